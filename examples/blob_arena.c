@@ -0,0 +1,100 @@
+/*
+ * blob_arena.c - caching config fragments with blob_memdup, an arena and
+ * an interning table
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "libubox/blobmsg.h"
+
+#define N_COPIES	200000
+#define N_DISTINCT	100
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_attr *copies[N_COPIES];
+	static struct blob_buf buf;
+	struct blob_attr *frag[N_DISTINCT], *cur, *dup;
+	const struct blob_attr *a, *b;
+	struct blob_arena arena;
+	struct blob_intern tbl;
+	double start, t_malloc, t_arena, t_intern;
+	char name[16];
+	void *c;
+	int i, rem;
+
+	blob_buf_init(&buf, 0);
+	for (i = 0; i < N_DISTINCT; i++) {
+		snprintf(name, sizeof(name), "lan%d", i);
+		c = blobmsg_open_table(&buf, name);
+		blobmsg_add_string(&buf, "proto", "static");
+		blobmsg_add_u32(&buf, "mtu", 1500);
+		blobmsg_close_table(&buf, c);
+	}
+
+	i = 0;
+	blob_for_each_attr(cur, buf.head, rem)
+		frag[i++] = cur;
+
+	start = now();
+	for (i = 0; i < N_COPIES; i++)
+		copies[i] = blob_memdup(frag[i % N_DISTINCT]);
+	for (i = 0; i < N_COPIES; i++)
+		free(copies[i]);
+	t_malloc = now() - start;
+
+	blob_arena_init(&arena, 0);
+	start = now();
+	for (i = 0; i < N_COPIES; i++)
+		copies[i] = blob_memdup_arena(&arena, frag[i % N_DISTINCT]);
+	blob_arena_free(&arena);
+	t_arena = now() - start;
+
+	blob_intern_init(&tbl, NULL);
+	start = now();
+	for (i = 0; i < N_COPIES; i++)
+		copies[i] = (struct blob_attr *) blob_intern_get(&tbl, frag[i % N_DISTINCT]);
+	t_intern = now() - start;
+
+	if (tbl.count != N_DISTINCT) {
+		fprintf(stderr, "expected %d interned copies, got %u\n", N_DISTINCT, tbl.count);
+		return 1;
+	}
+
+	dup = blob_memdup(frag[0]);
+	a = blob_intern_get(&tbl, frag[0]);
+	b = blob_intern_get(&tbl, dup);
+	free(dup);
+	if (a != b || !blob_attr_equal(a, frag[0])) {
+		fprintf(stderr, "identical fragments not shared\n");
+		return 1;
+	}
+	blob_intern_put(&tbl, a);
+	blob_intern_put(&tbl, b);
+
+	for (i = 0; i < N_COPIES; i++)
+		blob_intern_put(&tbl, copies[i]);
+
+	if (tbl.count) {
+		fprintf(stderr, "%u copies left after release\n", tbl.count);
+		return 1;
+	}
+
+	printf("blob_memdup        %8.1f ns/copy\n", t_malloc * 1e9 / N_COPIES);
+	printf("blob_memdup_arena  %8.1f ns/copy\n", t_arena * 1e9 / N_COPIES);
+	printf("blob_intern_get    %8.1f ns/copy, %d distinct copies stored\n",
+	       t_intern * 1e9 / N_COPIES, N_DISTINCT);
+
+	blob_intern_free(&tbl);
+	blob_buf_free(&buf);
+	return 0;
+}
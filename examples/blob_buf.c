@@ -0,0 +1,102 @@
+/*
+ * blob_buf.c - blob_buf growth benchmark
+ *
+ * builds 1 MB blobmsg messages out of small fields, once with the default
+ * geometric growth and once with the old fixed 256 byte step (plugged in
+ * through the grow hook), and once reusing the allocation between messages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libubox/blobmsg.h"
+
+#define MSG_SIZE	(1024 * 1024)
+#define ROUNDS		20
+
+static int reallocs;
+
+static bool linear_grow(struct blob_buf *buf, int minlen)
+{
+	int delta = ((minlen / 256) + 1) * 256;
+	void *new;
+
+	new = realloc(buf->buf, buf->buflen + delta);
+	if (!new)
+		return false;
+
+	memset((char *) new + buf->buflen, 0, delta);
+	buf->buf = new;
+	buf->buflen += delta;
+	reallocs++;
+	return true;
+}
+
+static bool counting_grow(struct blob_buf *buf, int minlen);
+static bool (*default_grow)(struct blob_buf *buf, int minlen);
+
+static bool counting_grow(struct blob_buf *buf, int minlen)
+{
+	reallocs++;
+	return default_grow(buf, minlen);
+}
+
+static void fill_message(struct blob_buf *buf)
+{
+	void *tbl;
+	int i = 0;
+
+	while (blob_pad_len(buf->head) < MSG_SIZE) {
+		tbl = blobmsg_open_table(buf, NULL);
+		blobmsg_add_u32(buf, "id", i++);
+		blobmsg_add_string(buf, "name", "eth0");
+		blobmsg_add_u64(buf, "rx_bytes", 1234567890ULL);
+		blobmsg_close_table(buf, tbl);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, bool (*grow)(struct blob_buf *, int), bool reuse)
+{
+	struct blob_buf buf = {};
+	double start;
+	int i;
+
+	reallocs = 0;
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		if (!reuse)
+			blob_buf_free(&buf);
+		buf.grow = grow;
+		blob_buf_init(&buf, BLOBMSG_TYPE_ARRAY);
+		fill_message(&buf);
+	}
+
+	printf("%-10s %8.3f ms/msg %8d reallocs/msg\n", name,
+	       (now() - start) * 1000 / ROUNDS, reallocs / ROUNDS);
+	blob_buf_free(&buf);
+}
+
+int main(int argc, char **argv)
+{
+	struct blob_buf buf = {};
+
+	/* pick up the library default grow function */
+	blob_buf_init(&buf, 0);
+	default_grow = buf.grow;
+	blob_buf_free(&buf);
+
+	run("linear", linear_grow, false);
+	run("geometric", counting_grow, false);
+	run("reuse", counting_grow, true);
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * blob_hash.c - blob_hash throughput compared to md5
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "libubox/blob.h"
+#include "libubox/md5.h"
+
+#define PAYLOAD		(1024 * 1024)
+#define ROUNDS		200
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf buf;
+	struct blob_attr *attr, *copy;
+	volatile uint64_t h = 0;
+	uint8_t digest[16];
+	md5_ctx_t ctx;
+	double start, t_hash, t_md5;
+	char *data;
+	int i;
+
+	/* reference values of the XXH64 algorithm */
+	if (blob_hash_data("", 0, 0) != 0xef46db3751d8e999ULL ||
+	    blob_hash_data("abc", 3, 0) != 0x44bc2cf5ad770999ULL) {
+		fprintf(stderr, "unexpected hash values\n");
+		return 1;
+	}
+
+	data = malloc(PAYLOAD);
+	for (i = 0; i < PAYLOAD; i++)
+		data[i] = i * 31;
+
+	blob_buf_init(&buf, 0);
+	attr = blob_put(&buf, 1, data, PAYLOAD);
+
+	copy = blob_memdup(attr);
+	if (!blob_attr_equal_hash(attr, blob_hash(attr), copy, blob_hash(copy))) {
+		fprintf(stderr, "copies do not match\n");
+		return 1;
+	}
+
+	copy->data[PAYLOAD / 2] ^= 1;
+	if (blob_hash(attr) == blob_hash(copy)) {
+		fprintf(stderr, "hash did not change\n");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		h += blob_hash(attr);
+	t_hash = now() - start;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		md5_begin(&ctx);
+		md5_hash(attr, blob_raw_len(attr), &ctx);
+		md5_end(digest, &ctx);
+	}
+	t_md5 = now() - start;
+
+	printf("blob_hash %8.1f MB/s\n", ROUNDS * PAYLOAD / t_hash / 1e6);
+	printf("md5       %8.1f MB/s\n", ROUNDS * PAYLOAD / t_md5 / 1e6);
+
+	free(copy);
+	free(data);
+	blob_buf_free(&buf);
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * blob_long.c - attributes beyond the 24 bit length field
+ *
+ * puts a single 20 MB payload and a table that grows past 16 MB one
+ * entry at a time, then walks both and checks every length. also parses
+ * long headers that claim less than their own size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libubox/blobmsg.h"
+
+#define BIG_LEN		(20 * 1024 * 1024)
+#define CHUNK_LEN	(64 * 1024)
+#define N_CHUNKS	300
+
+static int check_big(struct blob_attr *attr)
+{
+	const unsigned char *data = blobmsg_data(attr);
+	int i;
+
+	if (!blob_is_long(attr) || blobmsg_data_len(attr) != BIG_LEN) {
+		fprintf(stderr, "big: bad length %d\n", blobmsg_data_len(attr));
+		return 1;
+	}
+
+	for (i = 0; i < BIG_LEN; i += 4093) {
+		if (data[i] != (unsigned char) i) {
+			fprintf(stderr, "big: bad data at %d\n", i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_table(struct blob_attr *attr)
+{
+	struct blob_attr *cur;
+	char name[16];
+	int rem, n = 0;
+
+	if (!blob_is_long(attr) || !blobmsg_check_attr(attr, true)) {
+		fprintf(stderr, "table: bad header\n");
+		return 1;
+	}
+
+	blobmsg_for_each_attr(cur, attr, rem) {
+		snprintf(name, sizeof(name), "c%d", n);
+		if (strcmp(blobmsg_name(cur), name) ||
+		    blobmsg_data_len(cur) != CHUNK_LEN ||
+		    *(unsigned char *) blobmsg_data(cur) != (unsigned char) n) {
+			fprintf(stderr, "table: bad entry %d\n", n);
+			return 1;
+		}
+		n++;
+	}
+
+	if (n != N_CHUNKS) {
+		fprintf(stderr, "table: %d entries, expected %d\n", n, N_CHUNKS);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int check_short(void)
+{
+	static const struct blob_attr_info info[2] = {
+		[1] = { .type = BLOB_ATTR_STRING },
+	};
+	struct blob_attr *tb[2];
+	uint32_t msg[6];
+	unsigned int len;
+
+	/* a root that claims 4 bytes behind a long header */
+	msg[0] = cpu_to_be32((1 << BLOB_ATTR_ID_SHIFT) | BLOB_ATTR_LEN_LONG);
+	msg[1] = cpu_to_be32(4);
+	msg[2] = cpu_to_be32((1 << BLOB_ATTR_ID_SHIFT) | 8);
+	if (blob_len((struct blob_attr *) msg) ||
+	    blob_parse((struct blob_attr *) msg, tb, info, 2)) {
+		fprintf(stderr, "short long root accepted\n");
+		return 1;
+	}
+
+	/*
+	 * a child that does the same, each length word up to 7, and one whose
+	 * padded length wraps around to 0
+	 */
+	for (len = 0; len < 9; len++) {
+		msg[0] = cpu_to_be32(sizeof(msg));
+		msg[1] = cpu_to_be32((1 << BLOB_ATTR_ID_SHIFT) | BLOB_ATTR_LEN_LONG);
+		msg[2] = cpu_to_be32(len < 8 ? len : 0xfffffffd);
+		msg[3] = cpu_to_be32(0x41414141);
+		msg[4] = msg[5] = msg[3];
+		if (blob_parse((struct blob_attr *) msg, tb, info, 2)) {
+			fprintf(stderr, "short long child (%u) accepted\n", len);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf b;
+	static unsigned char chunk[CHUNK_LEN];
+	struct blob_attr *tb[3];
+	unsigned char *data;
+	char name[16];
+	void *c;
+	int i, ret = 0;
+
+	static const struct blobmsg_policy policy[3] = {
+		{ .name = "big", .type = BLOBMSG_TYPE_UNSPEC },
+		{ .name = "table", .type = BLOBMSG_TYPE_TABLE },
+		{ .name = "tail", .type = BLOBMSG_TYPE_INT32 },
+	};
+
+	blobmsg_buf_init(&b);
+
+	data = malloc(BIG_LEN);
+	if (!data)
+		return 1;
+	for (i = 0; i < BIG_LEN; i++)
+		data[i] = i;
+	blobmsg_add_field(&b, BLOBMSG_TYPE_UNSPEC, "big", data, BIG_LEN);
+	free(data);
+
+	c = blobmsg_open_table(&b, "table");
+	for (i = 0; i < N_CHUNKS; i++) {
+		memset(chunk, i, sizeof(chunk));
+		snprintf(name, sizeof(name), "c%d", i);
+		blobmsg_add_field(&b, BLOBMSG_TYPE_UNSPEC, name, chunk, sizeof(chunk));
+	}
+	blobmsg_close_table(&b, c);
+
+	blobmsg_add_u32(&b, "tail", 0xdeadbeef);
+
+	printf("message: %u bytes, root long: %d\n",
+	       blob_raw_len(b.head), blob_is_long(b.head));
+
+	blobmsg_parse(policy, 3, tb, blob_data(b.head), blob_len(b.head));
+	if (!tb[0] || !tb[1] || !tb[2]) {
+		fprintf(stderr, "parse: missing attributes\n");
+		ret = 1;
+		goto out;
+	}
+
+	ret |= check_short();
+	ret |= check_big(tb[0]);
+	ret |= check_table(tb[1]);
+	if (blobmsg_get_u32(tb[2]) != 0xdeadbeef) {
+		fprintf(stderr, "tail: bad value\n");
+		ret = 1;
+	}
+
+	printf("%s\n", ret ? "FAIL" : "OK");
+out:
+	blob_buf_free(&b);
+	return ret;
+}
@@ -0,0 +1,220 @@
+/*
+ * blob_native.c - big endian vs. host byte order blob messages
+ *
+ * builds the same message in both formats, checks that blob_convert()
+ * turns one into the other and times a read pass over each. also parses a
+ * nested native attribute, makes sure blobmsg refuses native buffers, that
+ * native messages stop at 16 MB and that blob_parse() reads blobmsg
+ * attributes as big endian.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "libubox/blob.h"
+#include "libubox/blobmsg.h"
+
+#define N_ATTRS		4096
+#define ROUNDS		2000
+
+enum {
+	ATTR_U32,
+	ATTR_U64,
+	ATTR_NEST,
+	__ATTR_MAX
+};
+
+static const struct blob_attr_info info[__ATTR_MAX] = {
+	[ATTR_U32] = { .type = BLOB_ATTR_INT32 },
+	[ATTR_U64] = { .type = BLOB_ATTR_INT64 },
+	[ATTR_NEST] = { .type = BLOB_ATTR_NESTED },
+};
+
+static void fill(struct blob_buf *buf, bool native)
+{
+	void *c;
+	int i;
+
+	if (native)
+		blob_buf_init_native(buf, 0);
+	else
+		blob_buf_init(buf, 0);
+
+	for (i = 0; i < N_ATTRS; i++) {
+		blob_put_u32(buf, ATTR_U32, i);
+		c = blob_nest_start(buf, ATTR_NEST);
+		blob_put_u64(buf, ATTR_U64, (uint64_t) i << 32);
+		blob_nest_end(buf, c);
+	}
+}
+
+static uint64_t sum_be(struct blob_attr *root)
+{
+	struct blob_attr *cur, *sub;
+	uint64_t sum = 0;
+	int rem, rem2;
+
+	blob_for_each_attr(cur, root, rem) {
+		if (blob_id(cur) == ATTR_U32)
+			sum += blob_get_u32(cur);
+		else if (blob_id(cur) == ATTR_NEST)
+			blob_for_each_attr(sub, cur, rem2)
+				sum += blob_get_u64(sub) >> 32;
+	}
+
+	return sum;
+}
+
+static uint64_t sum_native(struct blob_attr *root)
+{
+	struct blob_attr *cur, *sub;
+	uint64_t sum = 0;
+	int rem, rem2;
+
+	blob_for_each_root_attr_native(cur, root, rem) {
+		if (blob_native_id(cur) == ATTR_U32)
+			sum += blob_native_get_u32(cur);
+		else if (blob_native_id(cur) == ATTR_NEST)
+			blob_for_each_attr_native(sub, cur, rem2)
+				sum += blob_native_get_u64(sub) >> 32;
+	}
+
+	return sum;
+}
+
+/* an extended (blobmsg style) attribute must not look like a native root */
+static int check_blobmsg(void)
+{
+	static struct blob_buf b;
+	struct blob_attr *tb[__ATTR_MAX], *tbl;
+	void *c;
+	int ret = 0;
+
+	blob_buf_init(&b, 0);
+	c = blob_nest_start(&b, ATTR_NEST);
+	blob_put_u32(&b, ATTR_U32, 0x12345678);
+	blob_nest_end(&b, c);
+
+	tbl = blob_data(b.head);
+	tbl->id_len |= cpu_to_be32(BLOB_ATTR_EXTENDED);
+	if (blob_parse(tbl, tb, info, __ATTR_MAX) != 1 ||
+	    blob_get_u32(tb[ATTR_U32]) != 0x12345678) {
+		fprintf(stderr, "blob_parse misread a blobmsg table\n");
+		ret = 1;
+	}
+
+	blob_buf_free(&b);
+	return ret;
+}
+
+/* native headers have no long form */
+static int check_limit(void)
+{
+	static struct blob_buf b;
+	int half = (BLOB_ATTR_LEN_MASK / 2 + 16) & ~3;
+	int ret = 0;
+	void *c;
+
+	blob_buf_init_native(&b, 0);
+	if (blob_put(&b, ATTR_U32, NULL, BLOB_ATTR_LEN_MASK + 1)) {
+		fprintf(stderr, "native buffer took a 16 MB attribute\n");
+		ret = 1;
+	}
+
+	/* neither may the container around two smaller ones */
+	c = blob_nest_start(&b, ATTR_NEST);
+	if (!c || !blob_put(&b, ATTR_U32, NULL, half) ||
+	    blob_put(&b, ATTR_U32, NULL, half)) {
+		fprintf(stderr, "native nested limit not enforced\n");
+		ret = 1;
+	}
+	if (c)
+		blob_nest_end(&b, c);
+
+	if (blob_native_len(blob_data(b.head)) != (unsigned int) half + 4) {
+		fprintf(stderr, "native container has length %u\n",
+			blob_native_len(blob_data(b.head)));
+		ret = 1;
+	}
+
+	blob_buf_free(&b);
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf be, native;
+	struct blob_attr *tb[__ATTR_MAX], *nest[__ATTR_MAX];
+	uint64_t expect = 2 * ((uint64_t) N_ATTRS * (N_ATTRS - 1) / 2);
+	volatile uint64_t sum = 0;
+	double start, t_be, t_native;
+	int i;
+
+	fill(&be, false);
+	fill(&native, true);
+
+	if (!native.native || be.native ||
+	    sum_be(be.head) != expect || sum_native(native.head) != expect) {
+		fprintf(stderr, "unexpected message contents\n");
+		return 1;
+	}
+
+	if (blob_parse_root_native(native.head, tb, info, __ATTR_MAX) != 2 ||
+	    blob_native_get_u32(tb[ATTR_U32]) != N_ATTRS - 1) {
+		fprintf(stderr, "blob_parse failed on the native message\n");
+		return 1;
+	}
+
+	/* the nested attribute has a host order header */
+	if (blob_parse_native(tb[ATTR_NEST], nest, info, __ATTR_MAX) != 1 ||
+	    blob_native_get_u64(nest[ATTR_U64]) != (uint64_t) (N_ATTRS - 1) << 32) {
+		fprintf(stderr, "blob_parse_native failed on the nested table\n");
+		return 1;
+	}
+
+	if (!blobmsg_add_string(&native, "name", "value") ||
+	    blobmsg_open_table(&native, "table")) {
+		fprintf(stderr, "blobmsg accepted a native buffer\n");
+		return 1;
+	}
+
+	if (check_blobmsg() || check_limit())
+		return 1;
+
+	if (blob_convert(native.head, info, __ATTR_MAX, false) ||
+	    !blob_attr_equal(native.head, be.head)) {
+		fprintf(stderr, "conversion to big endian failed\n");
+		return 1;
+	}
+
+	if (blob_convert(native.head, info, __ATTR_MAX, true) ||
+	    sum_native(native.head) != expect) {
+		fprintf(stderr, "conversion to host byte order failed\n");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		sum += sum_be(be.head);
+	t_be = now() - start;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		sum += sum_native(native.head);
+	t_native = now() - start;
+
+	printf("big endian  %8.1f us/msg\n", t_be * 1e6 / ROUNDS);
+	printf("host order  %8.1f us/msg\n", t_native * 1e6 / ROUNDS);
+
+	blob_buf_free(&be);
+	blob_buf_free(&native);
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * blob_stream.c - stream one large blobmsg array through an in-memory pipe
+ *
+ * the writer adds array entries whenever the stream has drained and
+ * flushes with the array open, now and then even halfway through an
+ * entry. The reader gets the array entries one by one from
+ * blob_stream_read(), reassembled where they were split. Compares the peak
+ * blob_buf size with the size of the whole reply.
+ */
+
+#include <stdio.h>
+
+#include "libubox/blobmsg.h"
+#include "libubox/blob_stream.h"
+
+#define N_ENTRIES	100000
+#define BATCH		256
+#define FLUSH_EVERY	16
+#define SPLIT_EVERY	7
+#define HIGH_WATER	(64 * 1024)
+
+enum {
+	ROUTE_DEV,
+	ROUTE_METRIC,
+	__ROUTE_MAX
+};
+
+static const struct blobmsg_policy route_policy[__ROUTE_MAX] = {
+	[ROUTE_DEV] = { "dev", BLOBMSG_TYPE_STRING },
+	[ROUTE_METRIC] = { "metric", BLOBMSG_TYPE_INT32 },
+};
+
+static struct ustream_pipe writer, reader;
+static struct blob_stream bs;
+static struct blob_stream_reader reader_bs;
+static void *routes;
+static int produced, peak, errors;
+static int frames, split_frames, entries;
+static bool done;
+
+static int flush(void)
+{
+	int ret;
+
+	if (bs.buf.buflen > peak)
+		peak = bs.buf.buflen;
+
+	ret = blob_stream_flush(&bs);
+	if (ret < 0) {
+		fprintf(stderr, "write failed\n");
+		errors++;
+		uloop_end();
+	} else if (ret) {
+		frames++;
+	}
+
+	return ret;
+}
+
+static void produce(void)
+{
+	void *tbl;
+	int i;
+
+	if (!produced) {
+		blobmsg_add_string(&bs.buf, "begin", "routes");
+		routes = blobmsg_open_array(&bs.buf, "routes");
+	}
+
+	for (i = 0; i < BATCH && produced < N_ENTRIES; i++, produced++) {
+		tbl = blobmsg_open_table(&bs.buf, NULL);
+		blobmsg_add_string(&bs.buf, "dev", "eth0");
+		if (!(produced % SPLIT_EVERY) && flush() > 0)
+			split_frames++;
+		blobmsg_add_u32(&bs.buf, "metric", produced);
+		blobmsg_close_table(&bs.buf, tbl);
+
+		if (!(produced % FLUSH_EVERY))
+			flush();
+	}
+
+	if (produced < N_ENTRIES)
+		return;
+
+	blobmsg_close_array(&bs.buf, routes);
+	blobmsg_add_string(&bs.buf, "end", "routes");
+	if (blob_stream_finish(&bs)) {
+		fprintf(stderr, "finish failed\n");
+		errors++;
+		uloop_end();
+		return;
+	}
+	frames++;
+}
+
+static void writer_notify_write(struct ustream *s, int bytes)
+{
+	if (produced < N_ENTRIES && s->w.data_bytes < HIGH_WATER)
+		produce();
+}
+
+static void read_entry(struct blob_stream_reader *r, struct blob_attr *attr)
+{
+	struct blob_attr *tb[__ROUTE_MAX];
+
+	if (r->depth == 1) {
+		if (!strcmp(blobmsg_name(attr), "end"))
+			done = true;
+		return;
+	}
+
+	if (r->depth != 2 || strcmp(blobmsg_name(r->path[1]), "routes")) {
+		fprintf(stderr, "unexpected entry %s at depth %d\n",
+			blobmsg_name(attr), r->depth);
+		errors++;
+		return;
+	}
+
+	/* entries split across frames arrive reassembled */
+	blobmsg_parse(route_policy, __ROUTE_MAX, tb, blobmsg_data(attr),
+		      blobmsg_data_len(attr));
+	if (!tb[ROUTE_DEV] || !tb[ROUTE_METRIC]) {
+		fprintf(stderr, "entry %d is incomplete\n", entries);
+		errors++;
+		return;
+	}
+
+	if (blobmsg_get_u32(tb[ROUTE_METRIC]) != entries) {
+		fprintf(stderr, "metric %u, expected %d\n",
+			blobmsg_get_u32(tb[ROUTE_METRIC]), entries);
+		errors++;
+	}
+	entries++;
+}
+
+static void reader_notify_read(struct ustream *s, int bytes)
+{
+	if (blob_stream_read(&reader_bs, s)) {
+		fprintf(stderr, "malformed stream\n");
+		errors++;
+		done = true;
+	}
+
+	if (done)
+		uloop_end();
+}
+
+int main(int argc, char **argv)
+{
+	uloop_init();
+
+	writer.stream.notify_write = writer_notify_write;
+	reader.stream.notify_read = reader_notify_read;
+	ustream_pipe_pair(&writer, &reader);
+	blob_stream_reader_init(&reader_bs, 2, read_entry);
+
+	blob_stream_init(&bs, &writer.stream, BLOBMSG_TYPE_TABLE);
+	produce();
+	uloop_run();
+
+	if (entries != N_ENTRIES || !done) {
+		fprintf(stderr, "%d/%d entries, end %sseen\n",
+			entries, N_ENTRIES, done ? "" : "not ");
+		errors++;
+	}
+
+	if (!split_frames) {
+		fprintf(stderr, "no frame ended inside an entry\n");
+		errors++;
+	}
+
+	/* the array alone is far larger than the buffer ever got */
+	if (peak * 100 > (int) bs.bytes) {
+		fprintf(stderr, "peak blob_buf %d bytes for %zu bytes streamed\n",
+			peak, bs.bytes);
+		errors++;
+	}
+
+	printf("%d entries in %d frames, %zu bytes streamed, peak blob_buf %d bytes: %s\n",
+	       entries, frames, bs.bytes, peak, errors ? "FAILED" : "ok");
+
+	blob_stream_free(&bs);
+	blob_stream_reader_free(&reader_bs);
+	ustream_free(&writer.stream);
+	ustream_free(&reader.stream);
+	uloop_done();
+
+	return errors ? 1 : 0;
+}
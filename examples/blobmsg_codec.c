@@ -0,0 +1,139 @@
+/*
+ * blobmsg_codec.c - generated struct codec compared to blobmsg_parse
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "libubox/blobmsg_codec.h"
+
+#define ROUNDS		200000
+
+#define IFACE_FIELDS(F) \
+	F(STRING, name, true) \
+	F(STRING, proto, true) \
+	F(BOOL, up, false) \
+	F(INT32, mtu, false) \
+	F(INT64, rx_bytes, false) \
+	F(INT64, tx_bytes, false) \
+	F(ARRAY, dns, false)
+
+BLOBMSG_CODEC_DECLARE(iface, IFACE_FIELDS)
+BLOBMSG_CODEC_DEFINE(iface, IFACE_FIELDS)
+
+enum {
+	IFACE_NAME,
+	IFACE_PROTO,
+	IFACE_UP,
+	IFACE_MTU,
+	IFACE_RX,
+	IFACE_TX,
+	IFACE_DNS,
+	__IFACE_MAX
+};
+
+static const struct blobmsg_policy iface_policy[__IFACE_MAX] = {
+	[IFACE_NAME] = { "name", BLOBMSG_TYPE_STRING },
+	[IFACE_PROTO] = { "proto", BLOBMSG_TYPE_STRING },
+	[IFACE_UP] = { "up", BLOBMSG_TYPE_BOOL },
+	[IFACE_MTU] = { "mtu", BLOBMSG_TYPE_INT32 },
+	[IFACE_RX] = { "rx_bytes", BLOBMSG_TYPE_INT64 },
+	[IFACE_TX] = { "tx_bytes", BLOBMSG_TYPE_INT64 },
+	[IFACE_DNS] = { "dns", BLOBMSG_TYPE_ARRAY },
+};
+
+/* the hand written equivalent of iface_decode() */
+static int decode_by_hand(struct iface *msg, struct blob_attr *attr)
+{
+	struct blob_attr *tb[__IFACE_MAX];
+
+	memset(msg, 0, sizeof(*msg));
+	blobmsg_parse(iface_policy, __IFACE_MAX, tb, blobmsg_data(attr),
+		      blobmsg_data_len(attr));
+	if (!tb[IFACE_NAME] || !tb[IFACE_PROTO])
+		return -1;
+
+	msg->name = blobmsg_get_string(tb[IFACE_NAME]);
+	msg->proto = blobmsg_get_string(tb[IFACE_PROTO]);
+	if ((msg->has_up = !!tb[IFACE_UP]))
+		msg->up = blobmsg_get_bool(tb[IFACE_UP]);
+	if ((msg->has_mtu = !!tb[IFACE_MTU]))
+		msg->mtu = blobmsg_get_u32(tb[IFACE_MTU]);
+	if ((msg->has_rx_bytes = !!tb[IFACE_RX]))
+		msg->rx_bytes = blobmsg_get_u64(tb[IFACE_RX]);
+	if ((msg->has_tx_bytes = !!tb[IFACE_TX]))
+		msg->tx_bytes = blobmsg_get_u64(tb[IFACE_TX]);
+	if ((msg->has_dns = !!tb[IFACE_DNS]))
+		msg->dns = tb[IFACE_DNS];
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf buf, out;
+	struct iface msg, msg2;
+	double start, t_hand, t_codec;
+	void *c;
+	int i;
+
+	blobmsg_buf_init(&buf);
+	blobmsg_add_string(&buf, "name", "wan");
+	blobmsg_add_string(&buf, "proto", "dhcp");
+	blobmsg_add_u8(&buf, "up", 1);
+	blobmsg_add_u32(&buf, "mtu", 1500);
+	blobmsg_add_u64(&buf, "rx_bytes", 1ULL << 40);
+	c = blobmsg_open_array(&buf, "dns");
+	blobmsg_add_string(&buf, NULL, "192.0.2.1");
+	blobmsg_close_array(&buf, c);
+
+	if (iface_decode(&msg, buf.head) || strcmp(msg.name, "wan") ||
+	    !msg.up || msg.mtu != 1500 || msg.rx_bytes != 1ULL << 40 ||
+	    msg.has_tx_bytes || !msg.has_dns) {
+		fprintf(stderr, "decode failed\n");
+		return 1;
+	}
+
+	/* encode and decode again */
+	blobmsg_buf_init(&out);
+	if (iface_encode(&out, &msg) || iface_decode(&msg2, out.head) ||
+	    strcmp(msg2.proto, "dhcp") || msg2.mtu != 1500 ||
+	    blobmsg_check_array(msg2.dns, BLOBMSG_TYPE_STRING) != 1) {
+		fprintf(stderr, "round trip failed\n");
+		return 1;
+	}
+
+	/* required fields */
+	msg.has_proto = false;
+	blobmsg_buf_init(&out);
+	iface_encode(&out, &msg);
+	if (!iface_decode(&msg2, out.head)) {
+		fprintf(stderr, "missing required field not detected\n");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		decode_by_hand(&msg, buf.head);
+	t_hand = now() - start;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		iface_decode(&msg, buf.head);
+	t_codec = now() - start;
+
+	printf("blobmsg_parse + getters %8.1f ns/msg\n", t_hand * 1e9 / ROUNDS);
+	printf("iface_decode            %8.1f ns/msg\n", t_codec * 1e9 / ROUNDS);
+
+	blob_buf_free(&buf);
+	blob_buf_free(&out);
+	return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * blobmsg_diff.c - state snapshot deltas with blobmsg_diff/blobmsg_patch
+ *
+ * builds two snapshots that differ in a few fields, sends the change set
+ * instead of the full snapshot and checks that patching restores it. also
+ * covers layout only changes, malformed nested tables and diffs, and
+ * dropping a layout only change from a change set past 16 MB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "libubox/json.h"
+#include "libubox/blobmsg.h"
+#include "libubox/blobmsg_json.h"
+
+#define N_IFACES	256
+
+static void snapshot(struct blob_buf *buf, int gen)
+{
+	char name[16];
+	void *ifaces, *iface;
+	int i;
+
+	blobmsg_buf_init(buf);
+	blobmsg_add_string(buf, "host", "gw1");
+	blobmsg_add_u32(buf, "uptime", 1000 + gen);
+	if (!gen)
+		blobmsg_add_string(buf, "boot", "cold");
+
+	ifaces = blobmsg_open_table(buf, "interfaces");
+	for (i = 0; i < N_IFACES; i++) {
+		snprintf(name, sizeof(name), "eth%d", i);
+		iface = blobmsg_open_table(buf, name);
+		blobmsg_add_u8(buf, "up", !(gen && i == 7));
+		blobmsg_add_u64(buf, "rx_bytes", 1000 * i + (i == 3 ? gen : 0));
+		blobmsg_add_u64(buf, "tx_bytes", 10 * i);
+		blobmsg_close_table(buf, iface);
+	}
+	blobmsg_close_table(buf, ifaces);
+
+	if (gen)
+		blobmsg_add_string(buf, "alarm", "link down on eth7");
+}
+
+/* nested tables that only differ in member order produce no change set */
+static int check_layout(struct blob_buf *a, struct blob_buf *b, struct blob_buf *diff)
+{
+	void *c;
+
+	blobmsg_buf_init(a);
+	c = blobmsg_open_table(a, "t");
+	blobmsg_add_u32(a, "x", 1);
+	blobmsg_add_u32(a, "y", 2);
+	blobmsg_close_table(a, c);
+
+	blobmsg_buf_init(b);
+	c = blobmsg_open_table(b, "t");
+	blobmsg_add_u32(b, "y", 2);
+	blobmsg_add_u32(b, "x", 1);
+	blobmsg_close_table(b, c);
+
+	blobmsg_buf_init(diff);
+	if (blobmsg_diff(a->head, b->head, diff) != 0 || blob_len(diff->head)) {
+		fprintf(stderr, "layout only change produced output\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* a malformed nested table fails, with every table in out closed again */
+static int check_errors(struct blob_buf *bad, struct blob_buf *diff, struct blob_buf *out)
+{
+	static struct blob_buf good;
+	/* a member whose name runs past its end */
+	uint32_t garbage[2] = {
+		cpu_to_be32(BLOB_ATTR_EXTENDED | (BLOBMSG_TYPE_STRING << BLOB_ATTR_ID_SHIFT) | 8),
+		cpu_to_be32(0x00ff0000),
+	};
+	void *c, *m;
+
+	blobmsg_buf_init(bad);
+	blobmsg_add_field(bad, BLOBMSG_TYPE_TABLE, "t", garbage, sizeof(garbage));
+
+	blobmsg_buf_init(&good);
+	c = blobmsg_open_table(&good, "t");
+	blobmsg_add_u32(&good, "x", 1);
+	blobmsg_close_table(&good, c);
+
+	blobmsg_buf_init(diff);
+	c = blobmsg_open_table(diff, "mod");
+	m = blobmsg_open_table(diff, "t");
+	blobmsg_add_u32(diff, "set", 0);
+	blobmsg_close_table(diff, m);
+	blobmsg_close_table(diff, c);
+
+	blobmsg_buf_init(out);
+	if (blobmsg_patch(bad->head, diff->head, out) != -1 ||
+	    out->head != (struct blob_attr *) out->buf) {
+		fprintf(stderr, "nested patch error not handled\n");
+		return 1;
+	}
+
+	blobmsg_buf_init(out);
+	if (blobmsg_diff(bad->head, good.head, out) != -1 ||
+	    out->head != (struct blob_attr *) out->buf) {
+		fprintf(stderr, "nested diff error not handled\n");
+		return 1;
+	}
+
+	/* "set" has to be a table */
+	blobmsg_buf_init(diff);
+	c = blobmsg_open_table(diff, "mod");
+	m = blobmsg_open_table(diff, "t");
+	blobmsg_add_u32(diff, "set", 0);
+	blobmsg_close_table(diff, m);
+	blobmsg_close_table(diff, c);
+
+	blobmsg_buf_init(out);
+	if (blobmsg_patch(good.head, diff->head, out) != -1) {
+		fprintf(stderr, "malformed diff accepted\n");
+		return 1;
+	}
+
+	/* a diff table that does not parse */
+	blobmsg_buf_init(diff);
+	blobmsg_add_field(diff, BLOBMSG_TYPE_TABLE, "mod", garbage, sizeof(garbage));
+
+	blobmsg_buf_init(out);
+	if (blobmsg_patch(good.head, diff->head, out) != -1) {
+		fprintf(stderr, "unparsable diff accepted\n");
+		return 1;
+	}
+
+	blob_buf_free(&good);
+	return 0;
+}
+
+static void big_pair(struct blob_buf *a, struct blob_buf *b, char *str)
+{
+	void *c;
+
+	blobmsg_buf_init(a);
+	c = blobmsg_open_table(a, "a");
+	blobmsg_add_string(a, "x", "short");
+	blobmsg_close_table(a, c);
+	c = blobmsg_open_table(a, "b");
+	blobmsg_add_u32(a, "p", 1);
+	blobmsg_add_u32(a, "q", 2);
+	blobmsg_close_table(a, c);
+
+	blobmsg_buf_init(b);
+	c = blobmsg_open_table(b, "a");
+	blobmsg_add_string(b, "x", str);
+	blobmsg_close_table(b, c);
+	c = blobmsg_open_table(b, "b");
+	blobmsg_add_u32(b, "q", 2);
+	blobmsg_add_u32(b, "p", 1);
+	blobmsg_close_table(b, c);
+}
+
+/*
+ * the "mod" table switches to the long header when the layout only change
+ * of "b" is added, dropping it again must restore the short header and not
+ * leave anything behind
+ */
+static int check_long_rollback(struct blob_buf *a, struct blob_buf *b, struct blob_buf *diff)
+{
+	struct blob_attr *mod, *cur;
+	int len = 1000, n = 0, rem;
+	char *str;
+
+	str = malloc(BLOB_ATTR_LEN_MASK);
+	memset(str, 'x', BLOB_ATTR_LEN_MASK - 1);
+	str[BLOB_ATTR_LEN_MASK - 1] = 0;
+
+	/* size the change to "a" so that "mod" ends up just below 16 MB */
+	str[len] = 0;
+	big_pair(a, b, str);
+	blobmsg_buf_init(diff);
+	blobmsg_diff(a->head, b->head, diff);
+	str[len] = 'x';
+	len += BLOB_ATTR_LEN_MASK - 3 - blob_raw_len(blob_data(diff->head));
+	str[len] = 0;
+
+	big_pair(a, b, str);
+	blobmsg_buf_init(diff);
+	if (blobmsg_diff(a->head, b->head, diff) != 1) {
+		fprintf(stderr, "unexpected change count for the large diff\n");
+		free(str);
+		return 1;
+	}
+
+	mod = blob_data(diff->head);
+	blobmsg_for_each_attr(cur, mod, rem)
+		n++;
+
+	free(str);
+	if (n != 1 || blob_is_long(mod)) {
+		fprintf(stderr, "large change set has %d members (long %d)\n",
+			n, blob_is_long(mod));
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf old, new, diff, patched;
+	char *str;
+	int n;
+
+	snapshot(&old, 0);
+	snapshot(&new, 1);
+
+	blobmsg_buf_init(&diff);
+	n = blobmsg_diff(old.head, new.head, &diff);
+	if (n != 5) {
+		fprintf(stderr, "expected 5 changes, got %d\n", n);
+		return 1;
+	}
+
+	str = blobmsg_format_json(diff.head, true);
+	printf("diff: %s\n", str);
+	free(str);
+	printf("full snapshot %u bytes, change set %u bytes\n",
+	       blob_raw_len(new.head), blob_raw_len(diff.head));
+
+	blobmsg_buf_init(&patched);
+	if (blobmsg_patch(old.head, diff.head, &patched) ||
+	    !blob_attr_equal(patched.head, new.head)) {
+		fprintf(stderr, "patched snapshot differs\n");
+		return 1;
+	}
+
+	blobmsg_buf_init(&diff);
+	if (blobmsg_diff(new.head, patched.head, &diff) != 0) {
+		fprintf(stderr, "identical snapshots produced changes\n");
+		return 1;
+	}
+
+	if (check_layout(&old, &new, &diff) || check_errors(&old, &diff, &patched) ||
+	    check_long_rollback(&old, &new, &diff))
+		return 1;
+
+	blob_buf_free(&old);
+	blob_buf_free(&new);
+	blob_buf_free(&diff);
+	blob_buf_free(&patched);
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * blobmsg_format.c - blobmsg_format_json into a string vs. a sink
+ *
+ * formats a large status dump once as a string and once through
+ * blobmsg_format_json_sink(), checks that the sink sees the same text
+ * and prints the time per dump for both.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "libubox/json.h"
+#include "libubox/blobmsg.h"
+#include "libubox/blobmsg_json.h"
+
+#define N_ENTRIES	20000
+#define ROUNDS		20
+
+struct check {
+	const char *ref;
+	int pos;
+	int calls;
+	bool mismatch;
+};
+
+static int check_sink(void *priv, const char *data, int len)
+{
+	struct check *c = priv;
+
+	if (memcmp(c->ref + c->pos, data, len))
+		c->mismatch = true;
+
+	c->pos += len;
+	c->calls++;
+	return len;
+}
+
+static int null_sink(void *priv, const char *data, int len)
+{
+	return len;
+}
+
+static int short_sink(void *priv, const char *data, int len)
+{
+	return len / 2;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf b;
+	struct check c = {};
+	double start, t_str, t_sink;
+	void *list, *entry;
+	char *str, name[32];
+	int i, len = 0;
+
+	blobmsg_buf_init(&b);
+	list = blobmsg_open_array(&b, "interfaces");
+	for (i = 0; i < N_ENTRIES; i++) {
+		snprintf(name, sizeof(name), "wlan%d-\"%d\"", i / 4, i);
+		entry = blobmsg_open_table(&b, NULL);
+		blobmsg_add_string(&b, "name", name);
+		blobmsg_add_u8(&b, "up", i & 1);
+		blobmsg_add_u32(&b, "rx_packets", i * 1000);
+		blobmsg_add_u64(&b, "rx_bytes", (uint64_t) i << 32);
+		blobmsg_close_table(&b, entry);
+	}
+	blobmsg_close_array(&b, list);
+
+	str = blobmsg_format_json_indent(b.head, true, 0);
+	if (!str)
+		return 1;
+
+	c.ref = str;
+	len = blobmsg_format_json_sink(b.head, true, NULL, NULL, 0, check_sink, &c);
+	if (len != strlen(str) || c.pos != len || c.mismatch) {
+		fprintf(stderr, "sink output differs from the string\n");
+		return 1;
+	}
+
+	if (blobmsg_format_json_sink(b.head, true, NULL, NULL, -1, short_sink, NULL) >= 0) {
+		fprintf(stderr, "short write not reported\n");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		free(blobmsg_format_json(b.head, true));
+	t_str = now() - start;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		blobmsg_format_json_sink(b.head, true, NULL, NULL, -1, null_sink, NULL);
+	t_sink = now() - start;
+
+	printf("%u bytes of blobmsg -> %d bytes of JSON, %d sink calls\n",
+	       blob_raw_len(b.head), len, c.calls);
+	printf("string  %8.2f ms/dump\n", t_str * 1e3 / ROUNDS);
+	printf("sink    %8.2f ms/dump\n", t_sink * 1e3 / ROUNDS);
+
+	free(str);
+	blob_buf_free(&b);
+	return 0;
+}
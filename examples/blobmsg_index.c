@@ -0,0 +1,152 @@
+/*
+ * blobmsg_index.c - random access into large blobmsg arrays and tables
+ *
+ * compares blobmsg_index lookups against walking the list and checks that
+ * the index is invalidated when the underlying blob_buf changes, is freed
+ * or reused for a new message.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "libubox/blobmsg.h"
+
+#define N_ENTRIES	50000
+#define LOOKUPS		2000
+
+static struct blob_attr *walk_get(struct blob_attr *attr, int n)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	blobmsg_for_each_attr(cur, attr, rem)
+		if (!n--)
+			return cur;
+
+	return NULL;
+}
+
+static struct blob_attr *walk_lookup(struct blob_attr *attr, const char *name)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	blobmsg_for_each_attr(cur, attr, rem)
+		if (!strcmp(blobmsg_name(cur), name))
+			return cur;
+
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf buf;
+	struct blobmsg_index arr, tbl;
+	struct blob_attr *a_attr, *t_attr, *cur;
+	double start, t_walk, t_idx;
+	char name[32];
+	void *c;
+	int i, n;
+
+	blobmsg_buf_init(&buf);
+	c = blobmsg_open_array(&buf, "array");
+	for (i = 0; i < N_ENTRIES; i++)
+		blobmsg_add_u32(&buf, NULL, i);
+	blobmsg_close_array(&buf, c);
+
+	c = blobmsg_open_table(&buf, "table");
+	for (i = 0; i < N_ENTRIES; i++) {
+		snprintf(name, sizeof(name), "host-%d", i);
+		blobmsg_add_u32(&buf, name, i);
+	}
+	blobmsg_close_table(&buf, c);
+
+	a_attr = walk_lookup(buf.head, "array");
+	t_attr = walk_lookup(buf.head, "table");
+	if (blobmsg_index_init(&arr, a_attr, NULL) ||
+	    blobmsg_index_init(&tbl, t_attr, &buf))
+		return 1;
+
+	for (i = 0; i < N_ENTRIES; i += 97) {
+		snprintf(name, sizeof(name), "host-%d", i);
+		if (blobmsg_get_u32(blobmsg_index_get(&arr, i)) != i ||
+		    blobmsg_get_u32(blobmsg_index_lookup(&tbl, name)) != i) {
+			fprintf(stderr, "wrong element %d\n", i);
+			return 1;
+		}
+	}
+	if (blobmsg_index_lookup(&tbl, "host-x") || blobmsg_index_get(&arr, N_ENTRIES)) {
+		fprintf(stderr, "found missing element\n");
+		return 1;
+	}
+
+	n = 0;
+	start = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		snprintf(name, sizeof(name), "host-%d", (i * 7919) % N_ENTRIES);
+		cur = walk_lookup(t_attr, name);
+		n += blobmsg_get_u32(walk_get(a_attr, blobmsg_get_u32(cur)));
+	}
+	t_walk = now() - start;
+
+	start = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		snprintf(name, sizeof(name), "host-%d", (i * 7919) % N_ENTRIES);
+		cur = blobmsg_index_lookup(&tbl, name);
+		n -= blobmsg_get_u32(blobmsg_index_get(&arr, blobmsg_get_u32(cur)));
+	}
+	t_idx = now() - start;
+
+	if (n) {
+		fprintf(stderr, "walk and index results differ\n");
+		return 1;
+	}
+
+	printf("walk   %10.1f ns/lookup\n", t_walk * 1e9 / LOOKUPS);
+	printf("index  %10.1f ns/lookup\n", t_idx * 1e9 / LOOKUPS);
+
+	/* any change to the buffer invalidates the table index */
+	blobmsg_add_string(&buf, "extra", "x");
+	if (blobmsg_index_valid(&tbl) || blobmsg_index_lookup(&tbl, "host-1")) {
+		fprintf(stderr, "index not invalidated\n");
+		return 1;
+	}
+
+	/* so do freeing the buffer and starting a new message in it */
+	blobmsg_index_free(&tbl);
+	if (blobmsg_index_init(&tbl, t_attr, &buf)) {
+		fprintf(stderr, "index rebuild failed\n");
+		return 1;
+	}
+
+	blob_buf_free(&buf);
+	if (blobmsg_index_valid(&tbl)) {
+		fprintf(stderr, "index valid after blob_buf_free\n");
+		return 1;
+	}
+
+	blobmsg_buf_init(&buf);
+	t_attr = blobmsg_open_table(&buf, "table");
+	blobmsg_close_table(&buf, t_attr);
+	t_attr = walk_lookup(buf.head, "table");
+	blobmsg_index_free(&tbl);
+	blobmsg_index_init(&tbl, t_attr, &buf);
+	blobmsg_buf_init(&buf);
+	if (blobmsg_index_valid(&tbl)) {
+		fprintf(stderr, "index valid after blob_buf_init\n");
+		return 1;
+	}
+
+	blobmsg_index_free(&arr);
+	blobmsg_index_free(&tbl);
+	blob_buf_free(&buf);
+	return 0;
+}
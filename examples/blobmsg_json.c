@@ -0,0 +1,134 @@
+/*
+ * blobmsg_json.c - JSON text to blobmsg, with and without struct json
+ *
+ * converts the same document through json_parse() + blobmsg_add_object()
+ * and through blobmsg_add_json_from_string(), checks that both produce
+ * the same message and prints the heap allocations and time per message.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "libubox/json.h"
+#include "libubox/blobmsg.h"
+#include "libubox/blobmsg_json.h"
+
+#define N_ENTRIES	64
+#define ROUNDS		2000
+
+static unsigned long n_alloc;
+
+static void *count_malloc(size_t size)
+{
+	n_alloc++;
+	return malloc(size);
+}
+
+static char *build_doc(void)
+{
+	char *doc = malloc(N_ENTRIES * 256 + 256), *s = doc;
+	int i;
+
+	s += sprintf(s, "{ \"text\": \"tab\\there, \\u00e9\\ud83d\\ude00 \\\"q\\\"\",\n"
+			"  \"numbers\": [ -12, 0, 3.75, 1e3, -2.5E-1 ],\n"
+			"  \"flags\": { \"on\": true, \"off\": false },\n"
+			"  \"entries\": [\n");
+	for (i = 0; i < N_ENTRIES; i++)
+		s += sprintf(s, "    { \"name\": \"eth0.%d\", \"id\": %d, \"up\": %s,"
+				" \"ports\": [ %d, %d, %d ] }%s\n",
+			     i, i, (i & 1) ? "true" : "false", i, i + 1, i + 2,
+			     i < N_ENTRIES - 1 ? "," : "");
+	sprintf(s, "  ]\n}\n");
+
+	return doc;
+}
+
+static bool convert_tree(struct blob_buf *b, const char *doc)
+{
+	struct json *obj;
+	bool ret;
+
+	obj = json_parse(doc);
+	if (!obj)
+		return false;
+
+	ret = obj->type == json_type_object && blobmsg_add_object(b, obj);
+	json_object_put(obj);
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct json_hooks hooks = {
+		.malloc_fn = count_malloc,
+		.free_fn = free,
+	};
+	static struct blob_buf tree, direct;
+	unsigned long alloc_tree, alloc_direct;
+	double start, t_tree, t_direct;
+	char *doc = build_doc();
+	int i;
+
+	json_init_hooks(&hooks);
+	blob_buf_init_size(&tree, 0, 64 * 1024);
+	blob_buf_init_size(&direct, 0, 64 * 1024);
+
+	blobmsg_buf_init(&tree);
+	blobmsg_buf_init(&direct);
+	if (!convert_tree(&tree, doc) ||
+	    !blobmsg_add_json_from_string(&direct, doc) ||
+	    !blob_attr_equal(tree.head, direct.head)) {
+		fprintf(stderr, "conversion results differ\n");
+		return 1;
+	}
+
+	blobmsg_buf_init(&direct);
+	if (blobmsg_add_json_from_string(&direct, "{ \"a\": null }") ||
+	    blobmsg_add_json_from_string(&direct, "[ 1 ]") ||
+	    blobmsg_add_json_from_string(&direct, "{ \"a\": [ 1, ] }") ||
+	    blobmsg_add_json_from_string(&direct, "{ \"a\": \"open }")) {
+		fprintf(stderr, "invalid input accepted\n");
+		return 1;
+	}
+
+	n_alloc = 0;
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		blobmsg_buf_init(&tree);
+		convert_tree(&tree, doc);
+	}
+	t_tree = now() - start;
+	alloc_tree = n_alloc;
+
+	n_alloc = 0;
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		blobmsg_buf_init(&direct);
+		blobmsg_add_json_from_string(&direct, doc);
+	}
+	t_direct = now() - start;
+	alloc_direct = n_alloc;
+
+	printf("%zu bytes of JSON -> %u bytes of blobmsg\n",
+	       strlen(doc), blob_raw_len(direct.head));
+	printf("json tree  %6lu allocs/msg  %8.2f us/msg\n",
+	       alloc_tree / ROUNDS, t_tree * 1e6 / ROUNDS);
+	printf("direct     %6lu allocs/msg  %8.2f us/msg\n",
+	       alloc_direct / ROUNDS, t_direct * 1e6 / ROUNDS);
+
+	blob_buf_free(&tree);
+	blob_buf_free(&direct);
+	free(doc);
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * blobmsg_parse.c - blobmsg_parse vs. blobmsg_parse_compiled
+ *
+ * parses a message against a 48 field policy with both variants, checks
+ * that they return the same attributes and prints the time per parse.
+ * a few malformed messages must be rejected (or accepted) by both alike.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "libubox/blobmsg.h"
+
+#define N_FIELDS	48
+#define ROUNDS		200000
+
+static struct blobmsg_policy policy[N_FIELDS];
+static char names[N_FIELDS][16];
+
+struct raw_hdr {
+	uint16_t namelen;
+	uint8_t name[2];
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare(struct blobmsg_policy_compiled *cp, const char *what,
+		   struct blob_attr *msg, int expect)
+{
+	struct blob_attr *tb[N_FIELDS], *tb_c[N_FIELDS];
+	int ret, ret_c;
+
+	ret = blobmsg_parse(policy, N_FIELDS, tb, blob_data(msg), blob_len(msg));
+	ret_c = blobmsg_parse_compiled(cp, tb_c, blob_data(msg), blob_len(msg));
+	if (ret == expect && ret_c == expect)
+		return 0;
+
+	fprintf(stderr, "%s: blobmsg_parse %d, compiled %d, expected %d\n",
+		what, ret, ret_c, expect);
+	return 1;
+}
+
+static int check_malformed(struct blobmsg_policy_compiled *cp)
+{
+	static struct blob_buf buf;
+	struct raw_hdr hdr = {};
+	int err = 0;
+
+	/* name length of a policy entry, but longer than the attribute */
+	blob_buf_init(&buf, 0);
+	blobmsg_add_string(&buf, "field_0", "value");
+	hdr.namelen = cpu_to_be16(strlen("field_10"));
+	blob_put(&buf, BLOBMSG_TYPE_STRING, &hdr, sizeof(hdr));
+	err |= compare(cp, "namelen past the end", buf.head, -1);
+
+	/* no entry has that name length, the attribute is ignored */
+	blob_buf_init(&buf, 0);
+	hdr.namelen = cpu_to_be16(3);
+	blob_put(&buf, BLOBMSG_TYPE_STRING, &hdr, sizeof(hdr));
+	err |= compare(cp, "unknown namelen past the end", buf.head, 0);
+
+	/* too short for a blobmsg header */
+	blob_buf_init(&buf, 0);
+	blob_put(&buf, BLOBMSG_TYPE_STRING, NULL, 0);
+	err |= compare(cp, "short attribute", buf.head, -1);
+
+	/* unterminated string under a name that merely has a known length */
+	blob_buf_init(&buf, 0);
+	blobmsg_add_field(&buf, BLOBMSG_TYPE_STRING, "field_x", "abcd", 4);
+	err |= compare(cp, "unterminated string", buf.head, -1);
+
+	/* the same with a type no entry of that length uses */
+	blob_buf_init(&buf, 0);
+	blobmsg_add_field(&buf, BLOBMSG_TYPE_TABLE, "field_x", "abcd", 4);
+	err |= compare(cp, "bad table, unused type", buf.head, 0);
+
+	blob_buf_free(&buf);
+
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	struct blobmsg_policy_compiled *cp;
+	struct blob_attr *tb[N_FIELDS], *tb_c[N_FIELDS];
+	static struct blob_buf buf;
+	double start, plain, compiled;
+	int i;
+
+	blobmsg_buf_init(&buf);
+	for (i = 0; i < N_FIELDS; i++) {
+		snprintf(names[i], sizeof(names[i]), "field_%d", i);
+		policy[i].name = names[i];
+		policy[i].type = (i & 1) ? BLOBMSG_TYPE_INT32 : BLOBMSG_TYPE_STRING;
+	}
+
+	/* fill in reverse order, plus a few fields the policy does not know */
+	for (i = N_FIELDS - 1; i >= 0; i--) {
+		if (i & 1)
+			blobmsg_add_u32(&buf, names[i], i);
+		else
+			blobmsg_add_string(&buf, names[i], "value");
+		if (!(i % 8))
+			blobmsg_add_string(&buf, "unknown", "x");
+	}
+
+	cp = blobmsg_policy_compile(policy, N_FIELDS);
+	if (!cp)
+		return 1;
+
+	blobmsg_parse(policy, N_FIELDS, tb, blob_data(buf.head), blob_len(buf.head));
+	blobmsg_parse_compiled(cp, tb_c, blob_data(buf.head), blob_len(buf.head));
+	for (i = 0; i < N_FIELDS; i++) {
+		if (!tb[i] || tb[i] != tb_c[i]) {
+			fprintf(stderr, "mismatch at field %d\n", i);
+			return 1;
+		}
+	}
+
+	if (check_malformed(cp))
+		return 1;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		blobmsg_parse(policy, N_FIELDS, tb, blob_data(buf.head), blob_len(buf.head));
+	plain = now() - start;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		blobmsg_parse_compiled(cp, tb_c, blob_data(buf.head), blob_len(buf.head));
+	compiled = now() - start;
+
+	printf("blobmsg_parse          %8.1f ns/msg\n", plain * 1e9 / ROUNDS);
+	printf("blobmsg_parse_compiled %8.1f ns/msg\n", compiled * 1e9 / ROUNDS);
+
+	blobmsg_policy_free(cp);
+	blob_buf_free(&buf);
+	return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * blobmsg_path.c - blobmsg path query example
+ *
+ * runs a few queries against a telemetry style message, checks the
+ * results and times a wildcard query against the hand written loop.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "libubox/blobmsg.h"
+#include "libubox/blobmsg_path.h"
+
+#define N_IFACES	64
+#define ROUNDS		20000
+
+static int failed;
+
+static void build(struct blob_buf *buf)
+{
+	char name[16];
+	void *list, *iface, *stats;
+	int i;
+
+	blobmsg_buf_init(buf);
+	blobmsg_add_string(buf, "host", "gw1");
+	list = blobmsg_open_array(buf, "interfaces");
+	for (i = 0; i < N_IFACES; i++) {
+		snprintf(name, sizeof(name), "eth%d", i);
+		iface = blobmsg_open_table(buf, NULL);
+		blobmsg_add_string(buf, "name", name);
+		blobmsg_add_u8(buf, "up", !(i % 4 == 3));
+		stats = blobmsg_open_table(buf, "stats");
+		blobmsg_add_u64(buf, "rx_bytes", 1000 * i);
+		blobmsg_add_u64(buf, "tx_bytes", 10 * i);
+		blobmsg_close_table(buf, stats);
+		blobmsg_close_table(buf, iface);
+	}
+	blobmsg_close_array(buf, list);
+}
+
+static void check(struct blob_attr *root, const char *path, int count, uint64_t sum)
+{
+	struct blobmsg_path *p = blobmsg_path_compile(path);
+	struct blob_attr *res[2 * N_IFACES];
+	uint64_t total = 0;
+	int i, n;
+
+	if (!p) {
+		fprintf(stderr, "FAIL: %s does not compile\n", path);
+		failed = 1;
+		return;
+	}
+
+	n = blobmsg_path_match(p, root, res, ARRAY_SIZE(res));
+	for (i = 0; i < n && i < ARRAY_SIZE(res); i++)
+		if (blobmsg_type(res[i]) == BLOBMSG_TYPE_INT64)
+			total += blobmsg_get_u64(res[i]);
+
+	if (n != count || total != sum) {
+		fprintf(stderr, "FAIL: %s: %d matches, sum %llu\n", path, n,
+			(unsigned long long) total);
+		failed = 1;
+	}
+
+	blobmsg_path_free(p);
+}
+
+static uint64_t sum_by_hand(struct blob_attr *root)
+{
+	enum { IFACES, __ROOT_MAX };
+	enum { STATS, __IFACE_MAX };
+	enum { RX, __STATS_MAX };
+	static const struct blobmsg_policy root_pol[] = {
+		[IFACES] = { "interfaces", BLOBMSG_TYPE_ARRAY },
+	};
+	static const struct blobmsg_policy iface_pol[] = {
+		[STATS] = { "stats", BLOBMSG_TYPE_TABLE },
+	};
+	static const struct blobmsg_policy stats_pol[] = {
+		[RX] = { "rx_bytes", BLOBMSG_TYPE_INT64 },
+	};
+	struct blob_attr *tb[1], *tb2[1], *tb3[1], *cur;
+	uint64_t sum = 0;
+	int rem;
+
+	blobmsg_parse(root_pol, 1, tb, blob_data(root), blob_len(root));
+	blobmsg_for_each_attr(cur, tb[IFACES], rem) {
+		blobmsg_parse(iface_pol, 1, tb2, blobmsg_data(cur), blobmsg_data_len(cur));
+		if (!tb2[STATS])
+			continue;
+		blobmsg_parse(stats_pol, 1, tb3, blobmsg_data(tb2[STATS]),
+			      blobmsg_data_len(tb2[STATS]));
+		if (tb3[RX])
+			sum += blobmsg_get_u64(tb3[RX]);
+	}
+
+	return sum;
+}
+
+static int sum_cb(struct blob_attr *attr, void *priv)
+{
+	*(uint64_t *) priv += blobmsg_get_u64(attr);
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf buf;
+	struct blobmsg_path *p;
+	uint64_t all = 1000ULL * N_IFACES * (N_IFACES - 1) / 2;
+	uint64_t down = 0, sum = 0, ref = 0;
+	double start, t_hand, t_path;
+	int i;
+
+	build(&buf);
+	for (i = 3; i < N_IFACES; i += 4)
+		down += 1000 * i;
+
+	check(buf.head, "interfaces[*].stats.rx_bytes", N_IFACES, all);
+	check(buf.head, "interfaces.*.stats.rx_bytes", N_IFACES, all);
+	check(buf.head, "interfaces[2].stats.rx_bytes", 1, 2000);
+	check(buf.head, "interfaces[name==\"eth5\"].stats[\"rx_bytes\"]", 1, 5000);
+	check(buf.head, "interfaces[up==false].stats.rx_bytes", N_IFACES / 4, down);
+	check(buf.head, "interfaces[*].stats[rx_bytes>=60000]", 0, 0);
+	check(buf.head, "interfaces[*].stats.*", 2 * N_IFACES, all + all / 100);
+	check(buf.head, "interfaces[99]", 0, 0);
+	check(buf.head, "host", 1, 0);
+	check(buf.head, "", 1, 0);
+	if (blobmsg_path_compile("interfaces[") || blobmsg_path_compile("a..b") ||
+	    blobmsg_path_compile("a[x ~ 1]")) {
+		fprintf(stderr, "FAIL: invalid path compiled\n");
+		failed = 1;
+	}
+
+	p = blobmsg_path_compile("interfaces[*].stats.rx_bytes");
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		ref += sum_by_hand(buf.head);
+	t_hand = now() - start;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		blobmsg_path_eval(p, buf.head, sum_cb, &sum);
+	t_path = now() - start;
+
+	if (sum != ref)
+		failed = 1;
+
+	printf("blobmsg_parse chain %8.2f us/msg\n", t_hand * 1e6 / ROUNDS);
+	printf("blobmsg_path        %8.2f us/msg\n", t_path * 1e6 / ROUNDS);
+
+	blobmsg_path_free(p);
+	blob_buf_free(&buf);
+	return failed;
+}
@@ -0,0 +1,242 @@
+/*
+ * blobmsg_validate.c - checked parsing vs. blobmsg_validate_tree
+ *
+ * hands a list of tables to several consumers. Each consumer either
+ * checks every level itself with blobmsg_parse() and
+ * blobmsg_check_array(), or relies on a single blobmsg_validate_tree()
+ * call on receive and uses the unchecked accessors.
+ * Also makes sure that a few broken messages get rejected, among them
+ * headers that claim less than their own size or more than is left.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "libubox/blobmsg.h"
+
+#define N_ENTRIES	64
+#define N_CONSUMERS	4
+#define ROUNDS		20000
+
+enum {
+	ENTRY_NAME,
+	ENTRY_ID,
+	ENTRY_PORTS,
+	__ENTRY_MAX
+};
+
+static const struct blobmsg_policy entry_policy[__ENTRY_MAX] = {
+	[ENTRY_NAME] = { .name = "name", .type = BLOBMSG_TYPE_STRING },
+	[ENTRY_ID] = { .name = "id", .type = BLOBMSG_TYPE_INT32 },
+	[ENTRY_PORTS] = { .name = "ports", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+static void fill(struct blob_buf *b)
+{
+	void *list, *entry, *ports;
+	int i, j;
+
+	blobmsg_buf_init(b);
+	list = blobmsg_open_array(b, "entries");
+	for (i = 0; i < N_ENTRIES; i++) {
+		entry = blobmsg_open_table(b, NULL);
+		blobmsg_add_string(b, "name", "eth0.100");
+		blobmsg_add_u32(b, "id", i);
+		ports = blobmsg_open_array(b, "ports");
+		for (j = 0; j < 4; j++)
+			blobmsg_add_u32(b, NULL, i + j);
+		blobmsg_close_array(b, ports);
+		blobmsg_close_table(b, entry);
+	}
+	blobmsg_close_array(b, list);
+}
+
+static unsigned int sum_checked(struct blob_attr *root)
+{
+	struct blob_attr *tb[__ENTRY_MAX], *list, *cur, *port;
+	unsigned int sum = 0;
+	int rem, rem2;
+
+	list = blob_data(root);
+	if (blobmsg_check_array(list, BLOBMSG_TYPE_TABLE) < 0)
+		return 0;
+
+	blobmsg_for_each_attr(cur, list, rem) {
+		if (blobmsg_parse(entry_policy, __ENTRY_MAX, tb,
+				  blobmsg_data(cur), blobmsg_data_len(cur)) ||
+		    !tb[ENTRY_ID] || !tb[ENTRY_PORTS])
+			return 0;
+
+		sum += blobmsg_get_u32(tb[ENTRY_ID]);
+		if (blobmsg_check_array(tb[ENTRY_PORTS], BLOBMSG_TYPE_INT32) < 0)
+			return 0;
+
+		blobmsg_for_each_attr(port, tb[ENTRY_PORTS], rem2)
+			sum += blobmsg_get_u32(port);
+	}
+
+	return sum;
+}
+
+static unsigned int sum_unchecked(struct blob_attr *root)
+{
+	struct blob_attr *tb[__ENTRY_MAX], *list, *cur, *port;
+	unsigned int sum = 0;
+	int rem, rem2;
+
+	list = blob_data(root);
+	blobmsg_for_each_attr_unchecked(cur, list, rem) {
+		blobmsg_parse_unchecked(entry_policy, __ENTRY_MAX, tb,
+					blobmsg_data(cur), blobmsg_data_len(cur));
+		if (!tb[ENTRY_ID] || !tb[ENTRY_PORTS])
+			return 0;
+
+		sum += blobmsg_get_u32(tb[ENTRY_ID]);
+		blobmsg_for_each_attr_unchecked(port, tb[ENTRY_PORTS], rem2)
+			sum += blobmsg_get_u32(port);
+	}
+
+	return sum;
+}
+
+/* give the only child of b a header claiming len bytes */
+static bool check_len(struct blob_buf *b, int type, bool long_hdr, unsigned int len)
+{
+	struct blob_attr *attr;
+
+	blobmsg_buf_init(b);
+	blobmsg_add_string(b, "s", "0123456789");
+	attr = blob_data(b->head);
+	attr->id_len = cpu_to_be32(BLOB_ATTR_EXTENDED | (type << BLOB_ATTR_ID_SHIFT));
+	if (long_hdr) {
+		attr->id_len |= cpu_to_be32(BLOB_ATTR_LEN_LONG);
+		*(uint32_t *) attr->data = cpu_to_be32(len);
+	} else {
+		attr->id_len |= cpu_to_be32(len);
+	}
+
+	return !blobmsg_validate_tree(b->head, BLOBMSG_MAX_DEPTH);
+}
+
+static int check_broken(void)
+{
+	static struct blob_buf b;
+	struct blob_attr *attr;
+	char *str;
+	void *c[BLOBMSG_MAX_DEPTH + 1];
+	int i, ret = 0;
+
+	/* missing string terminator */
+	blobmsg_buf_init(&b);
+	blobmsg_add_string(&b, "s", "abc");
+	attr = blob_data(b.head);
+	str = blobmsg_data(attr);
+	memset(str, 'x', blobmsg_data_len(attr));
+	if (blobmsg_validate_tree(b.head, BLOBMSG_MAX_DEPTH)) {
+		fprintf(stderr, "unterminated string accepted\n");
+		ret = 1;
+	}
+
+	/* name length beyond the attribute */
+	blobmsg_buf_init(&b);
+	blobmsg_add_u32(&b, "n", 1);
+	attr = blob_data(b.head);
+	((struct blobmsg_hdr *) blob_data(attr))->namelen = cpu_to_be16(200);
+	if (blobmsg_validate_tree(b.head, BLOBMSG_MAX_DEPTH)) {
+		fprintf(stderr, "bad name length accepted\n");
+		ret = 1;
+	}
+
+	/* too deep */
+	blobmsg_buf_init(&b);
+	for (i = 0; i <= BLOBMSG_MAX_DEPTH; i++)
+		c[i] = blobmsg_open_array(&b, "a");
+	for (i = BLOBMSG_MAX_DEPTH; i >= 0; i--)
+		blobmsg_close_array(&b, c[i]);
+	if (blobmsg_validate_tree(b.head, BLOBMSG_MAX_DEPTH) ||
+	    !blobmsg_validate_tree(b.head, BLOBMSG_MAX_DEPTH + 1)) {
+		fprintf(stderr, "depth limit not applied\n");
+		ret = 1;
+	}
+
+	/* too short for the header, or longer than the table */
+	for (i = 1; i < 8; i++) {
+		if (check_len(&b, BLOBMSG_TYPE_UNSPEC, false, i % 4) &&
+		    check_len(&b, BLOBMSG_TYPE_STRING, false, i % 4) &&
+		    check_len(&b, BLOBMSG_TYPE_UNSPEC, true, i) &&
+		    check_len(&b, BLOBMSG_TYPE_STRING, true, i) &&
+		    check_len(&b, BLOBMSG_TYPE_UNSPEC, false, 24 + i) &&
+		    check_len(&b, BLOBMSG_TYPE_UNSPEC, true, 24 + i) &&
+		    check_len(&b, BLOBMSG_TYPE_UNSPEC, true, ~0U - i))
+			continue;
+
+		fprintf(stderr, "bad child length %d accepted\n", i);
+		ret = 1;
+	}
+
+	/* trailing bytes inside a table */
+	blobmsg_buf_init(&b);
+	blobmsg_add_u32(&b, "n", 1);
+	blob_set_raw_len(b.head, blob_raw_len(b.head) + 4);
+	if (blobmsg_validate_tree(b.head, BLOBMSG_MAX_DEPTH)) {
+		fprintf(stderr, "trailing garbage accepted\n");
+		ret = 1;
+	}
+
+	blob_buf_free(&b);
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct blob_buf b;
+	volatile unsigned int sum = 0;
+	unsigned int expect = 0;
+	double start, checked, validated;
+	int i, j;
+
+	for (i = 0; i < N_ENTRIES; i++)
+		expect += i + 4 * i + 6;
+
+	fill(&b);
+	if (sum_checked(b.head) != expect ||
+	    !blobmsg_validate_tree(b.head, BLOBMSG_MAX_DEPTH) ||
+	    sum_unchecked(b.head) != expect) {
+		fprintf(stderr, "unexpected message contents\n");
+		return 1;
+	}
+
+	if (check_broken())
+		return 1;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		for (j = 0; j < N_CONSUMERS; j++)
+			sum += sum_checked(b.head);
+	checked = now() - start;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		if (!blobmsg_validate_tree(b.head, BLOBMSG_MAX_DEPTH))
+			return 1;
+
+		for (j = 0; j < N_CONSUMERS; j++)
+			sum += sum_unchecked(b.head);
+	}
+	validated = now() - start;
+
+	printf("checked    %8.2f us/msg\n", checked * 1e6 / ROUNDS);
+	printf("validated  %8.2f us/msg\n", validated * 1e6 / ROUNDS);
+
+	blob_buf_free(&b);
+	return 0;
+}
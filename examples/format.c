@@ -53,6 +53,21 @@ static int format_test1(u8 * s, size_t size, va_list * va)
 	return format(s, size, "%12d %12f%12.4e", x, y, y);
 }
 
+/* collects sink output in 3 byte pieces to exercise split writes */
+static int test_sink(void *priv, const u8 *data, size_t len)
+{
+	u8 **s = priv;
+	size_t i, n;
+
+	for (i = 0; i < len; i += n) {
+		n = clib_min(len - i, 3);
+		memcpy(*s, data + i, n);
+		*s += n;
+	}
+
+	return len;
+}
+
 static int expectation(const char *exp, char *fmt, ...)
 {
 	u8 *s, *str, *end;
@@ -73,6 +88,18 @@ static int expectation(const char *exp, char *fmt, ...)
 		ret = 1;
 	} else if (verbose)
 		fformat(stdout, "PASS: %s\n", fmt);
+
+	s = str;
+	va_start(va, fmt);
+	va_format_sink(test_sink, &s, fmt, &va);
+	va_end(va);
+
+	*s = 0;
+	if (strcmp(exp, (char *)str)) {
+		fformat(stdout, "FAIL: sink %s (expected vs. result)\n"
+				"\"%s\"\n\"%s\"\n", fmt, exp, str);
+		ret = 1;
+	}
 	return ret;
 }
 
@@ -81,6 +108,7 @@ int test_format_main(unformat_input_t * input)
 	int ret = 0;
 	ret |= expectation("foo", "foo");
 	ret |= expectation("foo", "%s", "foo");
+	ret |= expectation("a foo b", "a %s b", "foo");
 	ret |= expectation("9876", "%d", 9876);
 	ret |= expectation("-9876", "%wd", (word) - 9876);
 	ret |= expectation("98765432", "%u", 98765432);
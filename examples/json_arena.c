@@ -0,0 +1,151 @@
+/*
+ * json_arena.c - json_parse() vs. json_parse_arena()
+ *
+ * parses and drops the same request over and over, once with a heap
+ * allocation per node and string and once out of a reused blob_arena.
+ * Checks that both trees print the same and that the usual API still
+ * works on an arena tree, then prints the allocator calls and time per
+ * request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "libubox/json.h"
+#include "libubox/blob.h"
+
+#define N_ENTRIES	64
+#define ROUNDS		2000
+
+static unsigned long n_alloc, n_free;
+
+static void *count_malloc(size_t size)
+{
+	n_alloc++;
+	return malloc(size);
+}
+
+static void count_free(void *ptr)
+{
+	n_free++;
+	free(ptr);
+}
+
+static char *build_doc(void)
+{
+	char *doc = malloc(N_ENTRIES * 256 + 256), *s = doc;
+	int i;
+
+	s += sprintf(s, "{ \"method\": \"call\", \"text\": \"tab\\there \\u00e9\",\n"
+			"  \"entries\": [\n");
+	for (i = 0; i < N_ENTRIES; i++)
+		s += sprintf(s, "    { \"name\": \"eth0.%d\", \"id\": %d, \"up\": %s,"
+				" \"ports\": [ %d, %d, %d ] }%s\n",
+			     i, i, (i & 1) ? "true" : "false", i, i + 1, i + 2,
+			     i < N_ENTRIES - 1 ? "," : "");
+	sprintf(s, "  ]\n}\n");
+
+	return doc;
+}
+
+/* mix heap items into an arena tree and take arena items out again */
+static int check_api(struct json *obj)
+{
+	struct json *entries, *item;
+
+	json_add_string_to_object(obj, "added", "heap");
+	json_replace_item_in_object(obj, "method", json_create_string("reply"));
+	json_delete_item_from_object(obj, "text");
+
+	entries = json_get_object_item(obj, "entries");
+	item = json_detach_item_from_array(entries, 0);
+	json_add_item_to_object(obj, "first", item);
+	json_add_item_reference_to_array(entries, item);
+	json_delete_item_from_array(entries, 1);
+
+	item = json_get_object_item(obj, "method");
+	if (!item || strcmp(item->valuestring, "reply") ||
+	    json_get_array_size(entries) != N_ENTRIES - 1 ||
+	    strcmp(json_get_object_item(obj, "first")->string, "first") ||
+	    !json_get_object_item(obj, "added"))
+		return 1;
+
+	return !json_to_string(obj);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct json_hooks hooks = {
+		.malloc_fn = count_malloc,
+		.free_fn = count_free,
+	};
+	struct blob_arena arena;
+	unsigned long alloc_heap, alloc_arena;
+	double start, t_heap, t_arena;
+	struct json *heap, *obj;
+	char *doc = build_doc();
+	int i, ret;
+
+	json_init_hooks(&hooks);
+	blob_arena_init(&arena, 32 * 1024);
+
+	heap = json_parse(doc);
+	obj = json_parse_arena(doc, &arena);
+	if (!heap || !obj ||
+	    strcmp(json_to_string_unformatted(heap), json_to_string_unformatted(obj))) {
+		fprintf(stderr, "arena tree differs\n");
+		return 1;
+	}
+	json_delete(heap);
+
+	ret = check_api(obj);
+	json_delete(obj);
+	blob_arena_free(&arena);
+	if (ret || n_alloc != n_free) {
+		fprintf(stderr, "arena tree broken, %lu allocs / %lu frees\n",
+			n_alloc, n_free);
+		return 1;
+	}
+
+	if (json_parse_arena("{ \"a\": [ 1, ] }", &arena)) {
+		fprintf(stderr, "invalid input accepted\n");
+		return 1;
+	}
+	blob_arena_free(&arena);
+
+	n_alloc = 0;
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		json_delete(json_parse(doc));
+	t_heap = now() - start;
+	alloc_heap = n_alloc;
+
+	n_alloc = 0;
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		json_delete(json_parse_arena(doc, &arena));
+		blob_arena_free(&arena);
+	}
+	t_arena = now() - start;
+	alloc_arena = n_alloc;
+
+	printf("%zu bytes of JSON\n", strlen(doc));
+	printf("heap   %6lu json_malloc/req  %8.2f us/req\n",
+	       alloc_heap / ROUNDS, t_heap * 1e6 / ROUNDS);
+	printf("arena  %6lu json_malloc/req  %8.2f us/req\n",
+	       alloc_arena / ROUNDS, t_arena * 1e6 / ROUNDS);
+
+	free(doc);
+	return 0;
+}
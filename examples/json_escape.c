@@ -0,0 +1,196 @@
+/*
+ * json_escape.c - JSON string escaping throughput
+ *
+ * checks json_escape_span() against a byte by byte reference, then times
+ * the span search and full formatting (blobmsg_format_json() and
+ * json_to_string()) on an ASCII and a UTF-8 corpus.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "libubox/json.h"
+#include "libubox/blobmsg.h"
+#include "libubox/blobmsg_json.h"
+
+#define N_STRINGS	512
+#define STR_LEN		1024
+#define ROUNDS		200
+
+static const char *ascii_words[] = {
+	"the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog ",
+	"interface ", "wlan0 ", "192.168.1.1 ", "uptime ", "status: ", "ok ",
+};
+
+static const char *utf8_words[] = {
+	"grüße ", "café ", "naïve ", "Ελλάδα ", "Россия ", "日本語 ", "中文 ",
+	"한국어 ", "emoji 😀 ", "ok ", "niño ", "façade ",
+};
+
+static size_t span_ref(const char *str, size_t len, int slash)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		unsigned char c = str[i];
+
+		if (c < 0x20 || c == '"' || c == '\\' || (slash && c == '/'))
+			break;
+	}
+
+	return i;
+}
+
+static void fill(char *str, const char **words, int n_words, unsigned int seed)
+{
+	int len = 0, wlen;
+	const char *w;
+
+	while (1) {
+		seed = seed * 1103515245 + 12345;
+		w = words[(seed >> 16) % n_words];
+		if ((seed >> 8) % 40 == 0)
+			w = (seed & 1) ? "\"quoted\" " : "line\n";
+
+		wlen = strlen(w);
+		if (len + wlen >= STR_LEN)
+			break;
+
+		memcpy(str + len, w, wlen);
+		len += wlen;
+	}
+	str[len] = 0;
+}
+
+static int check_span(void)
+{
+	unsigned char buf[256];
+	unsigned int seed = 1;
+	int i, off, len, slash;
+
+	for (i = 0; i < 20000; i++) {
+		for (len = 0; len < sizeof(buf); len++) {
+			seed = seed * 1103515245 + 12345;
+			/* mostly clean bytes, including the ones >= 0x80 */
+			buf[len] = ((seed >> 16) % 64) ? 0x20 + (seed >> 8) % 0xe0 :
+				   (seed >> 8) % 0x30;
+		}
+
+		off = i % 32;
+		len = (i * 7) % (sizeof(buf) - off);
+		slash = i & 1;
+		if (json_escape_span((char *) buf + off, len, slash) !=
+		    span_ref((char *) buf + off, len, slash) ||
+		    json_escape_span_scalar((char *) buf + off, len, slash) !=
+		    span_ref((char *) buf + off, len, slash)) {
+			fprintf(stderr, "span mismatch at %d\n", i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef size_t (*span_fn)(const char *str, size_t len, int slash);
+
+static double time_span(span_fn fn, char (*strs)[STR_LEN])
+{
+	volatile size_t sink = 0;
+	double start = now();
+	size_t len, n;
+	const char *p;
+	int i, j;
+
+	for (i = 0; i < ROUNDS; i++) {
+		for (j = 0; j < N_STRINGS; j++) {
+			p = strs[j];
+			len = strlen(p);
+			while (len) {
+				n = fn(p, len, 1);
+				if (n == len)
+					break;
+				p += n + 1;
+				len -= n + 1;
+				sink += n;
+			}
+		}
+	}
+
+	return (double) N_STRINGS * STR_LEN * ROUNDS / (now() - start) / 1e6;
+}
+
+static void bench(const char *name, const char **words, int n_words)
+{
+	static char strs[N_STRINGS][STR_LEN];
+	static struct blob_buf b;
+	struct json *obj;
+	double start, t_blobmsg, t_json;
+	int i;
+
+	blobmsg_buf_init(&b);
+	obj = json_create_array();
+	for (i = 0; i < N_STRINGS; i++) {
+		fill(strs[i], words, n_words, i + 1);
+		blobmsg_add_string(&b, "s", strs[i]);
+		json_add_item_to_array(obj, json_create_string(strs[i]));
+	}
+
+	start = now();
+	for (i = 0; i < ROUNDS / 10; i++)
+		free(blobmsg_format_json(b.head, true));
+	t_blobmsg = now() - start;
+
+	/* the result is cached in obj until the format changes, so alternate */
+	start = now();
+	for (i = 0; i < ROUNDS / 10; i++) {
+		if (i & 1)
+			json_to_string(obj);
+		else
+			json_to_string_unformatted(obj);
+	}
+	t_json = now() - start;
+
+	printf("%s: span ref %7.1f MB/s, scalar %7.1f MB/s, vector %7.1f MB/s\n",
+	       name, time_span(span_ref, strs),
+	       time_span(json_escape_span_scalar, strs),
+	       time_span(json_escape_span, strs));
+	printf("%s: blobmsg_format_json %6.2f ms, json_to_string %6.2f ms\n",
+	       name, t_blobmsg * 1e3 / (ROUNDS / 10), t_json * 1e3 / (ROUNDS / 10));
+
+	json_delete(obj);
+	blob_buf_free(&b);
+}
+
+int main(int argc, char **argv)
+{
+	struct json *obj;
+	char *str;
+	int ret;
+
+	if (check_span())
+		return 1;
+
+	obj = json_create_string("a\"b\\c/d\n\x01 é");
+	str = json_to_string_unformatted(obj);
+	ret = strcmp(str, "\"a\\\"b\\\\c/d\\n\\u0001 é\"");
+	json_delete(obj);
+	if (ret) {
+		fprintf(stderr, "json_to_string output changed\n");
+		return 1;
+	}
+
+	bench("ascii", ascii_words, sizeof(ascii_words) / sizeof(ascii_words[0]));
+	bench("utf-8", utf8_words, sizeof(utf8_words) / sizeof(utf8_words[0]));
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * json_lookup.c - json_get_object_item() with the member index
+ *
+ * runs random adds, detaches and replaces on an object and checks every
+ * lookup against a plain walk of the member list, also after changes made
+ * through a reference, then times lookups on a request sized object both
+ * ways.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "libubox/json.h"
+
+#define N_KEYS		64
+#define N_OPS		5000
+#define ROUNDS		20000
+
+/* what the index has to agree with: exact match first, then any case */
+static struct json *lookup_ref(struct json *obj, const char *name)
+{
+	struct json *c, *match = NULL;
+
+	for (c = obj->child; c; c = c->next) {
+		if (!c->string)
+			continue;
+		if (!strcmp(c->string, name))
+			return c;
+		if (!match && !strcasecmp(c->string, name))
+			match = c;
+	}
+
+	return match;
+}
+
+/* the lookup without an index, as it used to be */
+static struct json *lookup_walk(struct json *obj, const char *name)
+{
+	struct json *c = obj->child;
+
+	while (c && (!c->string || strcasecmp(c->string, name)))
+		c = c->next;
+
+	return c;
+}
+
+static void key_name(char *buf, int len, unsigned int n)
+{
+	/* a few names only differ in case */
+	snprintf(buf, len, (n & 3) ? "key%u" : "Key%u", n / 2);
+}
+
+static int check_ops(void)
+{
+	struct json *obj = json_create_object();
+	unsigned int seed = 1, n;
+	char name[32], other[32];
+	int i, j;
+
+	for (i = 0; i < N_OPS; i++) {
+		seed = seed * 1103515245 + 12345;
+		n = (seed >> 16) % (N_KEYS * 2);
+		key_name(name, sizeof(name), n);
+
+		switch ((seed >> 8) % 4) {
+		case 0:
+			json_add_number_to_object(obj, name, i);
+			break;
+		case 1:
+		case 2:
+			/* duplicate names pile up otherwise */
+			json_delete_item_from_object(obj, name);
+			break;
+		case 3:
+			/* a missing name leaves the new item to the caller */
+			if (json_get_object_item(obj, name))
+				json_replace_item_in_object(obj, name,
+							    json_create_number(-i));
+			break;
+		}
+
+		for (j = 0; j < N_KEYS * 2; j++) {
+			key_name(other, sizeof(other), j);
+			if (json_get_object_item(obj, other) != lookup_ref(obj, other)) {
+				fprintf(stderr, "lookup of %s differs after op %d\n",
+					other, i);
+				return 1;
+			}
+		}
+	}
+
+	if (!obj->index) {
+		fprintf(stderr, "index not built\n");
+		return 1;
+	}
+
+	json_delete(obj);
+	return 0;
+}
+
+/* a reference shares the members, changes through it must not go stale */
+static int check_reference(void)
+{
+	struct json *obj = json_create_object();
+	struct json *holder = json_create_object();
+	struct json *ref;
+	char name[32];
+	int i;
+
+	for (i = 0; i < N_KEYS; i++) {
+		key_name(name, sizeof(name), i * 2 + 1);
+		json_add_number_to_object(obj, name, i);
+	}
+	json_get_object_item(obj, "missing");
+
+	json_add_item_reference_to_object(holder, "ref", obj);
+	ref = json_get_object_item(holder, "ref");
+	json_add_number_to_object(ref, "added", 1);
+	json_delete_item_from_object(ref, "key5");
+
+	for (i = 0; i < N_KEYS * 2; i++) {
+		key_name(name, sizeof(name), i);
+		if (json_get_object_item(obj, name) != lookup_ref(obj, name)) {
+			fprintf(stderr, "lookup of %s stale after a change through a reference\n",
+				name);
+			return 1;
+		}
+	}
+
+	if (json_get_object_item(obj, "added") != lookup_ref(obj, "added")) {
+		fprintf(stderr, "member added through a reference not found\n");
+		return 1;
+	}
+
+	json_delete(holder);
+	json_delete(obj);
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	char names[N_KEYS][32];
+	struct json *obj;
+	volatile int64_t sum = 0;
+	double start, t_walk, t_index;
+	int i, j;
+
+	if (check_ops() || check_reference())
+		return 1;
+
+	obj = json_create_object();
+	for (i = 0; i < N_KEYS; i++) {
+		snprintf(names[i], sizeof(names[i]), "option_name_%d", i);
+		json_add_number_to_object(obj, names[i], i);
+	}
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		for (j = 0; j < N_KEYS; j++)
+			sum += lookup_walk(obj, names[j])->valueint;
+	t_walk = now() - start;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		for (j = 0; j < N_KEYS; j++)
+			sum += json_get_object_item(obj, names[j])->valueint;
+	t_index = now() - start;
+
+	printf("%d members\n", N_KEYS);
+	printf("walk   %8.2f ns/lookup\n", t_walk * 1e9 / ROUNDS / N_KEYS);
+	printf("index  %8.2f ns/lookup\n", t_index * 1e9 / ROUNDS / N_KEYS);
+
+	json_delete(obj);
+	return 0;
+}
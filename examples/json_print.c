@@ -0,0 +1,189 @@
+/*
+ * json_print.c - printing struct json trees
+ *
+ * renders the same document through json_to_string(), into a reused
+ * printbuf with json_print_buf() and through json_object_to_file_ext(),
+ * checks that they agree, that the opt-in print cache does not change
+ * the output, and prints the allocator calls and time per document.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+
+#include "libubox/json.h"
+#include "libubox/printbuf.h"
+
+#define N_ENTRIES	256
+#define ROUNDS		2000
+
+static unsigned long n_alloc;
+
+static void *count_malloc(size_t size)
+{
+	n_alloc++;
+	return malloc(size);
+}
+
+static struct json *build_doc(void)
+{
+	struct json *obj, *list, *entry, *ports;
+	char name[32];
+	int i;
+
+	obj = json_create_object();
+	json_add_string_to_object(obj, "method", "status");
+	json_add_number_to_object(obj, "huge", 1e300);
+	json_add_number_to_object(obj, "ratio", 0.25);
+
+	list = json_create_array();
+	for (i = 0; i < N_ENTRIES; i++) {
+		snprintf(name, sizeof(name), "wlan%d-\"%d\"", i / 4, i);
+		entry = json_create_object();
+		json_add_string_to_object(entry, "name", name);
+		json_add_item_to_object(entry, "up", json_create_bool(i & 1));
+		json_add_number64_to_object(entry, "rx_bytes", (int64_t) i << 32);
+		ports = json_create_array();
+		json_add_item_to_array(ports, json_create_number64(i));
+		json_add_item_to_array(ports, json_create_object());
+		json_add_item_to_object(entry, "ports", ports);
+		json_add_item_to_array(list, entry);
+	}
+	json_add_item_to_object(obj, "entries", list);
+
+	return obj;
+}
+
+static int check_file(struct json *obj, const char *ref)
+{
+	char path[] = "/tmp/json_printXXXXXX";
+	int fd, len = strlen(ref), ret = 0;
+	char *buf = malloc(len + 1);
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		goto out;
+	close(fd);
+
+	if (!json_object_to_file_ext(path, obj, 1) &&
+	    (fd = open(path, O_RDONLY)) >= 0) {
+		ret = read(fd, buf, len + 1) == len && !memcmp(buf, ref, len);
+		close(fd);
+	}
+
+	unlink(path);
+out:
+	free(buf);
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct json_hooks hooks = {
+		.malloc_fn = count_malloc,
+		.free_fn = free,
+	};
+	unsigned long alloc_str, alloc_buf;
+	double start, t_str, t_buf, t_cache;
+	struct printbuf *pb;
+	struct json *obj, *list;
+	char *ref, *flat, *text;
+	int i, len;
+
+	json_init_hooks(&hooks);
+	obj = build_doc();
+	pb = printbuf_new();
+
+	ref = strdup(json_to_string(obj));
+	flat = strdup(json_to_string_unformatted(obj));
+	len = strlen(ref);
+	if (json_print_buf(pb, obj, 1) || strcmp(pb->buf, ref) ||
+	    json_print_buf(pb, obj, 0) || strncmp(pb->buf + len, flat, strlen(flat)) ||
+	    !check_file(obj, ref)) {
+		fprintf(stderr, "outputs differ\n");
+		return 1;
+	}
+
+	/* the text stays valid as long as it does not change */
+	text = json_to_string(obj);
+	if (json_to_string(obj) != text) {
+		fprintf(stderr, "unchanged text was replaced\n");
+		return 1;
+	}
+
+	/* cached subtrees print the same, at any depth and in both formats */
+	list = json_get_object_item(obj, "entries");
+	json_set_print_cache(list, 1);
+	json_set_print_cache(json_get_array_item(list, 3), 1);
+	for (i = 0; i < 2; i++) {
+		if (strcmp(json_to_string(obj), ref) ||
+		    strcmp(json_to_string_unformatted(obj), flat)) {
+			fprintf(stderr, "cached output differs\n");
+			return 1;
+		}
+	}
+
+	/* until it is reset, the cache keeps the old text of the last format */
+	json_replace_item_in_object(json_get_array_item(list, 0), "up",
+				    json_create_null());
+	if (strcmp(json_to_string_unformatted(obj), flat)) {
+		fprintf(stderr, "cache not used\n");
+		return 1;
+	}
+	json_set_print_cache(list, 0);
+	if (!strcmp(json_to_string_unformatted(obj), flat)) {
+		fprintf(stderr, "cache not dropped\n");
+		return 1;
+	}
+	json_set_print_cache(json_get_array_item(list, 3), 0);
+
+	n_alloc = 0;
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		json_to_string(obj);
+	t_str = now() - start;
+	alloc_str = n_alloc;
+
+	n_alloc = 0;
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		printbuf_reset(pb);
+		json_print_buf(pb, obj, 1);
+	}
+	t_buf = now() - start;
+	alloc_buf = n_alloc;
+
+	json_set_print_cache(list, 1);
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		printbuf_reset(pb);
+		json_print_buf(pb, obj, 1);
+	}
+	t_cache = now() - start;
+
+	printf("%d bytes of JSON\n", len);
+	printf("json_to_string  %4lu json_malloc/doc  %8.2f us/doc\n",
+	       alloc_str / ROUNDS, t_str * 1e6 / ROUNDS);
+	printf("json_print_buf  %4lu json_malloc/doc  %8.2f us/doc\n",
+	       alloc_buf / ROUNDS, t_buf * 1e6 / ROUNDS);
+	printf("cached subtree                     %8.2f us/doc\n",
+	       t_cache * 1e6 / ROUNDS);
+
+	json_delete(obj);
+	printbuf_free(pb);
+	free(ref);
+	free(flat);
+	return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * json_stream.c - parsing a request that arrives in pieces
+ *
+ * feeds documents to a json_parser split at every position and compares
+ * the trees with json_parse(), checks errors, the nesting limit and back
+ * to back documents, then receives a 256 KB request in 1500 byte segments, once reparsing the
+ * buffer with json_parse_stream() after every segment like the JSON-RPC
+ * server used to, and once through json_parser_feed().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "libubox/json.h"
+#include "libubox/blob.h"
+
+#define REQ_SIZE	(256 * 1024)
+#define SEGMENT		1500
+
+static const char *docs[] = {
+	"{ \"method\": \"call\", \"params\": [ 1, -2.5, 3e2, true, false, null ],"
+	" \"id\": \"a\\\"b\\\\c\\u00e9\\ud83d\\ude00\\n\" }",
+	"[ [], {}, [ [ [ \"deep\" ] ] ], { \"a\": { \"b\": {} } } ]",
+	"\"just a string\"",
+	"true",
+	"{\"\":\"\",\"Key\":0,\"key\":-0.0001}",
+};
+
+static const char *broken[] = {
+	"[ 1, ]", "{ \"a\" 1 }", "[ tru ]", "{ \"a\": 1 ]", "[ 1 2 ]",
+	"{ 1: 2 }", "]", "[ \"a\0b\" ]",
+};
+
+static int check_split(const char *doc, size_t split, struct blob_arena *arena)
+{
+	struct json_parser p;
+	struct json *ref, *obj;
+	size_t len = strlen(doc), used;
+	int ret = 1;
+
+	json_parser_init(&p, arena);
+	if (json_parser_feed(&p, doc, split, &used) != JSON_PARSE_MORE ||
+	    used != split ||
+	    json_parser_feed(&p, doc + split, len - split, &used) != JSON_PARSE_DONE ||
+	    split + used != len)
+		goto out;
+
+	obj = json_parser_result(&p);
+	ref = json_parse(doc);
+	ret = strcmp(json_to_string_unformatted(obj), json_to_string_unformatted(ref));
+	json_delete(obj);
+	json_delete(ref);
+
+out:
+	json_parser_free(&p);
+	if (arena)
+		blob_arena_free(arena);
+	return ret;
+}
+
+static int check_bytes(const char *doc)
+{
+	struct json_parser p;
+	struct json *obj;
+	size_t i, len = strlen(doc), used;
+	int ret = 1;
+
+	json_parser_init(&p, NULL);
+	for (i = 0; i < len - 1; i++)
+		if (json_parser_feed(&p, doc + i, 1, &used) != JSON_PARSE_MORE)
+			goto out;
+
+	if (json_parser_feed(&p, doc + i, 1, &used) == JSON_PARSE_DONE) {
+		obj = json_parser_result(&p);
+		ret = !obj;
+		json_delete(obj);
+	}
+
+out:
+	json_parser_free(&p);
+	return ret;
+}
+
+static int check_depth(int depth, enum json_parse_status expect)
+{
+	struct json_parser p;
+	enum json_parse_status st;
+	size_t used;
+	char *doc;
+
+	doc = malloc(2 * depth);
+	if (!doc)
+		return 1;
+
+	memset(doc, '[', depth);
+	memset(doc + depth, ']', depth);
+
+	json_parser_init(&p, NULL);
+	st = json_parser_feed(&p, doc, 2 * depth, &used);
+	json_delete(json_parser_result(&p));
+	json_parser_free(&p);
+	free(doc);
+
+	return st != expect;
+}
+
+static int check(void)
+{
+	const char *two = "{\"id\":1} [2]3 ";
+	struct blob_arena arena;
+	struct json_parser p;
+	struct json *obj;
+	size_t i, j, used;
+	int ret = 0;
+
+	blob_arena_init(&arena, 0);
+	for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+		for (j = 0; j < strlen(docs[i]); j++) {
+			ret |= check_split(docs[i], j, NULL);
+			ret |= check_split(docs[i], j, &arena);
+		}
+		ret |= check_bytes(docs[i]);
+	}
+	if (ret) {
+		fprintf(stderr, "split documents parse differently\n");
+		return 1;
+	}
+
+	json_parser_init(&p, NULL);
+	for (i = 0; i < sizeof(broken) / sizeof(broken[0]); i++) {
+		json_parser_reset(&p);
+		if (json_parser_feed(&p, broken[i], strlen(broken[i]) + 3,
+				     &used) != JSON_PARSE_ERROR) {
+			fprintf(stderr, "broken document %zu accepted\n", i);
+			return 1;
+		}
+	}
+
+	/* nesting past max_depth is an error, up to it is fine */
+	if (check_depth(JSON_PARSER_MAX_DEPTH, JSON_PARSE_DONE) ||
+	    check_depth(JSON_PARSER_MAX_DEPTH + 1, JSON_PARSE_ERROR) ||
+	    check_depth(1000000, JSON_PARSE_ERROR)) {
+		fprintf(stderr, "nesting limit not applied\n");
+		return 1;
+	}
+
+	/* back to back documents, a number needs the byte after it */
+	json_parser_reset(&p);
+	for (i = 0; i < 3; i++) {
+		if (json_parser_feed(&p, two, strlen(two), &used) != JSON_PARSE_DONE)
+			ret = 1;
+		obj = json_parser_result(&p);
+		if (!obj || obj->type != (i == 0 ? JSON_T_OBJECT :
+					   i == 1 ? JSON_T_ARRAY : JSON_T_NUMBER))
+			ret = 1;
+		json_delete(obj);
+		two += used;
+	}
+	json_parser_free(&p);
+
+	if (ret || strcmp(two, " ")) {
+		fprintf(stderr, "back to back documents not split\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static char *build_request(void)
+{
+	char *req = malloc(REQ_SIZE + 256), *s = req;
+	int i = 0;
+
+	s += sprintf(s, "{ \"jsonrpc\": \"2.0\", \"method\": \"set\", \"params\": [");
+	while (s - req < REQ_SIZE)
+		s += sprintf(s, "%s{ \"name\": \"eth0.%d\", \"mtu\": %d, \"up\": %s }",
+			     i ? ", " : "", i, 1500 + i, (i & 1) ? "true" : "false"),
+		i++;
+	sprintf(s, "], \"id\": 1 }");
+
+	return req;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	char *req = build_request(), *buf, *end;
+	size_t len = strlen(req), pos, n, used;
+	enum json_parse_status st = JSON_PARSE_MORE;
+	struct json *old = NULL, *obj;
+	struct json_parser p;
+	double start, t_old, t_new;
+
+	if (check())
+		return 1;
+
+	/* what the server did: append, then parse the whole buffer again */
+	buf = malloc(len + 1);
+	start = now();
+	for (pos = 0; pos < len && !old; pos += n) {
+		n = len - pos < SEGMENT ? len - pos : SEGMENT;
+		memcpy(buf + pos, req + pos, n);
+		buf[pos + n] = 0;
+		old = json_parse_stream(buf, &end);
+	}
+	t_old = now() - start;
+
+	json_parser_init(&p, NULL);
+	start = now();
+	for (pos = 0; pos < len && st == JSON_PARSE_MORE; pos += n) {
+		n = len - pos < SEGMENT ? len - pos : SEGMENT;
+		st = json_parser_feed(&p, req + pos, n, &used);
+	}
+	t_new = now() - start;
+
+	obj = json_parser_result(&p);
+	if (!old || !obj || strcmp(json_to_string_unformatted(old),
+				   json_to_string_unformatted(obj))) {
+		fprintf(stderr, "request parsed differently\n");
+		return 1;
+	}
+
+	printf("%zu byte request in %d byte segments\n", len, SEGMENT);
+	printf("reparse   %10.2f ms\n", t_old * 1e3);
+	printf("parser    %10.2f ms\n", t_new * 1e3);
+
+	json_delete(old);
+	json_delete(obj);
+	json_parser_free(&p);
+	free(buf);
+	free(req);
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * ustream_mmap.c - read a file through a memory mapped ustream
+ *
+ * writes a file of numbered lines, then reads it back with a small mapping
+ * window while consuming only a few lines per callback, so lines straddle
+ * window boundaries and most callbacks leave data behind. checks every line
+ * and that the mapping is only moved about once per window.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libubox/ustream.h"
+#include "libubox/uloop.h"
+
+#define LINES		20000
+#define WINDOW		4096
+#define PER_CALLBACK	3
+
+static struct ustream_mmap sm;
+static char *last_map;
+static int line, remaps, callbacks, errors;
+
+static int consume_lines(struct ustream *s, int max)
+{
+	char expect[32], *data, *nl;
+	int len, n = 0;
+
+	while (n < max && (data = ustream_get_read_buf(s, &len)) != NULL) {
+		nl = memchr(data, '\n', len);
+		if (!nl)
+			break;
+
+		snprintf(expect, sizeof(expect), "line %d", line);
+		if (nl - data != (int) strlen(expect) ||
+		    memcmp(data, expect, nl - data) != 0) {
+			fprintf(stderr, "unexpected data for line %d\n", line);
+			errors++;
+		}
+
+		ustream_consume(s, nl + 1 - data);
+		line++;
+		n++;
+	}
+
+	return n;
+}
+
+static void read_cb(struct ustream *s, int bytes)
+{
+	if (sm.map != last_map) {
+		last_map = sm.map;
+		remaps++;
+	}
+
+	callbacks++;
+	consume_lines(s, PER_CALLBACK);
+}
+
+static void state_cb(struct ustream *s)
+{
+	if (!s->eof)
+		return;
+
+	consume_lines(s, LINES);
+	uloop_end();
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/ustream_mmap.XXXXXX";
+	long size, windows;
+	FILE *f;
+	int fd, i;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	unlink(path);
+
+	f = fdopen(dup(fd), "w");
+	for (i = 0; i < LINES; i++)
+		fprintf(f, "line %d\n", i);
+	fclose(f);
+	size = lseek(fd, 0, SEEK_END);
+
+	uloop_init();
+
+	if (ustream_mmap_init(&sm, fd, WINDOW) < 0) {
+		fprintf(stderr, "ustream_mmap_init failed\n");
+		return 1;
+	}
+	sm.stream.notify_read = read_cb;
+	sm.stream.notify_state = state_cb;
+
+	uloop_run();
+
+	ustream_free(&sm.stream);
+	uloop_done();
+	close(fd);
+
+	if (line != LINES) {
+		fprintf(stderr, "read %d of %d lines\n", line, LINES);
+		errors++;
+	}
+
+	/* the mapping spans two windows, one move per window at most */
+	windows = (size + sm.window - 1) / sm.window;
+	if (remaps > windows + 1) {
+		fprintf(stderr, "%d remaps for %ld windows\n", remaps, windows);
+		errors++;
+	}
+
+	printf("%ld bytes, %d lines, %d callbacks, %d mappings: %s\n", size,
+	       line, callbacks, remaps, errors ? "FAILED" : "ok");
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * ustream_pipe.c - request/response benchmark over an in-memory ustream pair
+ *
+ * measures framing and parsing cost without any kernel transport, either
+ * with blobmsg messages (default) or newline delimited JSON-RPC (-j).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "libubox/ustream.h"
+#include "libubox/blobmsg.h"
+#include "libubox/json.h"
+
+static struct ustream_pipe client, server;
+static struct blob_buf b;
+static char frame[65536];
+static int count = 100000, done;
+static bool json;
+
+static void send_blob(struct ustream *s, int id, const char *method)
+{
+	void *tbl;
+
+	blobmsg_buf_init(&b);
+	blobmsg_add_u32(&b, "id", id);
+	blobmsg_add_string(&b, "method", method);
+	tbl = blobmsg_open_table(&b, "params");
+	blobmsg_add_string(&b, "interface", "eth0");
+	blobmsg_add_u64(&b, "rx_bytes", 1234567890ULL);
+	blobmsg_close_table(&b, tbl);
+	ustream_write(s, (char *) b.head, blob_pad_len(b.head), false);
+}
+
+static void send_json(struct ustream *s, int id, const char *method)
+{
+	ustream_printf(s, "{\"jsonrpc\":\"2.0\",\"id\":%d,\"method\":\"%s\","
+		       "\"params\":{\"interface\":\"eth0\",\"rx_bytes\":1234567890}}\n",
+		       id, method);
+}
+
+static void send_msg(struct ustream *s, int id, const char *method)
+{
+	if (json)
+		send_json(s, id, method);
+	else
+		send_blob(s, id, method);
+}
+
+/* returns the id of the next complete message, -1 if there is none */
+static int recv_blob(struct ustream *s)
+{
+	static const struct blobmsg_policy pol = { "id", BLOBMSG_TYPE_INT32 };
+	struct blob_attr *hdr = (struct blob_attr *) frame, *tb;
+	int len;
+
+	if (ustream_pending_data(s, false) < (int) sizeof(*hdr))
+		return -1;
+
+	/* messages are handed over whole, so the header implies the body */
+	len = ustream_read(s, frame, sizeof(*hdr));
+	len = blob_pad_len(hdr) - len;
+	if (ustream_pending_data(s, false) < len) {
+		fprintf(stderr, "short frame\n");
+		exit(1);
+	}
+
+	ustream_read(s, frame + sizeof(*hdr), len);
+	blobmsg_parse(&pol, 1, &tb, blob_data(hdr), blob_len(hdr));
+
+	return tb ? blobmsg_get_u32(tb) : 0;
+}
+
+static int recv_json(struct ustream *s)
+{
+	struct json *msg, *id;
+	char *str, *nl;
+	int len, ret;
+
+	str = ustream_get_read_buf(s, &len);
+	if (!str)
+		return -1;
+
+	nl = memchr(str, '\n', len);
+	if (!nl)
+		return -1;
+
+	*nl = 0;
+	msg = json_parse(str);
+	ustream_consume(s, nl + 1 - str);
+	if (!msg)
+		return 0;
+
+	id = json_get_object_item(msg, "id");
+	ret = id ? id->valueint : 0;
+	json_delete(msg);
+
+	return ret;
+}
+
+static int recv_msg(struct ustream *s)
+{
+	return json ? recv_json(s) : recv_blob(s);
+}
+
+static void server_read_cb(struct ustream *s, int bytes)
+{
+	int id;
+
+	while ((id = recv_msg(s)) >= 0)
+		send_msg(s, id, "pong");
+}
+
+static void client_read_cb(struct ustream *s, int bytes)
+{
+	int id;
+
+	while ((id = recv_msg(s)) >= 0) {
+		if (++done == count) {
+			uloop_end();
+			return;
+		}
+		send_msg(s, id + 1, "ping");
+	}
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-j] [-n <count>] [-l <latency ms>]\n", name);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start, end;
+	double t;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "jn:l:")) != -1) {
+		switch (ch) {
+		case 'j':
+			json = true;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'l':
+			client.latency = server.latency = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	uloop_init();
+
+	client.stream.notify_read = client_read_cb;
+	server.stream.notify_read = server_read_cb;
+	client.stream.string_data = server.stream.string_data = json;
+	ustream_pipe_pair(&client, &server);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	send_msg(&client.stream, 0, "ping");
+	uloop_run();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%s: %d round trips in %.3fs (%.0f/s)\n", json ? "json" : "blobmsg",
+	       done, t, done / t);
+
+	ustream_free(&client.stream);
+	ustream_free(&server.stream);
+	uloop_done();
+	free(b.buf);
+
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * ustream_splice.c - relay two socket ustreams with ustream_splice_pair()
+ *
+ * client <-> a ... b <-> server, with a and b spliced together.
+ *
+ * before the relay is set up, a has read more than a pipe can hold from the
+ * client and b still has unsent output for the server. the server has to
+ * see that data in order, followed by everything the client sends later.
+ * a second run closes the server early and checks that the client can keep
+ * sending, with its data being dropped, until it closes its side.
+ */
+
+#include <sys/socket.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "libubox/ustream.h"
+#include "libubox/uloop.h"
+
+#define BACKLOG_W	(100 * 1024)
+#define BACKLOG_R	(200 * 1024)
+#define LIVE		(2 * 1024 * 1024)
+#define TOTAL		(BACKLOG_W + BACKLOG_R + LIVE)
+
+static struct ustream_fd client, a, b, server;
+static struct ustream_splice sp;
+static struct uloop_timeout timeout;
+static uint64_t tx_ofs, rx_total;
+static bool close_server;
+static int errors;
+
+static char pattern(uint64_t ofs)
+{
+	return (ofs * 13 + (ofs >> 12)) & 0xff;
+}
+
+static void send_data(struct ustream *s, int len)
+{
+	char buf[4096];
+	int i, n;
+
+	while (len > 0) {
+		n = len < (int) sizeof(buf) ? len : (int) sizeof(buf);
+		for (i = 0; i < n; i++)
+			buf[i] = pattern(tx_ofs + i);
+		ustream_write(s, buf, n, true);
+		tx_ofs += n;
+		len -= n;
+	}
+}
+
+static void server_read_cb(struct ustream *s, int bytes)
+{
+	char *data;
+	int len, i;
+
+	while ((data = ustream_get_read_buf(s, &len)) != NULL) {
+		for (i = 0; i < len; i++) {
+			if (data[i] == pattern(rx_total + i))
+				continue;
+
+			fprintf(stderr, "data mismatch at offset %llu\n",
+				(unsigned long long) rx_total + i);
+			errors++;
+			uloop_end();
+			return;
+		}
+		rx_total += len;
+		ustream_consume(s, len);
+	}
+}
+
+static void server_state_cb(struct ustream *s)
+{
+	if (s->eof)
+		uloop_end();
+}
+
+static void a_read_cb(struct ustream *s, int bytes)
+{
+	/* keep everything buffered until the relay takes over */
+	if (ustream_pending_data(s, false) >= BACKLOG_R)
+		uloop_end();
+}
+
+static void a_state_cb(struct ustream *s)
+{
+	/* the client closed after its data was dropped */
+	if (s->eof && close_server)
+		uloop_end();
+}
+
+static void b_state_cb(struct ustream *s)
+{
+	if (s->write_error && !close_server) {
+		fprintf(stderr, "unexpected write error\n");
+		errors++;
+	}
+}
+
+static void client_write_cb(struct ustream *s, int bytes)
+{
+	if (!ustream_pending_data(s, true))
+		shutdown(client.fd.fd, SHUT_WR);
+}
+
+static void timeout_cb(struct uloop_timeout *t)
+{
+	fprintf(stderr, "timed out after %llu bytes\n", (unsigned long long) rx_total);
+	errors++;
+	uloop_end();
+}
+
+static void init_pair(struct ustream_fd *x, struct ustream_fd *y)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+
+	ustream_fd_init(x, fds[0]);
+	ustream_fd_init(y, fds[1]);
+}
+
+static void free_stream(struct ustream_fd *sf)
+{
+	if (sf->fd.fd < 0)
+		return;
+
+	ustream_free(&sf->stream);
+	close(sf->fd.fd);
+	sf->fd.fd = -1;
+}
+
+static int run(bool early_close)
+{
+	memset(&client, 0, sizeof(client));
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	memset(&server, 0, sizeof(server));
+	tx_ofs = rx_total = 0;
+	close_server = early_close;
+	errors = 0;
+
+	/* let a buffer the whole backlog before splicing */
+	a.stream.r.buffer_len = 4096;
+	a.stream.r.max_buffers = 2 * BACKLOG_R / 4096;
+
+	init_pair(&client, &a);
+	init_pair(&b, &server);
+	a.stream.notify_read = a_read_cb;
+	a.stream.notify_state = a_state_cb;
+	b.stream.notify_state = b_state_cb;
+	server.stream.notify_read = server_read_cb;
+	server.stream.notify_state = server_state_cb;
+
+	/* output b could not send yet, the server does not read it */
+	ustream_set_read_blocked(&server.stream, true);
+	send_data(&b.stream, BACKLOG_W);
+
+	send_data(&client.stream, BACKLOG_R);
+	timeout.cb = timeout_cb;
+	uloop_timeout_set(&timeout, 5000);
+	uloop_run();
+
+	if (ustream_pending_data(&a.stream, false) != BACKLOG_R) {
+		fprintf(stderr, "a buffered %d bytes\n",
+			ustream_pending_data(&a.stream, false));
+		errors++;
+	}
+
+	if (ustream_splice_pair(&sp, &a, &b) < 0) {
+		fprintf(stderr, "ustream_splice_pair failed\n");
+		return 1;
+	}
+
+	if (early_close)
+		free_stream(&server);
+	else
+		ustream_set_read_blocked(&server.stream, false);
+
+	client.stream.notify_write = client_write_cb;
+	send_data(&client.stream, LIVE);
+	uloop_run();
+	uloop_timeout_cancel(&timeout);
+
+	if (!early_close && rx_total != TOTAL) {
+		fprintf(stderr, "server received %llu of %d bytes\n",
+			(unsigned long long) rx_total, TOTAL);
+		errors++;
+	}
+
+	if (early_close && (!b.stream.write_error || !a.stream.eof ||
+			    ustream_pending_data(&client.stream, true))) {
+		fprintf(stderr, "client data was not drained\n");
+		errors++;
+	}
+
+	printf("%s: %llu bytes received, %s\n",
+	       early_close ? "server closed" : "relay",
+	       (unsigned long long) rx_total, errors ? "FAILED" : "ok");
+
+	ustream_splice_free(&sp);
+	free_stream(&client);
+	free_stream(&a);
+	free_stream(&b);
+	free_stream(&server);
+
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+
+	signal(SIGPIPE, SIG_IGN);
+	uloop_init();
+
+	ret |= run(false);
+	ret |= run(true);
+
+	uloop_done();
+
+	return ret ? 1 : 0;
+}
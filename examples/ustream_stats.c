@@ -0,0 +1,110 @@
+/*
+ * ustream_stats.c - per-stream and global ustream I/O counters
+ *
+ * buffers data on two in-memory stream pairs at the same time and checks
+ * that the global peak_buffered covers both of them. the counters are only
+ * maintained when libubox is built with -DUSTREAM_STATS=ON, otherwise the
+ * example only reports that they are disabled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libubox/ustream.h"
+#include "libubox/uloop.h"
+
+#define LEN_A	(100 * 1024)
+#define LEN_B	(60 * 1024)
+
+static struct ustream_pipe a_tx, a_rx, b_tx, b_rx;
+static int received;
+
+static void read_cb(struct ustream *s, int bytes)
+{
+	int len;
+
+	while (ustream_get_read_buf(s, &len)) {
+		ustream_consume(s, len);
+		received += len;
+	}
+
+	if (received == LEN_A + LEN_B)
+		uloop_end();
+}
+
+static void fill(struct ustream *s, int len)
+{
+	char buf[1024];
+
+	memset(buf, 'x', sizeof(buf));
+	while (len > 0) {
+		ustream_write(s, buf, len < (int) sizeof(buf) ? len : (int) sizeof(buf), true);
+		len -= sizeof(buf);
+	}
+}
+
+static void print_stats(const char *name, struct ustream_stats *st)
+{
+	printf("%-6s rx %llu tx %llu peak %llu allocs %llu\n", name,
+	       (unsigned long long) st->rx_bytes,
+	       (unsigned long long) st->tx_bytes,
+	       (unsigned long long) st->peak_buffered,
+	       (unsigned long long) st->buf_alloc);
+}
+
+int main(int argc, char **argv)
+{
+	struct ustream_stats st_a, st_b, total;
+	int errors = 0;
+
+	uloop_init();
+
+	a_tx.latency = b_tx.latency = 20;
+	ustream_pipe_pair(&a_tx, &a_rx);
+	ustream_pipe_pair(&b_tx, &b_rx);
+	a_rx.stream.notify_read = read_cb;
+	b_rx.stream.notify_read = read_cb;
+
+	fill(&a_tx.stream, LEN_A);
+	fill(&b_tx.stream, LEN_B);
+
+	uloop_run();
+
+	ustream_get_stats(&a_tx.stream, &st_a);
+	ustream_get_stats(&b_tx.stream, &st_b);
+	ustream_get_stats(NULL, &total);
+
+	ustream_free(&a_tx.stream);
+	ustream_free(&a_rx.stream);
+	ustream_free(&b_tx.stream);
+	ustream_free(&b_rx.stream);
+	uloop_done();
+
+	if (received != LEN_A + LEN_B) {
+		fprintf(stderr, "received %d of %d bytes\n", received, LEN_A + LEN_B);
+		return 1;
+	}
+
+	if (!total.tx_bytes) {
+		printf("ustream stats disabled, build with -DUSTREAM_STATS=ON\n");
+		return 0;
+	}
+
+	print_stats("a", &st_a);
+	print_stats("b", &st_b);
+	print_stats("total", &total);
+
+	if (st_a.peak_buffered < LEN_A || st_b.peak_buffered < LEN_B) {
+		fprintf(stderr, "per-stream peak too small\n");
+		errors++;
+	}
+
+	/* both streams held their data at the same time */
+	if (total.peak_buffered < st_a.peak_buffered + st_b.peak_buffered) {
+		fprintf(stderr, "global peak does not cover both streams\n");
+		errors++;
+	}
+
+	return errors ? 1 : 0;
+}
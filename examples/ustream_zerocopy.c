@@ -0,0 +1,356 @@
+/*
+ * ustream_zerocopy.c - MSG_ZEROCOPY writes over a loopback TCP connection
+ *
+ * interleaves copied and zero-copy writes, checks the data arriving on the
+ * other end and that each zero-copy buffer is only released once the
+ * kernel has signalled its completion. the same run is repeated over a
+ * unix socket pair, which has no SO_ZEROCOPY support and exercises the
+ * copying fallback. a last run frees the sending stream with data still
+ * queued and checks that every buffer is released and the connection only
+ * closes once the data in flight has completed.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "libubox/ustream.h"
+#include "libubox/uloop.h"
+
+#define ZC_BUFS		16
+#define ZC_LEN		(128 * 1024)
+#define SMALL_LEN	100
+
+struct test_buf {
+	struct ustream_zc_buf zb;
+	char *mem;
+	bool released;
+};
+
+static struct ustream_fd tx, rx;
+static struct uloop_timeout timeout;
+static struct test_buf bufs[ZC_BUFS];
+static uint64_t rx_total, tx_total;
+static bool zerocopy, in_write, freed, rx_eof;
+static int released, errors;
+
+static char pattern(uint64_t ofs)
+{
+	return (ofs * 7 + (ofs >> 11)) & 0xff;
+}
+
+static void fill(char *mem, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		mem[i] = pattern(tx_total + i);
+}
+
+static void check_done(void)
+{
+	if (released != ZC_BUFS)
+		return;
+
+	if (freed ? rx_eof : rx_total == tx_total)
+		uloop_end();
+}
+
+static void buf_release(struct ustream_zc_buf *zb)
+{
+	struct test_buf *b = container_of(zb, struct test_buf, zb);
+	int idx = b - bufs;
+
+	/*
+	 * TCP completes in order, so releases must be in order as well. Freeing
+	 * the stream releases what was never sent right away.
+	 */
+	if (b->released || (idx != released && !freed)) {
+		fprintf(stderr, "buffer %d released out of order\n", idx);
+		errors++;
+	}
+
+	/* with zero-copy, release must come from the error queue */
+	if (zerocopy && in_write) {
+		fprintf(stderr, "buffer %d released before its completion\n", idx);
+		errors++;
+	}
+
+	if (!zerocopy && !in_write && !freed) {
+		fprintf(stderr, "copied buffer %d released late\n", idx);
+		errors++;
+	}
+
+	/* scribble over it, the receiver would notice a premature release */
+	memset(b->mem, 0x55, zb->len);
+	b->released = true;
+	released++;
+	check_done();
+}
+
+static void rx_read_cb(struct ustream *s, int bytes)
+{
+	char *data;
+	int len, i;
+
+	while ((data = ustream_get_read_buf(s, &len)) != NULL) {
+		for (i = 0; i < len; i++) {
+			if (data[i] == pattern(rx_total + i))
+				continue;
+
+			fprintf(stderr, "data mismatch at offset %llu\n",
+				(unsigned long long) rx_total + i);
+			errors++;
+			uloop_end();
+			return;
+		}
+		rx_total += len;
+		ustream_consume(s, len);
+	}
+	check_done();
+}
+
+static void rx_state_cb(struct ustream *s)
+{
+	rx_eof = s->eof;
+	check_done();
+}
+
+static void timeout_cb(struct uloop_timeout *t)
+{
+	fprintf(stderr, "timed out: %d/%d released, %llu/%llu bytes received\n",
+		released, ZC_BUFS, (unsigned long long) rx_total,
+		(unsigned long long) tx_total);
+	errors++;
+	uloop_end();
+}
+
+static void write_small(void)
+{
+	char small[SMALL_LEN];
+
+	fill(small, sizeof(small));
+	ustream_write(&tx.stream, small, sizeof(small), false);
+	tx_total += sizeof(small);
+}
+
+static int run(const char *name, int tx_fd, int rx_fd)
+{
+	int i, ret;
+
+	memset(bufs, 0, sizeof(bufs));
+	released = 0;
+	errors = 0;
+	rx_total = tx_total = 0;
+
+	ustream_fd_init(&tx, tx_fd);
+	ustream_fd_init(&rx, rx_fd);
+	rx.stream.notify_read = rx_read_cb;
+
+	zerocopy = !ustream_fd_set_zerocopy(&tx, 0);
+	printf("%s: zero-copy %s\n", name, zerocopy ? "enabled" : "unsupported");
+
+	for (i = 0; i < ZC_BUFS; i++) {
+		struct test_buf *b = &bufs[i];
+
+		write_small();
+
+		b->mem = malloc(ZC_LEN);
+		fill(b->mem, ZC_LEN);
+		b->zb.data = b->mem;
+		b->zb.len = ZC_LEN;
+		b->zb.release = buf_release;
+		tx_total += ZC_LEN;
+
+		in_write = true;
+		ret = ustream_fd_write_zerocopy(&tx, &b->zb);
+		in_write = false;
+		if (ret != ZC_LEN) {
+			fprintf(stderr, "write_zerocopy returned %d\n", ret);
+			errors++;
+		}
+	}
+	write_small();
+
+	timeout.cb = timeout_cb;
+	uloop_timeout_set(&timeout, 5000);
+	uloop_run();
+	uloop_timeout_cancel(&timeout);
+
+	/* nothing may be left for ustream_free() to release */
+	if (released != ZC_BUFS) {
+		fprintf(stderr, "only %d/%d buffers released\n", released, ZC_BUFS);
+		errors++;
+	}
+
+	ustream_free(&tx.stream);
+	ustream_free(&rx.stream);
+	close(tx_fd);
+	close(rx_fd);
+	for (i = 0; i < ZC_BUFS; i++)
+		free(bufs[i].mem);
+
+	printf("%s: %llu bytes, %d buffers released, %s\n", name,
+	       (unsigned long long) rx_total, released, errors ? "FAILED" : "ok");
+
+	return errors;
+}
+
+static int run_free(const char *name, int tx_fd, int rx_fd)
+{
+	int i, size = 64 * 1024;
+
+	memset(bufs, 0, sizeof(bufs));
+	released = 0;
+	errors = 0;
+	rx_total = tx_total = 0;
+	rx_eof = false;
+
+	/* small buffers and a stalled reader keep most of it queued */
+	setsockopt(tx_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	setsockopt(rx_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	ustream_fd_init(&tx, tx_fd);
+	ustream_fd_init(&rx, rx_fd);
+	rx.stream.notify_read = rx_read_cb;
+	rx.stream.notify_state = rx_state_cb;
+	ustream_set_read_blocked(&rx.stream, true);
+
+	zerocopy = !ustream_fd_set_zerocopy(&tx, 0);
+	if (!zerocopy) {
+		printf("%s: zero-copy unsupported, skipped\n", name);
+		goto out;
+	}
+
+	for (i = 0; i < ZC_BUFS; i++) {
+		struct test_buf *b = &bufs[i];
+
+		b->mem = malloc(ZC_LEN);
+		fill(b->mem, ZC_LEN);
+		b->zb.data = b->mem;
+		b->zb.len = ZC_LEN;
+		b->zb.release = buf_release;
+		tx_total += ZC_LEN;
+		ustream_fd_write_zerocopy(&tx, &b->zb);
+	}
+
+	freed = true;
+	ustream_free(&tx.stream);
+	close(tx_fd);
+	tx_fd = -1;
+
+	ustream_set_read_blocked(&rx.stream, false);
+	timeout.cb = timeout_cb;
+	uloop_timeout_set(&timeout, 5000);
+	uloop_run();
+	uloop_timeout_cancel(&timeout);
+	freed = false;
+
+	if (released != ZC_BUFS || !rx_eof) {
+		fprintf(stderr, "%d/%d buffers released, eof %d\n", released,
+			ZC_BUFS, rx_eof);
+		errors++;
+	}
+
+	printf("%s: %llu of %llu bytes before close, %d buffers released, %s\n",
+	       name, (unsigned long long) rx_total, (unsigned long long) tx_total,
+	       released, errors ? "FAILED" : "ok");
+
+out:
+	if (tx_fd >= 0) {
+		ustream_free(&tx.stream);
+		close(tx_fd);
+	}
+	ustream_free(&rx.stream);
+	close(rx_fd);
+	for (i = 0; i < ZC_BUFS; i++)
+		free(bufs[i].mem);
+
+	return errors;
+}
+
+static int tcp_pair(int *fds)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(sin);
+	int lfd;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0)
+		return -1;
+
+	if (bind(lfd, (struct sockaddr *) &sin, sizeof(sin)) < 0 ||
+	    listen(lfd, 1) < 0 ||
+	    getsockname(lfd, (struct sockaddr *) &sin, &len) < 0)
+		goto error;
+
+	fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fds[0] < 0)
+		goto error;
+
+	if (connect(fds[0], (struct sockaddr *) &sin, sizeof(sin)) < 0)
+		goto error_close;
+
+	fds[1] = accept(lfd, NULL, NULL);
+	if (fds[1] < 0)
+		goto error_close;
+
+	close(lfd);
+	return 0;
+
+error_close:
+	close(fds[0]);
+error:
+	close(lfd);
+	return -1;
+}
+
+static void set_nonblock(int *fds)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+}
+
+int main(int argc, char **argv)
+{
+	int fds[2];
+	int ret = 0;
+
+	uloop_init();
+
+	if (tcp_pair(fds) < 0) {
+		perror("tcp_pair");
+		return 1;
+	}
+	set_nonblock(fds);
+	ret |= run("tcp", fds[0], fds[1]);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	set_nonblock(fds);
+	ret |= run("unix", fds[0], fds[1]);
+
+	if (tcp_pair(fds) < 0) {
+		perror("tcp_pair");
+		return 1;
+	}
+	set_nonblock(fds);
+	ret |= run_free("tcp free", fds[0], fds[1]);
+
+	uloop_done();
+
+	return ret ? 1 : 0;
+}
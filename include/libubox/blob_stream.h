@@ -0,0 +1 @@
+../../src/blob_stream.h
\ No newline at end of file
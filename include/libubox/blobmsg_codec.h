@@ -0,0 +1 @@
+../../src/blobmsg_codec.h
\ No newline at end of file
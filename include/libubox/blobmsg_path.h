@@ -0,0 +1 @@
+../../src/blobmsg_path.h
\ No newline at end of file
@@ -16,28 +16,66 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <limits.h>
+
 #include "blob.h"
 
 static bool
 blob_buffer_grow(struct blob_buf *buf, int minlen)
 {
 	struct blob_buf *new;
-	int delta = ((minlen / 256) + 1) * 256;
+	int max = (INT_MAX - buf->buflen) & ~255;
+	int delta;
+
+	/* buflen is an int, keep the new size representable */
+	if (minlen < 0 || minlen >= max)
+		return false;
+
+	delta = ((minlen / 256) + 1) * 256;
+
+	/* grow geometrically to keep the number of reallocs logarithmic */
+	if (delta < buf->buflen)
+		delta = buf->buflen;
+	if (delta > max)
+		delta = max;
+
+	/* no need to clear the new space, every attribute fills its padding */
 	new = realloc(buf->buf, buf->buflen + delta);
 	if (new) {
 		buf->buf = new;
-		memset(buf->buf + buf->buflen, 0, delta);
 		buf->buflen += delta;
 	}
 	return !!new;
 }
 
 static void
-blob_init(struct blob_attr *attr, int id, unsigned int len)
+blob_init(struct blob_attr *attr, int id, unsigned int len, bool native)
 {
-	len &= BLOB_ATTR_LEN_MASK;
-	len |= (id << BLOB_ATTR_ID_SHIFT) & BLOB_ATTR_ID_MASK;
-	attr->id_len = cpu_to_be32(len);
+	unsigned int id_len = (id << BLOB_ATTR_ID_SHIFT) & BLOB_ATTR_ID_MASK;
+
+	if (!native && len > BLOB_ATTR_LEN_MASK) {
+		attr->id_len = cpu_to_be32(id_len | BLOB_ATTR_LEN_LONG);
+		*(uint32_t *) attr->data = cpu_to_be32(len);
+		return;
+	}
+
+	id_len |= len & BLOB_ATTR_LEN_MASK;
+	attr->id_len = native ? id_len : cpu_to_be32(id_len);
+}
+
+/* size of a new attribute with the given payload, including padding */
+static unsigned int
+blob_attr_size(bool native, int payload, unsigned int *raw_len)
+{
+	unsigned int len = sizeof(struct blob_attr) + payload;
+
+	if (!native && len > BLOB_ATTR_LEN_MASK)
+		len += sizeof(uint32_t);
+
+	if (raw_len)
+		*raw_len = len;
+
+	return (len + BLOB_ATTR_ALIGN - 1) & ~(BLOB_ATTR_ALIGN - 1);
 }
 
 static inline struct blob_attr *
@@ -53,11 +91,56 @@ attr_to_offset(struct blob_buf *buf, struct blob_attr *attr)
 	return (char *)attr - (char *) buf->buf + BLOB_COOKIE;
 }
 
+/* everything but the root header is in host byte order for native buffers */
+static inline bool
+blob_buf_attr_native(struct blob_buf *buf, struct blob_attr *attr)
+{
+	return buf->native && attr != buf->buf;
+}
+
+static unsigned int
+blob_buf_pad_len(struct blob_buf *buf, struct blob_attr *attr)
+{
+	if (blob_buf_attr_native(buf, attr))
+		return blob_native_pad_len(attr);
+
+	return blob_pad_len(attr);
+}
+
+static void *
+blob_buf_data(struct blob_buf *buf, struct blob_attr *attr)
+{
+	if (blob_buf_attr_native(buf, attr))
+		return attr->data;
+
+	return blob_data(attr);
+}
+
+static struct blob_attr *
+blob_buf_next(struct blob_buf *buf, struct blob_attr *attr)
+{
+	return (struct blob_attr *) ((char *) attr + blob_buf_pad_len(buf, attr));
+}
+
+static void
+blob_buf_set_raw_len(struct blob_buf *buf, struct blob_attr *attr, unsigned int len)
+{
+	if (!blob_buf_attr_native(buf, attr)) {
+		blob_set_raw_len(attr, len);
+		return;
+	}
+
+	len &= BLOB_ATTR_LEN_MASK;
+	attr->id_len &= ~BLOB_ATTR_LEN_MASK;
+	attr->id_len |= len;
+}
+
 bool
 blob_buf_grow(struct blob_buf *buf, int required)
 {
 	int offset_head = attr_to_offset(buf, buf->head);
 
+	buf->gen++;
 	if (!buf->grow || !buf->grow(buf, required))
 		return false;
 
@@ -69,9 +152,19 @@ static struct blob_attr *
 blob_add(struct blob_buf *buf, struct blob_attr *pos, int id, int payload)
 {
 	int offset = attr_to_offset(buf, pos);
-	int required = (offset - BLOB_COOKIE + sizeof(struct blob_attr) + payload) - buf->buflen;
+	bool native = blob_buf_attr_native(buf, pos);
+	unsigned int raw_len, pad_len = blob_attr_size(native, payload, &raw_len);
+	int required = (offset - BLOB_COOKIE + pad_len) - buf->buflen;
 	struct blob_attr *attr;
 
+	/*
+	 * native headers have no long form, keep the whole message within
+	 * 24 bits so that no container can outgrow them
+	 */
+	if (buf->native && offset - BLOB_COOKIE + pad_len > BLOB_ATTR_LEN_MASK)
+		return NULL;
+
+	buf->gen++;
 	if (required > 0) {
 		if (!blob_buf_grow(buf, required))
 			return NULL;
@@ -80,30 +173,61 @@ blob_add(struct blob_buf *buf, struct blob_attr *pos, int id, int payload)
 		attr = pos;
 	}
 
-	blob_init(attr, id, payload + sizeof(struct blob_attr));
-	blob_fill_pad(attr);
+	blob_init(attr, id, raw_len, native);
+
+	/* same as blob_fill_pad(), independent of the header byte order */
+	memset((char *) attr + raw_len, 0, pad_len - raw_len);
 	return attr;
 }
 
-int
-blob_buf_init(struct blob_buf *buf, int id)
+static int
+__blob_buf_init(struct blob_buf *buf, int id, int size)
 {
 	if (!buf->grow)
 		buf->grow = blob_buffer_grow;
 
+	/* the previous message is gone, even if the memory is reused */
+	buf->gen++;
 	buf->head = buf->buf;
+	if (size > buf->buflen) {
+		if (!buf->grow(buf, size - buf->buflen))
+			return -ENOMEM;
+		buf->head = buf->buf;
+	}
+
 	if (blob_add(buf, buf->buf, id, 0) == NULL)
 		return -ENOMEM;
 
 	return 0;
 }
 
+int
+blob_buf_init(struct blob_buf *buf, int id)
+{
+	return blob_buf_init_size(buf, id, 0);
+}
+
+int
+blob_buf_init_native(struct blob_buf *buf, int id)
+{
+	buf->native = true;
+	return __blob_buf_init(buf, id, 0);
+}
+
+int
+blob_buf_init_size(struct blob_buf *buf, int id, int size)
+{
+	buf->native = false;
+	return __blob_buf_init(buf, id, size);
+}
+
 void
 blob_buf_free(struct blob_buf *buf)
 {
 	free(buf->buf);
 	buf->buf = NULL;
 	buf->buflen = 0;
+	buf->gen++;
 }
 
 void
@@ -120,21 +244,61 @@ blob_fill_pad(struct blob_attr *attr)
 void
 blob_set_raw_len(struct blob_attr *attr, unsigned int len)
 {
+	if (blob_is_long(attr)) {
+		*(uint32_t *) attr->data = cpu_to_be32(len);
+		return;
+	}
+
 	len &= BLOB_ATTR_LEN_MASK;
 	attr->id_len &= ~cpu_to_be32(BLOB_ATTR_LEN_MASK);
 	attr->id_len |= cpu_to_be32(len);
 }
 
+/*
+ * switch an open container to the long header once it outgrows 24 bits.
+ * end is the offset of the end of the data in use, everything between
+ * the header and end moves up by 4 bytes. Nest cookies only point at this
+ * container or those further out, which do not move.
+ */
+static struct blob_attr *
+blob_buf_make_long(struct blob_buf *buf, struct blob_attr *attr, int end)
+{
+	int offset = attr_to_offset(buf, attr);
+	int data = offset - BLOB_COOKIE + sizeof(struct blob_attr);
+	int required = end + sizeof(uint32_t) - buf->buflen;
+	unsigned int len;
+
+	if (required > 0 && !blob_buf_grow(buf, required))
+		return NULL;
+
+	attr = offset_to_attr(buf, offset);
+	len = blob_raw_len(attr) + sizeof(uint32_t);
+	memmove(attr->data + sizeof(uint32_t), attr->data, end - data);
+
+	attr->id_len &= ~cpu_to_be32(BLOB_ATTR_LEN_MASK);
+	attr->id_len |= cpu_to_be32(BLOB_ATTR_LEN_LONG);
+	*(uint32_t *) attr->data = cpu_to_be32(len);
+	return attr;
+}
+
 struct blob_attr *
 blob_new(struct blob_buf *buf, int id, int payload)
 {
+	struct blob_attr *head = buf->head;
 	struct blob_attr *attr;
 
-	attr = blob_add(buf, blob_next(buf->head), id, payload);
+	if (!buf->native && !blob_is_long(head) &&
+	    blob_pad_len(head) + blob_attr_size(buf->native, payload, NULL) > BLOB_ATTR_LEN_MASK &&
+	    !blob_buf_make_long(buf, head, attr_to_offset(buf, head) - BLOB_COOKIE +
+				blob_pad_len(head)))
+		return NULL;
+
+	attr = blob_add(buf, blob_buf_next(buf, buf->head), id, payload);
 	if (!attr)
 		return NULL;
 
-	blob_set_raw_len(buf->head, blob_pad_len(buf->head) + blob_pad_len(attr));
+	blob_buf_set_raw_len(buf, buf->head, blob_buf_pad_len(buf, buf->head) +
+			     blob_buf_pad_len(buf, attr));
 	return attr;
 }
 
@@ -146,10 +310,10 @@ blob_put_raw(struct blob_buf *buf, const void *ptr, unsigned int len)
 	if (len < sizeof(struct blob_attr) || !ptr)
 		return NULL;
 
-	attr = blob_add(buf, blob_next(buf->head), 0, len - sizeof(struct blob_attr));
+	attr = blob_add(buf, blob_buf_next(buf, buf->head), 0, len - sizeof(struct blob_attr));
 	if (!attr)
 		return NULL;
-	blob_set_raw_len(buf->head, blob_pad_len(buf->head) + len);
+	blob_buf_set_raw_len(buf, buf->head, blob_buf_pad_len(buf, buf->head) + len);
 	memcpy(attr, ptr, len);
 	return attr;
 }
@@ -164,7 +328,7 @@ blob_put(struct blob_buf *buf, int id, const void *ptr, unsigned int len)
 		return NULL;
 
 	if (ptr)
-		memcpy(blob_data(attr), ptr, len);
+		memcpy(blob_buf_data(buf, attr), ptr, len);
 	return attr;
 }
 
@@ -182,7 +346,28 @@ void
 blob_nest_end(struct blob_buf *buf, void *cookie)
 {
 	struct blob_attr *attr = offset_to_attr(buf, (unsigned long) cookie);
-	blob_set_raw_len(attr, blob_pad_len(attr) + blob_len(buf->head));
+	unsigned int len;
+
+	buf->gen++;
+	if (blob_buf_attr_native(buf, buf->head)) {
+		len = blob_native_len(buf->head);
+		goto out;
+	}
+
+	/* the parent only accounted for the short header so far */
+	len = blob_raw_len(buf->head) - sizeof(struct blob_attr);
+	if (!blob_buf_attr_native(buf, attr) && !blob_is_long(attr) &&
+	    blob_pad_len(attr) + len > BLOB_ATTR_LEN_MASK) {
+		struct blob_attr *head = buf->head;
+		struct blob_attr *new;
+
+		new = blob_buf_make_long(buf, attr, attr_to_offset(buf, head) -
+					 BLOB_COOKIE + blob_pad_len(head));
+		attr = new ? new : offset_to_attr(buf, (unsigned long) cookie);
+	}
+
+out:
+	blob_buf_set_raw_len(buf, attr, blob_buf_pad_len(buf, attr) + len);
 	buf->head = attr;
 }
 
@@ -216,38 +401,63 @@ blob_check_type(const void *ptr, unsigned int len, int type)
 	return true;
 }
 
-int
-blob_parse(struct blob_attr *attr, struct blob_attr **data, const struct blob_attr_info *info, int max)
+static bool
+blob_parse_attr(struct blob_attr *pos, void *data, int id, int len,
+		const struct blob_attr_info *info)
 {
-	struct blob_attr *pos;
-	int found = 0;
-	int rem;
+	int type = info[id].type;
 
-	memset(data, 0, sizeof(struct blob_attr *) * max);
-	blob_for_each_attr(pos, attr, rem) {
-		int id = blob_id(pos);
-		int len = blob_len(pos);
+	if (type < BLOB_ATTR_LAST) {
+		if (!blob_check_type(data, len, type))
+			return false;
+	}
 
-		if (id >= max)
-			continue;
+	if (info[id].minlen && len < info[id].minlen)
+		return false;
 
-		if (info) {
-			int type = info[id].type;
+	if (info[id].maxlen && len > info[id].maxlen)
+		return false;
 
-			if (type < BLOB_ATTR_LAST) {
-				if (!blob_check_type(blob_data(pos), len, type))
-					continue;
-			}
+	if (info[id].validate && !info[id].validate(&info[id], pos))
+		return false;
 
-			if (info[id].minlen && len < info[id].minlen)
-				continue;
+	return true;
+}
+
+static int
+blob_parse_list(void *list, int rem, struct blob_attr **data,
+		const struct blob_attr_info *info, int max, bool native)
+{
+	struct blob_attr *pos;
+	int found = 0;
+
+	memset(data, 0, sizeof(struct blob_attr *) * max);
+	if (native) {
+		__blob_for_each_attr_native(pos, list, rem) {
+			int id = blob_native_id(pos);
 
-			if (info[id].maxlen && len > info[id].maxlen)
+			if (id >= max)
 				continue;
 
-			if (info[id].validate && !info[id].validate(&info[id], pos))
+			if (info && !blob_parse_attr(pos, pos->data, id, blob_native_len(pos), info))
 				continue;
+
+			if (!data[id])
+				found++;
+
+			data[id] = pos;
 		}
+		return found;
+	}
+
+	__blob_for_each_attr(pos, list, rem) {
+		int id = blob_id(pos);
+
+		if (id >= max)
+			continue;
+
+		if (info && !blob_parse_attr(pos, blob_data(pos), id, blob_len(pos), info))
+			continue;
 
 		if (!data[id])
 			found++;
@@ -257,6 +467,100 @@ blob_parse(struct blob_attr *attr, struct blob_attr **data, const struct blob_at
 	return found;
 }
 
+int
+blob_parse(struct blob_attr *attr, struct blob_attr **data, const struct blob_attr_info *info, int max)
+{
+	if (!attr)
+		return blob_parse_list(NULL, 0, data, info, max, false);
+
+	return blob_parse_list(blob_data(attr), blob_len(attr), data, info, max, false);
+}
+
+int
+blob_parse_root_native(struct blob_attr *root, struct blob_attr **data, const struct blob_attr_info *info, int max)
+{
+	if (!root)
+		return blob_parse_list(NULL, 0, data, info, max, true);
+
+	return blob_parse_list(blob_data(root), blob_len(root), data, info, max, true);
+}
+
+int
+blob_parse_native(struct blob_attr *attr, struct blob_attr **data, const struct blob_attr_info *info, int max)
+{
+	if (!attr)
+		return blob_parse_list(NULL, 0, data, info, max, true);
+
+	return blob_parse_list(attr->data, blob_native_len(attr), data, info, max, true);
+}
+
+static int
+blob_convert_list(void *data, unsigned int rem, const struct blob_attr_info *info,
+		  int max, bool native)
+{
+	struct blob_attr *pos = data;
+	unsigned int id_len, len, pad_len;
+	uint16_t *v16;
+	uint32_t *v32;
+	uint64_t v64;
+	int id, type;
+
+	while (rem > 0) {
+		if (rem < sizeof(struct blob_attr))
+			return -1;
+
+		/* the header is still in the old byte order */
+		id_len = native ? be32_to_cpu(pos->id_len) : pos->id_len;
+		len = id_len & BLOB_ATTR_LEN_MASK;	/* long headers are rejected below */
+		pad_len = (len + BLOB_ATTR_ALIGN - 1) & ~(BLOB_ATTR_ALIGN - 1);
+		if (len < sizeof(struct blob_attr) || pad_len > rem)
+			return -1;
+
+		len -= sizeof(struct blob_attr);
+		id = (id_len & BLOB_ATTR_ID_MASK) >> BLOB_ATTR_ID_SHIFT;
+		type = (info && id < max) ? info[id].type : BLOB_ATTR_BINARY;
+
+		switch (type) {
+		case BLOB_ATTR_NESTED:
+			if (blob_convert_list(pos->data, len, info, max, native))
+				return -1;
+			break;
+		case BLOB_ATTR_INT16:
+			if (len != sizeof(*v16))
+				return -1;
+			v16 = (uint16_t *) pos->data;
+			*v16 = native ? be16_to_cpu(*v16) : cpu_to_be16(*v16);
+			break;
+		case BLOB_ATTR_INT32:
+			if (len != sizeof(*v32))
+				return -1;
+			v32 = (uint32_t *) pos->data;
+			*v32 = native ? be32_to_cpu(*v32) : cpu_to_be32(*v32);
+			break;
+		case BLOB_ATTR_INT64:
+			if (len != sizeof(v64))
+				return -1;
+			memcpy(&v64, pos->data, sizeof(v64));
+			v64 = native ? be64_to_cpu(v64) : cpu_to_be64(v64);
+			memcpy(pos->data, &v64, sizeof(v64));
+			break;
+		}
+
+		pos->id_len = native ? id_len : cpu_to_be32(id_len);
+		pos = (struct blob_attr *) ((char *) pos + pad_len);
+		rem -= pad_len;
+	}
+
+	return 0;
+}
+
+int
+blob_convert(struct blob_attr *root, const struct blob_attr_info *info,
+	     int max, bool native)
+{
+	return blob_convert_list(blob_data(root), blob_len(root), info, max, native);
+}
+
 bool
 blob_attr_equal(const struct blob_attr *a1, const struct blob_attr *a2)
 {
@@ -272,6 +576,110 @@ blob_attr_equal(const struct blob_attr *a1, const struct blob_attr *a2)
 	return !memcmp(a1, a2, blob_pad_len(a1));
 }
 
+#define HASH_P1	11400714785074694791ULL
+#define HASH_P2	14029467366897019727ULL
+#define HASH_P3	1609587929392839161ULL
+#define HASH_P4	9650029242287828579ULL
+#define HASH_P5	2870177450012600261ULL
+
+static inline uint64_t
+hash_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+hash_read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le64_to_cpu(v);
+}
+
+static inline uint32_t
+hash_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32_to_cpu(v);
+}
+
+static inline uint64_t
+hash_round(uint64_t acc, uint64_t input)
+{
+	acc += input * HASH_P2;
+	acc = hash_rotl(acc, 31);
+	return acc * HASH_P1;
+}
+
+static inline uint64_t
+hash_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= hash_round(0, val);
+	return acc * HASH_P1 + HASH_P4;
+}
+
+uint64_t
+blob_hash_data(const void *data, size_t len, uint64_t seed)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		/* four independent lanes keep the multipliers busy */
+		uint64_t v1 = seed + HASH_P1 + HASH_P2;
+		uint64_t v2 = seed + HASH_P2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - HASH_P1;
+
+		do {
+			v1 = hash_round(v1, hash_read64(p));
+			v2 = hash_round(v2, hash_read64(p + 8));
+			v3 = hash_round(v3, hash_read64(p + 16));
+			v4 = hash_round(v4, hash_read64(p + 24));
+			p += 32;
+		} while (p <= end - 32);
+
+		h = hash_rotl(v1, 1) + hash_rotl(v2, 7) +
+		    hash_rotl(v3, 12) + hash_rotl(v4, 18);
+		h = hash_merge(h, v1);
+		h = hash_merge(h, v2);
+		h = hash_merge(h, v3);
+		h = hash_merge(h, v4);
+	} else {
+		h = seed + HASH_P5;
+	}
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= hash_round(0, hash_read64(p));
+		h = hash_rotl(h, 27) * HASH_P1 + HASH_P4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t) hash_read32(p) * HASH_P1;
+		h = hash_rotl(h, 23) * HASH_P2 + HASH_P3;
+		p += 4;
+	}
+
+	for (; p < end; p++) {
+		h ^= *p * HASH_P5;
+		h = hash_rotl(h, 11) * HASH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= HASH_P2;
+	h ^= h >> 29;
+	h *= HASH_P3;
+	h ^= h >> 32;
+
+	return h;
+}
+
 struct blob_attr *
 blob_memdup(struct blob_attr *attr)
 {
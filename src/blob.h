@@ -48,6 +48,20 @@ enum {
 #define BLOB_ATTR_ALIGN    4
 #define BLOB_ATTR_EXTENDED 0x80000000
 
+/*
+ * length field value for attributes of 16 MB and more: the real length
+ * (including the now 8 byte header) follows as a big endian 32 bit word.
+ * The only free header bit, BLOB_ATTR_EXTENDED, already marks blobmsg
+ * attributes, so a length that is never valid on its
+ * own, below the 4 byte header, is used as the marker instead.
+ *
+ * This changes the wire format: readers predating long headers see a raw
+ * length of 1, which pads to 4 and passes their checks, and then take the
+ * length word for payload and the rest of the attribute for its siblings.
+ * Only send long attributes to peers known to understand them.
+ */
+#define BLOB_ATTR_LEN_LONG 1
+
 struct blob_attr {
 	uint32_t id_len;
 	char data[];
@@ -65,15 +79,33 @@ struct blob_buf {
 	bool (*grow)(struct blob_buf *buf, int minlen);
 	int buflen;
 	void *buf;
+	bool native;
+	/* bumped on every change, lets side indexes detect stale pointers */
+	unsigned int gen;
 };
 
+static inline bool
+blob_is_long(const struct blob_attr *attr)
+{
+	return (be32_to_cpu(attr->id_len) & BLOB_ATTR_LEN_MASK) == BLOB_ATTR_LEN_LONG;
+}
+
+/*
+ * blob_hdr_len: returns the length of the attribute header
+ */
+static inline unsigned int
+blob_hdr_len(const struct blob_attr *attr)
+{
+	return sizeof(struct blob_attr) + (blob_is_long(attr) ? sizeof(uint32_t) : 0);
+}
+
 /*
  * blob_data: returns the data pointer for an attribute
  */
 static inline void *
 blob_data(const struct blob_attr *attr)
 {
-	return (void *) attr->data;
+	return (char *) attr + blob_hdr_len(attr);
 }
 
 /*
@@ -93,21 +125,32 @@ blob_is_extended(const struct blob_attr *attr)
 }
 
 /*
- * blob_len: returns the length of the attribute's payload
+ * blob_raw_len: returns the complete length of an attribute (including the header)
  */
 static inline unsigned int
-blob_len(const struct blob_attr *attr)
+blob_raw_len(const struct blob_attr *attr)
 {
-	return (be32_to_cpu(attr->id_len) & BLOB_ATTR_LEN_MASK) - sizeof(struct blob_attr);
+	unsigned int len = be32_to_cpu(attr->id_len) & BLOB_ATTR_LEN_MASK;
+
+	if (len == BLOB_ATTR_LEN_LONG)
+		len = be32_to_cpu(*(uint32_t *) attr->data);
+
+	return len;
 }
 
 /*
- * blob_raw_len: returns the complete length of an attribute (including the header)
+ * blob_len: returns the length of the attribute's payload, 0 for a header
+ * that claims less than its own size
  */
 static inline unsigned int
-blob_raw_len(const struct blob_attr *attr)
+blob_len(const struct blob_attr *attr)
 {
-	return blob_len(attr) + sizeof(struct blob_attr);
+	unsigned int len = blob_raw_len(attr);
+
+	if (len < blob_hdr_len(attr))
+		return 0;
+
+	return len - blob_hdr_len(attr);
 }
 
 /*
@@ -177,7 +220,7 @@ blob_get_int64(const struct blob_attr *attr)
 static inline const char *
 blob_get_string(const struct blob_attr *attr)
 {
-	return attr->data;
+	return blob_data(attr);
 }
 
 static inline struct blob_attr *
@@ -186,19 +229,198 @@ blob_next(const struct blob_attr *attr)
 	return (struct blob_attr *) ((char *) attr + blob_pad_len(attr));
 }
 
+/*
+ * host byte order accessors, for attributes below the root of a message
+ * built with blob_buf_init_native(). Nothing in the message marks it as
+ * native, the code handling it has to know.
+ */
+static inline unsigned int
+blob_native_id(const struct blob_attr *attr)
+{
+	return (attr->id_len & BLOB_ATTR_ID_MASK) >> BLOB_ATTR_ID_SHIFT;
+}
+
+static inline unsigned int
+blob_native_raw_len(const struct blob_attr *attr)
+{
+	return attr->id_len & BLOB_ATTR_LEN_MASK;
+}
+
+static inline unsigned int
+blob_native_len(const struct blob_attr *attr)
+{
+	unsigned int len = blob_native_raw_len(attr);
+
+	if (len < sizeof(struct blob_attr))
+		return 0;
+
+	return len - sizeof(struct blob_attr);
+}
+
+static inline unsigned int
+blob_native_pad_len(const struct blob_attr *attr)
+{
+	unsigned int len = blob_native_raw_len(attr);
+	len = (len + BLOB_ATTR_ALIGN - 1) & ~(BLOB_ATTR_ALIGN - 1);
+	return len;
+}
+
+static inline struct blob_attr *
+blob_native_next(const struct blob_attr *attr)
+{
+	return (struct blob_attr *) ((char *) attr + blob_native_pad_len(attr));
+}
+
+static inline uint16_t
+blob_native_get_u16(const struct blob_attr *attr)
+{
+	return *(uint16_t *) attr->data;
+}
+
+static inline uint32_t
+blob_native_get_u32(const struct blob_attr *attr)
+{
+	return *(uint32_t *) attr->data;
+}
+
+static inline uint64_t
+blob_native_get_u64(const struct blob_attr *attr)
+{
+	uint64_t tmp;
+
+	memcpy(&tmp, attr->data, sizeof(tmp));
+	return tmp;
+}
+
 extern void blob_fill_pad(struct blob_attr *attr);
 extern void blob_set_raw_len(struct blob_attr *attr, unsigned int len);
 extern bool blob_attr_equal(const struct blob_attr *a1, const struct blob_attr *a2);
+
+/*
+ * blob_hash: 64 bit content hash of an attribute (header and payload)
+ *
+ * non-cryptographic (the XXH64 algorithm), meant for cache keys and for
+ * skipping full compares. The result is the same on every host.
+ */
+extern uint64_t blob_hash_data(const void *data, size_t len, uint64_t seed);
+
+static inline uint64_t
+blob_hash(const struct blob_attr *attr)
+{
+	return blob_hash_data(attr, blob_raw_len(attr), 0);
+}
+
+/* blob_attr_equal() for attributes with known hashes */
+static inline bool
+blob_attr_equal_hash(const struct blob_attr *a1, uint64_t h1,
+		     const struct blob_attr *a2, uint64_t h2)
+{
+	return h1 == h2 && blob_attr_equal(a1, a2);
+}
+/*
+ * blob_buf_init: start a new message in buf
+ *
+ * an existing allocation is kept and reused, so a blob_buf that is
+ * initialized again for every message only allocates until it has reached
+ * the size of the largest message. blob_buf_init_size() additionally makes
+ * sure that at least size bytes are available up front.
+ */
 extern int blob_buf_init(struct blob_buf *buf, int id);
+extern int blob_buf_init_size(struct blob_buf *buf, int id, int size);
+/*
+ * blob_buf_init_native: start a message in host byte order
+ *
+ * cheaper to build and to read with the blob_native_* accessors, but only
+ * meant for messages that stay on the host. Use blob_convert() before
+ * passing them on to anything that expects the big endian format.
+ * blobmsg is big endian only, adding blobmsg attributes to a native buffer
+ * fails. Native headers have no long form, so adding anything that would
+ * take the message past BLOB_ATTR_LEN_MASK bytes fails as well.
+ */
+extern int blob_buf_init_native(struct blob_buf *buf, int id);
+/*
+ * blob_convert: switch a message between big endian and host byte order
+ *
+ * converts the message below root in place, to host byte order if native
+ * is set, from it otherwise. The message must be in the other format, as
+ * it carries no marker. The root header stays big endian either way.
+ * Integer payloads are swapped according to the type in info, attributes
+ * with type BLOB_ATTR_NESTED are converted recursively with the same info.
+ * Returns -1 on a malformed message, which may then be partially converted.
+ */
+extern int blob_convert(struct blob_attr *root, const struct blob_attr_info *info,
+			int max, bool native);
 extern void blob_buf_free(struct blob_buf *buf);
 extern bool blob_buf_grow(struct blob_buf *buf, int required);
+/*
+ * blob_new/blob_nest_end switch a container to the long header once it
+ * outgrows 24 bits, moving its contents up by 4 bytes. Pointers into the
+ * container taken before (e.g. returned by blob_new() or blob_put()) are
+ * stale afterwards, the same as after the buffer was reallocated. Cookies
+ * from blob_nest_start() stay valid.
+ */
 extern struct blob_attr *blob_new(struct blob_buf *buf, int id, int payload);
 extern void *blob_nest_start(struct blob_buf *buf, int id);
 extern void blob_nest_end(struct blob_buf *buf, void *cookie);
 extern struct blob_attr *blob_put(struct blob_buf *buf, int id, const void *ptr, unsigned int len);
 extern bool blob_check_type(const void *ptr, unsigned int len, int type);
+/*
+ * blob_parse: sort the children of attr into data by id
+ *
+ * attr is the root or any attribute of a big endian message. For native
+ * messages, use blob_parse_root_native() on the root (which has a big
+ * endian header) and blob_parse_native() on the attributes below it.
+ */
 extern int blob_parse(struct blob_attr *attr, struct blob_attr **data, const struct blob_attr_info *info, int max);
+extern int blob_parse_root_native(struct blob_attr *root, struct blob_attr **data, const struct blob_attr_info *info, int max);
+extern int blob_parse_native(struct blob_attr *attr, struct blob_attr **data, const struct blob_attr_info *info, int max);
 extern struct blob_attr *blob_memdup(struct blob_attr *attr);
+
+/*
+ * blob_arena: bump allocator for long lived attribute copies
+ *
+ * blob_memdup_arena() copies are packed into large chunks instead of
+ * getting a malloc block each; they are only released all at once by
+ * blob_arena_free().
+ */
+struct blob_arena_chunk;
+
+struct blob_arena {
+	struct blob_arena_chunk *chunks;
+	size_t chunk_size;
+	char *cur;
+	size_t avail;
+};
+
+extern void blob_arena_init(struct blob_arena *a, size_t chunk_size);
+extern void *blob_arena_alloc(struct blob_arena *a, size_t size);
+extern void blob_arena_free(struct blob_arena *a);
+extern struct blob_attr *blob_memdup_arena(struct blob_arena *a,
+					   const struct blob_attr *attr);
+
+/*
+ * blob_intern: share one immutable copy of identical attributes
+ *
+ * blob_intern_get() returns the stored copy of an attribute with the same
+ * content, or stores a new one, and takes a reference. blob_intern_put()
+ * drops it again; the last reference removes the copy from the table.
+ * Copies come from arena if one is given (released with the arena),
+ * otherwise from malloc. The returned attribute must not be modified.
+ */
+struct blob_intern_entry;
+
+struct blob_intern {
+	struct blob_arena *arena;
+	struct blob_intern_entry **buckets;
+	unsigned int mask;
+	unsigned int count;
+};
+
+extern void blob_intern_init(struct blob_intern *tbl, struct blob_arena *arena);
+extern const struct blob_attr *blob_intern_get(struct blob_intern *tbl,
+					       const struct blob_attr *attr);
+extern void blob_intern_put(struct blob_intern *tbl, const struct blob_attr *attr);
+extern void blob_intern_free(struct blob_intern *tbl);
 extern struct blob_attr *blob_put_raw(struct blob_buf *buf, const void *ptr, unsigned int len);
 
 static inline struct blob_attr *
@@ -216,21 +438,24 @@ blob_put_u8(struct blob_buf *buf, int id, uint8_t val)
 static inline struct blob_attr *
 blob_put_u16(struct blob_buf *buf, int id, uint16_t val)
 {
-	val = cpu_to_be16(val);
+	if (!buf->native)
+		val = cpu_to_be16(val);
 	return blob_put(buf, id, &val, sizeof(val));
 }
 
 static inline struct blob_attr *
 blob_put_u32(struct blob_buf *buf, int id, uint32_t val)
 {
-	val = cpu_to_be32(val);
+	if (!buf->native)
+		val = cpu_to_be32(val);
 	return blob_put(buf, id, &val, sizeof(val));
 }
 
 static inline struct blob_attr *
 blob_put_u64(struct blob_buf *buf, int id, uint64_t val)
 {
-	val = cpu_to_be64(val);
+	if (!buf->native)
+		val = cpu_to_be64(val);
 	return blob_put(buf, id, &val, sizeof(val));
 }
 
@@ -241,16 +466,43 @@ blob_put_u64(struct blob_buf *buf, int id, uint64_t val)
 
 #define __blob_for_each_attr(pos, attr, rem) \
 	for (pos = (void *) attr; \
-	     rem > 0 && (blob_pad_len(pos) <= rem) && \
-	     (blob_pad_len(pos) >= sizeof(struct blob_attr)); \
+	     rem > 0 && rem >= blob_hdr_len(pos) && (blob_raw_len(pos) <= rem) && \
+	     (blob_pad_len(pos) <= rem) && \
+	     (blob_raw_len(pos) >= blob_hdr_len(pos)); \
 	     rem -= blob_pad_len(pos), pos = blob_next(pos))
 
 
+#define __blob_for_each_attr_native(pos, attr, rem) \
+	for (pos = (void *) attr; \
+	     rem >= (int) sizeof(struct blob_attr) && \
+	     (blob_native_pad_len(pos) <= rem) && \
+	     (blob_native_raw_len(pos) >= sizeof(struct blob_attr)); \
+	     rem -= blob_native_pad_len(pos), pos = blob_native_next(pos))
+
+/* iterate the children of a native root */
+#define blob_for_each_root_attr_native(pos, root, rem) \
+	for (rem = root ? blob_len(root) : 0, \
+	     pos = root ? blob_data(root) : 0; \
+	     rem >= (int) sizeof(struct blob_attr) && \
+	     (blob_native_pad_len(pos) <= rem) && \
+	     (blob_native_raw_len(pos) >= sizeof(struct blob_attr)); \
+	     rem -= blob_native_pad_len(pos), pos = blob_native_next(pos))
+
+/* iterate the children of a nested attribute below a native root */
+#define blob_for_each_attr_native(pos, attr, rem) \
+	for (rem = attr ? blob_native_len(attr) : 0, \
+	     pos = attr ? (void *) attr->data : 0; \
+	     rem >= (int) sizeof(struct blob_attr) && \
+	     (blob_native_pad_len(pos) <= rem) && \
+	     (blob_native_raw_len(pos) >= sizeof(struct blob_attr)); \
+	     rem -= blob_native_pad_len(pos), pos = blob_native_next(pos))
+
 #define blob_for_each_attr(pos, attr, rem) \
 	for (rem = attr ? blob_len(attr) : 0, \
 	     pos = attr ? blob_data(attr) : 0; \
-	     rem > 0 && (blob_pad_len(pos) <= rem) && \
-	     (blob_pad_len(pos) >= sizeof(struct blob_attr)); \
+	     rem > 0 && rem >= blob_hdr_len(pos) && (blob_raw_len(pos) <= rem) && \
+	     (blob_pad_len(pos) <= rem) && \
+	     (blob_raw_len(pos) >= blob_hdr_len(pos)); \
 	     rem -= blob_pad_len(pos), pos = blob_next(pos))
 
 
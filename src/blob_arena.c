@@ -0,0 +1,209 @@
+/*
+ * blob_arena - arena allocation and interning for blob attributes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "blob.h"
+#include "list.h"
+
+#define BLOB_ARENA_ALIGN	8
+#define BLOB_ARENA_DEFAULT	(16 * 1024)
+
+struct blob_arena_chunk {
+	struct blob_arena_chunk *next;
+	uint64_t data[];
+};
+
+struct blob_intern_entry {
+	struct blob_intern_entry *next;
+	uint64_t hash;
+	unsigned int refcount;
+	struct blob_attr attr;
+};
+
+void blob_arena_init(struct blob_arena *a, size_t chunk_size)
+{
+	memset(a, 0, sizeof(*a));
+	a->chunk_size = chunk_size ? chunk_size : BLOB_ARENA_DEFAULT;
+}
+
+static void *
+blob_arena_new_chunk(struct blob_arena *a, size_t size)
+{
+	struct blob_arena_chunk *c;
+
+	c = malloc(sizeof(*c) + size);
+	if (!c)
+		return NULL;
+
+	c->next = a->chunks;
+	a->chunks = c;
+	return c->data;
+}
+
+void *blob_arena_alloc(struct blob_arena *a, size_t size)
+{
+	void *ptr;
+
+	size = (size + BLOB_ARENA_ALIGN - 1) & ~(BLOB_ARENA_ALIGN - 1);
+	if (size <= a->avail) {
+		ptr = a->cur;
+		a->cur += size;
+		a->avail -= size;
+		return ptr;
+	}
+
+	/* big copies get their own chunk, the current one stays in use */
+	if (size > a->chunk_size / 4)
+		return blob_arena_new_chunk(a, size);
+
+	ptr = blob_arena_new_chunk(a, a->chunk_size);
+	if (!ptr)
+		return NULL;
+
+	a->cur = (char *) ptr + size;
+	a->avail = a->chunk_size - size;
+	return ptr;
+}
+
+void blob_arena_free(struct blob_arena *a)
+{
+	struct blob_arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+
+	blob_arena_init(a, a->chunk_size);
+}
+
+struct blob_attr *
+blob_memdup_arena(struct blob_arena *a, const struct blob_attr *attr)
+{
+	struct blob_attr *ret;
+	int size = blob_pad_len(attr);
+
+	ret = blob_arena_alloc(a, size);
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, attr, size);
+	return ret;
+}
+
+void blob_intern_init(struct blob_intern *tbl, struct blob_arena *arena)
+{
+	memset(tbl, 0, sizeof(*tbl));
+	tbl->arena = arena;
+}
+
+static bool
+blob_intern_resize(struct blob_intern *tbl)
+{
+	struct blob_intern_entry **buckets, *e, *next;
+	unsigned int size = tbl->buckets ? 2 * (tbl->mask + 1) : 64;
+	unsigned int i;
+
+	buckets = calloc(size, sizeof(*buckets));
+	if (!buckets)
+		return false;
+
+	for (i = 0; tbl->buckets && i <= tbl->mask; i++) {
+		for (e = tbl->buckets[i]; e; e = next) {
+			next = e->next;
+			e->next = buckets[e->hash & (size - 1)];
+			buckets[e->hash & (size - 1)] = e;
+		}
+	}
+
+	free(tbl->buckets);
+	tbl->buckets = buckets;
+	tbl->mask = size - 1;
+	return true;
+}
+
+const struct blob_attr *
+blob_intern_get(struct blob_intern *tbl, const struct blob_attr *attr)
+{
+	struct blob_intern_entry *e;
+	uint64_t hash = blob_hash(attr);
+	size_t size;
+
+	if (tbl->buckets) {
+		for (e = tbl->buckets[hash & tbl->mask]; e; e = e->next) {
+			if (e->hash == hash && blob_attr_equal(&e->attr, attr)) {
+				e->refcount++;
+				return &e->attr;
+			}
+		}
+	}
+
+	if ((!tbl->buckets || tbl->count > tbl->mask) && !blob_intern_resize(tbl))
+		return NULL;
+
+	size = sizeof(*e) + blob_pad_len(attr) - sizeof(struct blob_attr);
+	if (tbl->arena)
+		e = blob_arena_alloc(tbl->arena, size);
+	else
+		e = malloc(size);
+	if (!e)
+		return NULL;
+
+	memcpy(&e->attr, attr, blob_pad_len(attr));
+	e->hash = hash;
+	e->refcount = 1;
+	e->next = tbl->buckets[hash & tbl->mask];
+	tbl->buckets[hash & tbl->mask] = e;
+	tbl->count++;
+
+	return &e->attr;
+}
+
+void blob_intern_put(struct blob_intern *tbl, const struct blob_attr *attr)
+{
+	struct blob_intern_entry *e, **pos;
+
+	e = container_of(attr, struct blob_intern_entry, attr);
+	if (--e->refcount)
+		return;
+
+	for (pos = &tbl->buckets[e->hash & tbl->mask]; *pos; pos = &(*pos)->next) {
+		if (*pos != e)
+			continue;
+
+		*pos = e->next;
+		break;
+	}
+
+	tbl->count--;
+	if (!tbl->arena)
+		free(e);
+}
+
+void blob_intern_free(struct blob_intern *tbl)
+{
+	struct blob_intern_entry *e, *next;
+	unsigned int i;
+
+	for (i = 0; !tbl->arena && tbl->buckets && i <= tbl->mask; i++) {
+		for (e = tbl->buckets[i]; e; e = next) {
+			next = e->next;
+			free(e);
+		}
+	}
+
+	free(tbl->buckets);
+	blob_intern_init(tbl, tbl->arena);
+}
@@ -0,0 +1,524 @@
+/*
+ * blob_stream - stream blob messages through a ustream
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "blob_stream.h"
+#include "blobmsg.h"
+
+struct blob_stream_frame {
+	/* open containers, the root first */
+	struct blob_attr *path[BLOB_STREAM_MAX_DEPTH];
+	int n;
+
+	/* leading path entries that were already open at the last flush */
+	int shared;
+
+	/* children that were not written out before */
+	bool content;
+};
+
+int blob_stream_init(struct blob_stream *bs, struct ustream *s, int id)
+{
+	bs->s = s;
+	bs->id = id;
+	bs->bytes = 0;
+	bs->sent[0] = 0;
+	bs->depth = 1;
+
+	return blob_buf_init(&bs->buf, id);
+}
+
+/* start of the children of a container, after its header and name */
+static char *
+blob_stream_children(struct blob_attr *attr)
+{
+	struct blobmsg_hdr *hdr = blob_data(attr);
+
+	if (!blob_is_extended(attr))
+		return (char *) hdr;
+
+	return (char *) hdr + blobmsg_hdrlen(be16_to_cpu(hdr->namelen));
+}
+
+static int
+blob_stream_path(struct blob_stream *bs, struct blob_stream_frame *f)
+{
+	struct blob_attr *attr = bs->buf.buf;
+	int i;
+
+	/*
+	 * a parent only accounts for the short header of its open child,
+	 * which therefore sits in its last 4 bytes
+	 */
+	f->n = 0;
+	while (1) {
+		if (f->n == BLOB_STREAM_MAX_DEPTH)
+			return -1;
+
+		f->path[f->n++] = attr;
+		if (attr == bs->buf.head)
+			break;
+
+		attr = (struct blob_attr *) ((char *) attr + blob_pad_len(attr) -
+					     sizeof(struct blob_attr));
+	}
+
+	/* containers left open last time start where their parent stopped */
+	for (i = 1; i < f->n && i < bs->depth; i++)
+		if ((char *) f->path[i] != blob_stream_children(f->path[i - 1]) +
+					   bs->sent[i - 1])
+			break;
+
+	f->shared = i;
+	f->content = false;
+	return 0;
+}
+
+static int
+blob_stream_write(struct blob_stream *bs, const void *data, int len, bool more)
+{
+	if (len && ustream_write(bs->s, data, len, more) < len)
+		return -1;
+
+	bs->bytes += len;
+	return 0;
+}
+
+/*
+ * frame data for the container attr at level k: its header, the children
+ * that were not written out yet and, if it is open, its open child last.
+ * cont marks a container that was open at the last flush, its first child
+ * is then the one that was open below it, if that has been closed since.
+ * With write unset, only returns the length.
+ */
+static int
+blob_stream_emit(struct blob_stream *bs, struct blob_stream_frame *f, int k,
+		 struct blob_attr *attr, bool cont, bool write)
+{
+	char *start = blob_stream_children(attr);
+	char *end = (char *) attr + blob_pad_len(attr);
+	struct blob_attr *first = NULL, *open = NULL;
+	int name_len = start - (char *) blob_data(attr);
+	int first_len = 0, open_len = 0;
+	int hdr_len = sizeof(struct blob_attr);
+	uint32_t hdr[2];
+	char *raw;
+	int len;
+
+	if (cont) {
+		start += bs->sent[k];
+		if (k + 1 < bs->depth && k + 1 >= f->shared) {
+			first = (struct blob_attr *) start;
+			first_len = blob_stream_emit(bs, f, k + 1, first, true, false);
+		}
+	}
+
+	if (k + 1 < f->n && attr == f->path[k]) {
+		open = f->path[k + 1];
+		open_len = blob_stream_emit(bs, f, k + 1, open, k + 1 < f->shared, false);
+		end = (char *) open;
+	}
+
+	raw = first ? start + blob_pad_len(first) : start;
+	if (end > raw)
+		f->content = true;
+
+	len = name_len + first_len + (end - raw) + open_len;
+	if (len + hdr_len > BLOB_ATTR_LEN_MASK)
+		hdr_len += sizeof(uint32_t);
+	len += hdr_len;
+
+	if (!write)
+		return len;
+
+	hdr[0] = attr->id_len & cpu_to_be32(BLOB_ATTR_ID_MASK | BLOB_ATTR_EXTENDED);
+	if (hdr_len > (int) sizeof(struct blob_attr)) {
+		hdr[0] |= cpu_to_be32(BLOB_ATTR_LEN_LONG);
+		hdr[1] = cpu_to_be32(len);
+	} else {
+		hdr[0] |= cpu_to_be32(len);
+	}
+
+	if (blob_stream_write(bs, hdr, hdr_len, true) ||
+	    blob_stream_write(bs, blob_data(attr), name_len, true))
+		return -1;
+
+	if (first && blob_stream_emit(bs, f, k + 1, first, true, true) < 0)
+		return -1;
+
+	if (blob_stream_write(bs, raw, end - raw, false))
+		return -1;
+
+	if (open && blob_stream_emit(bs, f, k + 1, open, k + 1 < f->shared, true) < 0)
+		return -1;
+
+	return len;
+}
+
+/*
+ * drop what was written out: the children of the innermost container and,
+ * by moving that container down, those of its parent. Nothing else can
+ * move, the cookies of the callers point at the containers further out.
+ */
+static void
+blob_stream_trim(struct blob_stream *bs, struct blob_stream_frame *f)
+{
+	struct blob_buf *buf = &bs->buf;
+	struct blob_attr *attr = f->path[f->n - 1];
+	struct blob_attr *parent;
+	char *pos;
+	int i, len;
+
+	buf->gen++;
+	len = blob_stream_children(attr) - (char *) attr;
+	blob_set_raw_len(attr, len);
+
+	for (i = 0; i < f->n - 2; i++)
+		bs->sent[i] = (char *) f->path[i + 1] - blob_stream_children(f->path[i]);
+
+	if (f->n > 1) {
+		parent = f->path[f->n - 2];
+		pos = blob_stream_children(parent);
+		if (f->n - 2 < f->shared)
+			pos += bs->sent[f->n - 2];
+
+		bs->sent[f->n - 2] = pos - blob_stream_children(parent);
+		if (pos < (char *) attr) {
+			blob_set_raw_len(parent, blob_raw_len(parent) - ((char *) attr - pos));
+			memmove(pos, attr, len);
+			buf->head = (struct blob_attr *) pos;
+		}
+	}
+
+	bs->sent[f->n - 1] = 0;
+	bs->depth = f->n;
+}
+
+/*
+ * blob_stream_flush: write out everything added since the last flush
+ *
+ * can be called with containers open, see blob_stream.h for how those are
+ * framed. Returns the number of bytes written or -1 if the stream failed
+ * or the containers are nested too deeply.
+ */
+int blob_stream_flush(struct blob_stream *bs)
+{
+	struct blob_stream_frame f;
+	size_t bytes = bs->bytes;
+	uint32_t depth;
+	int len;
+
+	if (bs->buf.native || blob_stream_path(bs, &f))
+		return -1;
+
+	len = blob_stream_emit(bs, &f, 0, f.path[0], true, false);
+
+	/* send an empty frame as well if containers were closed since */
+	if (!f.content && f.shared == bs->depth)
+		return 0;
+
+	depth = cpu_to_be32(f.n - 1);
+	if (blob_stream_write(bs, &depth, sizeof(depth), true) ||
+	    blob_stream_emit(bs, &f, 0, f.path[0], true, true) != len)
+		return -1;
+
+	blob_stream_trim(bs, &f);
+
+	return bs->bytes - bytes;
+}
+
+int blob_stream_finish(struct blob_stream *bs)
+{
+	if (bs->buf.head != bs->buf.buf)
+		return -1;
+
+	return blob_stream_flush(bs) < 0 ? -1 : 0;
+}
+
+void blob_stream_free(struct blob_stream *bs)
+{
+	blob_buf_free(&bs->buf);
+}
+
+void blob_stream_reader_init(struct blob_stream_reader *r, int level,
+			     blob_stream_entry_cb cb)
+{
+	memset(r, 0, sizeof(*r));
+	r->cb = cb;
+	r->level = level;
+	r->max_len = BLOB_STREAM_READ_MAX;
+}
+
+void blob_stream_reader_free(struct blob_stream_reader *r)
+{
+	free(r->frame);
+	free(r->entry);
+	r->frame = NULL;
+	r->entry = NULL;
+	r->frame_size = r->entry_size = 0;
+	r->have = r->entry_len = 0;
+	r->open = 0;
+}
+
+static bool
+blob_stream_grow(char **buf, unsigned int *size, unsigned int len)
+{
+	char *new;
+
+	if (len <= *size)
+		return true;
+
+	if (len < *size * 2)
+		len = *size * 2;
+
+	new = realloc(*buf, len);
+	if (!new)
+		return false;
+
+	*buf = new;
+	*size = len;
+	return true;
+}
+
+/* the children of a container in a frame, -1 if the header does not fit */
+static int
+blob_stream_read_children(struct blob_attr *attr, char **start, int *rem)
+{
+	struct blobmsg_hdr *hdr = blob_data(attr);
+	unsigned int len = blob_len(attr);
+
+	if (blob_is_extended(attr) &&
+	    (len < sizeof(*hdr) ||
+	     blobmsg_hdrlen(be16_to_cpu(hdr->namelen)) > len))
+		return -1;
+
+	*start = blob_stream_children(attr);
+	*rem = (char *) attr + blob_pad_len(attr) - *start;
+	return 0;
+}
+
+static bool
+blob_stream_is_nested(struct blob_attr *attr)
+{
+	if (!blob_is_extended(attr))
+		return false;
+
+	return blob_id(attr) == BLOBMSG_TYPE_TABLE ||
+	       blob_id(attr) == BLOBMSG_TYPE_ARRAY;
+}
+
+static int
+blob_stream_put(struct blob_stream_reader *r, const void *data, unsigned int len)
+{
+	if (len > r->max_len - r->entry_len ||
+	    !blob_stream_grow(&r->entry, &r->entry_size, r->entry_len + len))
+		return -1;
+
+	memcpy(r->entry + r->entry_len, data, len);
+	r->entry_len += len;
+	return 0;
+}
+
+/*
+ * containers of an entry are kept with a long header while they are open,
+ * they only get their final length once closed
+ */
+static void
+blob_stream_close(struct blob_stream_reader *r, int j)
+{
+	struct blob_attr *attr = (struct blob_attr *) (r->entry + r->entry_open[j]);
+	unsigned int len = r->entry_len - r->entry_open[j];
+
+	if (len - sizeof(uint32_t) > BLOB_ATTR_LEN_MASK) {
+		*(uint32_t *) attr->data = cpu_to_be32(len);
+		return;
+	}
+
+	len -= sizeof(uint32_t);
+	memmove(attr->data, attr->data + sizeof(uint32_t), len - sizeof(*attr));
+	attr->id_len &= ~cpu_to_be32(BLOB_ATTR_LEN_MASK);
+	attr->id_len |= cpu_to_be32(len);
+	r->entry_len -= sizeof(uint32_t);
+}
+
+/*
+ * add the part of an entry in the frame at nesting level k, j levels below
+ * the entry itself. cont marks a container that was open at the end of the
+ * last frame, open one that still is at the end of this one.
+ */
+static int
+blob_stream_merge(struct blob_stream_reader *r, struct blob_attr *attr, int j,
+		  int k, bool cont, bool open, unsigned int depth)
+{
+	struct blob_attr *cur;
+	uint32_t hdr[2];
+	char *start;
+	int rem;
+
+	if (!cont && !open)
+		return blob_stream_put(r, attr, blob_pad_len(attr));
+
+	if (k + 1 >= BLOB_STREAM_MAX_DEPTH ||
+	    blob_stream_read_children(attr, &start, &rem))
+		return -1;
+
+	if (!cont) {
+		r->entry_open[j] = r->entry_len;
+		hdr[0] = attr->id_len & cpu_to_be32(BLOB_ATTR_ID_MASK | BLOB_ATTR_EXTENDED);
+		hdr[0] |= cpu_to_be32(BLOB_ATTR_LEN_LONG);
+		hdr[1] = 0;
+		if (blob_stream_put(r, hdr, sizeof(hdr)) ||
+		    blob_stream_put(r, blob_data(attr), start - (char *) blob_data(attr)))
+			return -1;
+	}
+
+	__blob_for_each_attr(cur, start, rem) {
+		bool first = (char *) cur == start;
+		bool last = rem == (int) blob_pad_len(cur);
+
+		if (blob_stream_merge(r, cur, j + 1, k + 1,
+				      cont && first && (unsigned int) k < r->open,
+				      open && last && (unsigned int) k < depth, depth))
+			return -1;
+	}
+
+	if (rem)
+		return -1;
+
+	if (!open)
+		blob_stream_close(r, j);
+
+	return 0;
+}
+
+static int
+blob_stream_entry(struct blob_stream_reader *r, struct blob_attr *attr, int k,
+		  bool cont, bool open, unsigned int depth)
+{
+	r->depth = k;
+	if (!cont && !open) {
+		r->cb(r, attr);
+		return 0;
+	}
+
+	/* only a continued entry may be pending */
+	if (cont != !!r->entry_len)
+		return -1;
+
+	if (blob_stream_merge(r, attr, 0, k, cont, open, depth))
+		return -1;
+
+	if (open)
+		return 0;
+
+	r->depth = k;
+	r->cb(r, (struct blob_attr *) r->entry);
+	r->entry_len = 0;
+	return 0;
+}
+
+/* hand out the entries of a table or array (or the root) at level k */
+static int
+blob_stream_walk(struct blob_stream_reader *r, struct blob_attr *attr, int k,
+		 bool cont, bool open, unsigned int depth)
+{
+	struct blob_attr *cur;
+	char *start;
+	int rem, ret;
+
+	if (k + 1 >= BLOB_STREAM_MAX_DEPTH ||
+	    blob_stream_read_children(attr, &start, &rem))
+		return -1;
+
+	r->path[k] = attr;
+	__blob_for_each_attr(cur, start, rem) {
+		bool first = (char *) cur == start;
+		bool last = rem == (int) blob_pad_len(cur);
+		bool c_cont = cont && first && (unsigned int) k < r->open;
+		bool c_open = open && last && (unsigned int) k < depth;
+
+		if (k + 1 < r->level && blob_stream_is_nested(cur))
+			ret = blob_stream_walk(r, cur, k + 1, c_cont, c_open, depth);
+		else
+			ret = blob_stream_entry(r, cur, k + 1, c_cont, c_open, depth);
+
+		if (ret)
+			return -1;
+	}
+
+	return rem ? -1 : 0;
+}
+
+/* size of the frame read so far: its header first, then all of it */
+static int
+blob_stream_frame_len(struct blob_stream_reader *r)
+{
+	struct blob_attr *root = (struct blob_attr *) (r->frame + sizeof(uint32_t));
+	unsigned int hdr = sizeof(uint32_t) + sizeof(struct blob_attr);
+
+	if (r->have < hdr)
+		return hdr;
+
+	if (blob_is_long(root)) {
+		hdr += sizeof(uint32_t);
+		if (r->have < hdr)
+			return hdr;
+	}
+
+	if (blob_raw_len(root) < blob_hdr_len(root) ||
+	    blob_raw_len(root) > r->max_len)
+		return -1;
+
+	return sizeof(uint32_t) + blob_pad_len(root);
+}
+
+/*
+ * blob_stream_read: read frames from s and hand out the entries in them
+ *
+ * reads as much as s has buffered, a partial frame is kept for the next
+ * call. Returns 0, or -1 if the stream is malformed or out of memory, the
+ * reader has to be reset with blob_stream_reader_free() then.
+ */
+int blob_stream_read(struct blob_stream_reader *r, struct ustream *s)
+{
+	struct blob_attr *root;
+	uint32_t depth;
+	int len;
+
+	while (1) {
+		len = blob_stream_frame_len(r);
+		if (len < 0 ||
+		    !blob_stream_grow(&r->frame, &r->frame_size, len))
+			return -1;
+
+		if (r->have < (unsigned int) len) {
+			r->have += ustream_read(s, r->frame + r->have, len - r->have);
+			if (r->have < (unsigned int) len)
+				return 0;
+			continue;
+		}
+
+		depth = be32_to_cpu(*(uint32_t *) r->frame);
+		if (depth >= BLOB_STREAM_MAX_DEPTH)
+			return -1;
+
+		r->have = 0;
+		root = (struct blob_attr *) (r->frame + sizeof(uint32_t));
+		if (blob_stream_walk(r, root, 0, true, true, depth))
+			return -1;
+
+		r->open = depth;
+	}
+}
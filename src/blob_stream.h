@@ -0,0 +1,113 @@
+/*
+ * blob_stream - stream blob messages through a ustream
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __BLOB_STREAM_H__
+#define __BLOB_STREAM_H__
+
+#include "libubox/blob.h"
+#include "libubox/ustream.h"
+
+#define BLOB_STREAM_MAX_DEPTH	32
+
+/*
+ * blob_stream: build attributes in buf with the usual blob/blobmsg calls
+ * and hand what was added so far to the stream with blob_stream_flush(),
+ * which also works with containers open. Written children are dropped
+ * from the innermost open container and its parent, so a large table or
+ * array is never held in memory as a whole. Anything written further out
+ * stays in buf until the containers below it are closed, since the cookies
+ * of the callers must keep pointing at them.
+ *
+ * Every flush writes one frame: a 32 bit big endian word with the number
+ * of containers that were open, followed by a complete root attribute
+ * with the stream id that blob_parse()/blobmsg_parse() accept as it is.
+ * Containers that were open are included with the children added so far
+ * (and their lengths patched in the frame only), so they form the chain
+ * of last attributes below the root. In the next frame the same containers
+ * continue as the chain of first attributes, with the same id and name,
+ * followed by the children added after that. A word of 0 marks a frame
+ * that ends at the top level.
+ */
+struct blob_stream {
+	struct blob_buf buf;
+	struct ustream *s;
+	int id;
+
+	/*
+	 * containers open at the last flush, the root first: how many bytes
+	 * of their children were written out already
+	 */
+	unsigned int sent[BLOB_STREAM_MAX_DEPTH];
+	int depth;
+
+	/* bytes handed to the stream so far */
+	size_t bytes;
+};
+
+/* frames and reassembled entries larger than this are rejected by default */
+#define BLOB_STREAM_READ_MAX	(16 * 1024 * 1024)
+
+struct blob_stream_reader;
+
+typedef void (*blob_stream_entry_cb)(struct blob_stream_reader *r,
+				     struct blob_attr *attr);
+
+/*
+ * blob_stream_reader: parse the frames of a blob_stream and call cb for
+ * every complete entry. Entries are the attributes at nesting level
+ * 'level' below the root, and those further out that are not blobmsg
+ * tables or arrays. The blobmsg tables and arrays further out are
+ * followed across frames instead of being kept as a whole, so with a
+ * level of 2 the entries of a large array are handed out one by one.
+ * An entry that was split across frames is reassembled first.
+ *
+ * While cb runs, path[0..depth - 1] are the containers around the entry,
+ * the root first. They point into the current frame and only hold the
+ * part of their children that is in it.
+ */
+struct blob_stream_reader {
+	blob_stream_entry_cb cb;
+	int level;
+	unsigned int max_len;
+
+	struct blob_attr *path[BLOB_STREAM_MAX_DEPTH];
+	int depth;
+
+	/* current frame */
+	char *frame;
+	unsigned int frame_size;
+	unsigned int have;
+
+	/* number of containers open at the end of the last frame */
+	unsigned int open;
+
+	/* entry being reassembled and the offsets of its open containers */
+	char *entry;
+	unsigned int entry_size;
+	unsigned int entry_len;
+	unsigned int entry_open[BLOB_STREAM_MAX_DEPTH];
+};
+
+int blob_stream_init(struct blob_stream *bs, struct ustream *s, int id);
+int blob_stream_flush(struct blob_stream *bs);
+int blob_stream_finish(struct blob_stream *bs);
+void blob_stream_free(struct blob_stream *bs);
+
+void blob_stream_reader_init(struct blob_stream_reader *r, int level,
+			     blob_stream_entry_cb cb);
+int blob_stream_read(struct blob_stream_reader *r, struct ustream *s);
+void blob_stream_reader_free(struct blob_stream_reader *r);
+
+#endif
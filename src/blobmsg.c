@@ -44,7 +44,7 @@ bool blobmsg_check_attr(const struct blob_attr *attr, bool name)
 	if (blob_len(attr) < sizeof(struct blobmsg_hdr))
 		return false;
 
-	hdr = (void *) attr->data;
+	hdr = blob_data(attr);
 	if (!hdr->namelen && name)
 		return false;
 
@@ -103,6 +103,74 @@ bool blobmsg_check_attr_list(const struct blob_attr *attr, int type)
 	return blobmsg_check_array(attr, type) >= 0;
 }
 
+static bool
+blobmsg_validate_attr(const struct blob_attr *attr, bool name)
+{
+	const struct blobmsg_hdr *hdr = blob_data(attr);
+
+	if (!blob_is_extended(attr) || !blobmsg_check_attr(attr, name))
+		return false;
+
+	/* blobmsg_check_attr() alone lets the padded header overrun the payload */
+	return blobmsg_hdrlen(blobmsg_namelen(hdr)) <= blob_len(attr);
+}
+
+/* the header of attr has to fit in rem and claim no more than rem */
+static bool
+blobmsg_validate_len(const struct blob_attr *attr, unsigned int rem)
+{
+	if (rem < sizeof(*attr) || rem < blob_hdr_len(attr))
+		return false;
+
+	return blob_raw_len(attr) >= blob_hdr_len(attr) &&
+	       blob_raw_len(attr) <= rem && blob_pad_len(attr) <= rem;
+}
+
+static bool
+blobmsg_validate_list(const struct blob_attr *attr, bool name, int depth)
+{
+	const struct blob_attr *cur = blobmsg_data(attr);
+	unsigned int rem = blobmsg_data_len(attr);
+
+	for (; rem; rem -= blob_pad_len(cur), cur = blob_next(cur)) {
+		if (!blobmsg_validate_len(cur, rem) ||
+		    !blobmsg_validate_attr(cur, name))
+			return false;
+
+		switch (blob_id(cur)) {
+		case BLOBMSG_TYPE_TABLE:
+		case BLOBMSG_TYPE_ARRAY:
+			if (depth <= 0)
+				return false;
+
+			if (!blobmsg_validate_list(cur, blob_id(cur) == BLOBMSG_TYPE_TABLE,
+						   depth - 1))
+				return false;
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool blobmsg_validate_tree(const struct blob_attr *attr, int max_depth)
+{
+	if (!attr || blob_raw_len(attr) < blob_hdr_len(attr))
+		return false;
+
+	if (blob_is_extended(attr) && !blobmsg_validate_attr(attr, false))
+		return false;
+
+	switch (blob_id(attr)) {
+	case BLOBMSG_TYPE_TABLE:
+		return blobmsg_validate_list(attr, true, max_depth);
+	case BLOBMSG_TYPE_ARRAY:
+		return blobmsg_validate_list(attr, false, max_depth);
+	default:
+		return false;
+	}
+}
+
 int blobmsg_parse_array(const struct blobmsg_policy *policy, int policy_len,
 			struct blob_attr **tb, void *data, unsigned int len)
 {
@@ -130,8 +198,9 @@ int blobmsg_parse_array(const struct blobmsg_policy *policy, int policy_len,
 }
 
 
-int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
-                  struct blob_attr **tb, void *data, unsigned int len)
+static int
+__blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
+		struct blob_attr **tb, void *data, unsigned int len, bool check)
 {
 	struct blobmsg_hdr *hdr;
 	struct blob_attr *attr;
@@ -148,6 +217,9 @@ int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
 	}
 
 	__blob_for_each_attr(attr, data, len) {
+		if (check && blob_len(attr) < sizeof(struct blobmsg_hdr))
+			return -1;
+
 		hdr = blob_data(attr);
 		for (i = 0; i < policy_len; i++) {
 			if (!policy[i].name)
@@ -160,7 +232,7 @@ int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
 			if (blobmsg_namelen(hdr) != pslen[i])
 				continue;
 
-			if (!blobmsg_check_attr(attr, true))
+			if (check && !blobmsg_check_attr(attr, true))
 				return -1;
 
 			if (tb[i])
@@ -176,6 +248,252 @@ int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
 	return 0;
 }
 
+int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
+                  struct blob_attr **tb, void *data, unsigned int len)
+{
+	return __blobmsg_parse(policy, policy_len, tb, data, len, true);
+}
+
+int blobmsg_parse_unchecked(const struct blobmsg_policy *policy, int policy_len,
+			    struct blob_attr **tb, void *data, unsigned int len)
+{
+	return __blobmsg_parse(policy, policy_len, tb, data, len, false);
+}
+
+static inline uint32_t
+blobmsg_type_bit(int type)
+{
+	return 1U << (type < 31 ? type : 31);
+}
+
+/* FNV-1a */
+static uint32_t
+blobmsg_name_hash(const char *name, int len)
+{
+	uint32_t hash = 2166136261u;
+
+	while (len-- > 0) {
+		hash ^= (uint8_t) *name++;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+struct blobmsg_policy_compiled *
+blobmsg_policy_compile(const struct blobmsg_policy *policy, int policy_len)
+{
+	struct blobmsg_policy_compiled *cp;
+	struct blobmsg_policy_slot *slot;
+	unsigned int size = 4;
+	uint32_t hash;
+	int i, len;
+
+	if (policy_len < 0 || policy_len >= UINT16_MAX)
+		return NULL;
+
+	/* keep the load factor below 1/2 so that probe sequences stay short */
+	while (size < 2 * policy_len)
+		size <<= 1;
+
+	cp = calloc(1, sizeof(*cp) + size * sizeof(cp->slots[0]));
+	if (!cp)
+		return NULL;
+
+	cp->policy = policy;
+	cp->policy_len = policy_len;
+	cp->mask = size - 1;
+
+	for (i = 0; i < policy_len; i++) {
+		if (!policy[i].name)
+			continue;
+
+		len = strlen(policy[i].name);
+		if (len > UINT16_MAX)
+			continue;
+
+		if (len < ARRAY_SIZE(cp->check))
+			cp->check[len] |= policy[i].type == BLOBMSG_TYPE_UNSPEC ?
+					  ~0U : blobmsg_type_bit(policy[i].type);
+
+		hash = blobmsg_name_hash(policy[i].name, len);
+		slot = &cp->slots[hash & cp->mask];
+		while (slot->index)
+			slot = &cp->slots[(slot - cp->slots + 1) & cp->mask];
+
+		slot->hash = hash;
+		slot->namelen = len;
+		slot->index = i + 1;
+	}
+
+	return cp;
+}
+
+void blobmsg_policy_free(struct blobmsg_policy_compiled *cp)
+{
+	free(cp);
+}
+
+int blobmsg_parse_compiled(const struct blobmsg_policy_compiled *cp,
+			   struct blob_attr **tb, void *data, unsigned int len)
+{
+	const struct blobmsg_policy *policy = cp->policy;
+	const struct blobmsg_policy_slot *slot;
+	struct blobmsg_hdr *hdr;
+	struct blob_attr *attr;
+	unsigned int pos;
+	uint32_t hash;
+	int i, namelen;
+
+	memset(tb, 0, cp->policy_len * sizeof(*tb));
+
+	__blob_for_each_attr(attr, data, len) {
+		if (blob_len(attr) < sizeof(struct blobmsg_hdr))
+			return -1;
+
+		hdr = blob_data(attr);
+		namelen = blobmsg_namelen(hdr);
+
+		/* like blobmsg_parse(), check if any entry has this length and type */
+		if (namelen < ARRAY_SIZE(cp->check) &&
+		    (cp->check[namelen] & blobmsg_type_bit(blob_id(attr))) &&
+		    !blobmsg_check_attr(attr, true))
+			return -1;
+
+		/* no entry can match, the name is not used */
+		if (namelen > blob_len(attr) - sizeof(struct blobmsg_hdr))
+			continue;
+
+		hash = blobmsg_name_hash((char *) hdr->name, namelen);
+
+		/* entries with the same name all sit in one probe sequence */
+		for (pos = hash & cp->mask; cp->slots[pos].index;
+		     pos = (pos + 1) & cp->mask) {
+			slot = &cp->slots[pos];
+			i = slot->index - 1;
+
+			if (slot->hash != hash || slot->namelen != namelen)
+				continue;
+
+			if (policy[i].type != BLOBMSG_TYPE_UNSPEC &&
+			    blob_id(attr) != policy[i].type)
+				continue;
+
+			if (tb[i])
+				continue;
+
+			if (memcmp(policy[i].name, hdr->name, namelen) != 0)
+				continue;
+
+			tb[i] = attr;
+		}
+	}
+
+	return 0;
+}
+
+int blobmsg_index_init(struct blobmsg_index *idx, struct blob_attr *attr,
+		       struct blob_buf *buf)
+{
+	struct blobmsg_index_slot *slot;
+	struct blob_attr *cur;
+	unsigned int size = 4;
+	uint32_t hash;
+	int count, i, rem;
+	bool table;
+
+	memset(idx, 0, sizeof(*idx));
+
+	count = blobmsg_check_array(attr, BLOBMSG_TYPE_UNSPEC);
+	if (count < 0)
+		return -1;
+
+	table = blobmsg_type(attr) == BLOBMSG_TYPE_TABLE;
+	if (table) {
+		while (size < 2 * count)
+			size <<= 1;
+	} else {
+		size = 0;
+	}
+
+	idx->elems = malloc(count * sizeof(*idx->elems) +
+			    size * sizeof(*idx->slots) + 1);
+	if (!idx->elems)
+		return -1;
+
+	if (table) {
+		idx->slots = (void *) &idx->elems[count];
+		memset(idx->slots, 0, size * sizeof(*idx->slots));
+		idx->mask = size - 1;
+	}
+
+	i = 0;
+	blobmsg_for_each_attr(cur, attr, rem) {
+		idx->elems[i++] = cur;
+		if (!table)
+			continue;
+
+		hash = blobmsg_name_hash(blobmsg_name(cur),
+					 blobmsg_namelen(blob_data(cur)));
+		slot = &idx->slots[hash & idx->mask];
+		while (slot->index)
+			slot = &idx->slots[(slot - idx->slots + 1) & idx->mask];
+
+		slot->hash = hash;
+		slot->index = i;
+	}
+
+	idx->attr = attr;
+	idx->buf = buf;
+	idx->gen = buf ? buf->gen : 0;
+	idx->count = count;
+	return 0;
+}
+
+void blobmsg_index_free(struct blobmsg_index *idx)
+{
+	free(idx->elems);
+	memset(idx, 0, sizeof(*idx));
+}
+
+struct blob_attr *blobmsg_index_get(const struct blobmsg_index *idx, int n)
+{
+	if (!blobmsg_index_valid(idx) || n < 0 || n >= idx->count)
+		return NULL;
+
+	return idx->elems[n];
+}
+
+struct blob_attr *blobmsg_index_lookup(const struct blobmsg_index *idx,
+				       const char *name)
+{
+	const struct blobmsg_index_slot *slot;
+	struct blob_attr *cur;
+	unsigned int pos;
+	size_t namelen;
+	uint32_t hash;
+
+	if (!blobmsg_index_valid(idx) || !idx->slots)
+		return NULL;
+
+	namelen = strlen(name);
+	hash = blobmsg_name_hash(name, namelen);
+	for (pos = hash & idx->mask; idx->slots[pos].index;
+	     pos = (pos + 1) & idx->mask) {
+		slot = &idx->slots[pos];
+		if (slot->hash != hash)
+			continue;
+
+		/* slots are filled in message order, the first match wins */
+		cur = idx->elems[slot->index - 1];
+		if (blobmsg_namelen(blob_data(cur)) == namelen &&
+		    !memcmp(blobmsg_name(cur), name, namelen))
+			return cur;
+	}
+
+	return NULL;
+}
+
 
 static struct blob_attr *
 blobmsg_new(struct blob_buf *buf, int type, const char *name, int payload_len, void **data)
@@ -185,6 +503,10 @@ blobmsg_new(struct blob_buf *buf, int type, const char *name, int payload_len, v
 	int attrlen, namelen;
 	char *pad_start, *pad_end;
 
+	/* blobmsg headers and payloads are always big endian */
+	if (buf->native)
+		return NULL;
+
 	if (!name)
 		name = "";
 
@@ -110,11 +110,120 @@ bool blobmsg_check_attr_list(const struct blob_attr *attr, int type);
  */
 int blobmsg_check_array(const struct blob_attr *attr, int type);
 
+/*
+ * blobmsg_validate_tree: check a whole message in one pass
+ *
+ * Walks attr, which must be a table or array (or the root of a message
+ * built with blobmsg_buf_init), and checks every header, name and string
+ * terminator below it. Nesting deeper than max_depth levels of tables
+ * and arrays is rejected. The caller still has to make sure that the
+ * raw length of attr itself lies within the received buffer.
+ *
+ * Once this succeeded, blobmsg_parse_unchecked() and
+ * blobmsg_for_each_attr_unchecked() can be used on any part of the tree.
+ */
+#define BLOBMSG_MAX_DEPTH	16
+
+bool blobmsg_validate_tree(const struct blob_attr *attr, int max_depth);
+
 int blobmsg_parse(const struct blobmsg_policy *policy, int policy_len,
                   struct blob_attr **tb, void *data, unsigned int len);
+/* blobmsg_parse() without the per attribute checks, for validated trees */
+int blobmsg_parse_unchecked(const struct blobmsg_policy *policy, int policy_len,
+			    struct blob_attr **tb, void *data, unsigned int len);
 int blobmsg_parse_array(const struct blobmsg_policy *policy, int policy_len,
 			struct blob_attr **tb, void *data, unsigned int len);
 
+/*
+ * blobmsg_policy_compile: build a name lookup table for a policy
+ *
+ * blobmsg_parse() compares every attribute against every policy entry.
+ * For large policies that are parsed often, compile the policy once and
+ * use blobmsg_parse_compiled(), which finds the matching entries with a
+ * single hash lookup per attribute. It rejects the same malformed input as
+ * blobmsg_parse(). The policy array must stay valid as long as the
+ * compiled table is used.
+ */
+struct blobmsg_policy_slot {
+	uint32_t hash;
+	uint16_t namelen;
+	uint16_t index;
+};
+
+struct blobmsg_policy_compiled {
+	const struct blobmsg_policy *policy;
+	int policy_len;
+	unsigned int mask;
+	/* types that have an entry with a given name length, as type bits */
+	uint32_t check[256];
+	struct blobmsg_policy_slot slots[];
+};
+
+struct blobmsg_policy_compiled *
+blobmsg_policy_compile(const struct blobmsg_policy *policy, int policy_len);
+void blobmsg_policy_free(struct blobmsg_policy_compiled *cp);
+int blobmsg_parse_compiled(const struct blobmsg_policy_compiled *cp,
+			   struct blob_attr **tb, void *data, unsigned int len);
+
+/*
+ * blobmsg_index: side index for random access into an array or table
+ *
+ * blobmsg_index_init() walks attr once and records the position of every
+ * element, plus a name hash for tables. Afterwards blobmsg_index_get()
+ * and blobmsg_index_lookup() run in constant time. If attr lives in a
+ * blob_buf that is still being written to, pass that buffer as well: any
+ * later change to it invalidates the index and lookups return NULL until
+ * it is rebuilt. Pass NULL for messages that do not change.
+ */
+struct blobmsg_index_slot {
+	uint32_t hash;
+	uint32_t index;
+};
+
+struct blobmsg_index {
+	struct blob_attr *attr;
+	struct blob_buf *buf;
+	unsigned int gen;
+	int count;
+	unsigned int mask;
+	struct blob_attr **elems;
+	struct blobmsg_index_slot *slots;
+};
+
+int blobmsg_index_init(struct blobmsg_index *idx, struct blob_attr *attr,
+		       struct blob_buf *buf);
+void blobmsg_index_free(struct blobmsg_index *idx);
+struct blob_attr *blobmsg_index_get(const struct blobmsg_index *idx, int n);
+struct blob_attr *blobmsg_index_lookup(const struct blobmsg_index *idx,
+				       const char *name);
+
+static inline bool blobmsg_index_valid(const struct blobmsg_index *idx)
+{
+	return idx->attr && (!idx->buf || idx->buf->gen == idx->gen);
+}
+
+static inline int blobmsg_index_count(const struct blobmsg_index *idx)
+{
+	return blobmsg_index_valid(idx) ? idx->count : 0;
+}
+
+/*
+ * blobmsg_diff: describe how table new differs from table old
+ *
+ * adds the change set to the current table of out and returns the number
+ * of changes (0 if both are equivalent) or -1 on error. The change set is
+ * a blobmsg table itself:
+ *   "set": members that were added or got a new value (arrays and values
+ *          are replaced as a whole)
+ *   "del": names of members that were removed
+ *   "mod": a change set for every nested table that changed
+ * Identical subtrees are skipped with a single compare.
+ *
+ * blobmsg_patch: add base with the change set diff applied to out
+ */
+int blobmsg_diff(struct blob_attr *old, struct blob_attr *new, struct blob_buf *out);
+int blobmsg_patch(struct blob_attr *base, struct blob_attr *diff, struct blob_buf *out);
+
 int blobmsg_add_field(struct blob_buf *buf, int type, const char *name,
                       const void *data, unsigned int len);
 
@@ -239,8 +348,15 @@ void blobmsg_printf(struct blob_buf *buf, const char *name, const char *format,
 #define blobmsg_for_each_attr(pos, attr, rem) \
 	for (rem = attr ? blobmsg_data_len(attr) : 0, \
 	     pos = attr ? blobmsg_data(attr) : 0; \
-	     rem > 0 && (blob_pad_len(pos) <= rem) && \
-	     (blob_pad_len(pos) >= sizeof(struct blob_attr)); \
+	     rem > 0 && rem >= blob_hdr_len(pos) && (blob_raw_len(pos) <= rem) && \
+	     (blob_pad_len(pos) <= rem) && \
+	     (blob_raw_len(pos) >= blob_hdr_len(pos)); \
+	     rem -= blob_pad_len(pos), pos = blob_next(pos))
+
+/* iterate a container that passed blobmsg_validate_tree() */
+#define blobmsg_for_each_attr_unchecked(pos, attr, rem) \
+	for (rem = blobmsg_data_len(attr), pos = blobmsg_data(attr); \
+	     rem > 0; \
 	     rem -= blob_pad_len(pos), pos = blob_next(pos))
 
 #endif
@@ -0,0 +1,178 @@
+/*
+ * blobmsg_codec - generated decoders/encoders between blobmsg and C structs
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __BLOBMSG_CODEC_H__
+#define __BLOBMSG_CODEC_H__
+
+#include "libubox/blobmsg.h"
+
+/*
+ * a message schema is a list of fields, each given as
+ * F(type, name, required) where type is one of STRING, BOOL, INT8, INT16,
+ * INT32, INT64, TABLE or ARRAY:
+ *
+ *   #define IFACE_FIELDS(F) \
+ *	F(STRING, name, true) \
+ *	F(INT32, mtu, false) \
+ *	F(TABLE, options, false)
+ *
+ *   BLOBMSG_CODEC_DECLARE(iface, IFACE_FIELDS)	(in a header)
+ *   BLOBMSG_CODEC_DEFINE(iface, IFACE_FIELDS)	(in one source file)
+ *
+ * this declares struct iface with a member and a has_<name> flag per field
+ * and the functions:
+ *
+ *   int iface_decode(struct iface *msg, struct blob_attr *attr);
+ *	fill msg from the table attr. Fields are located with a compiled
+ *	policy and type checked; returns -1 if the table is invalid or a
+ *	required field is missing. Strings, tables and arrays point into attr.
+ *
+ *   int iface_encode(struct blob_buf *buf, const struct iface *msg);
+ *	add every field with has_<name> set to the current table of buf
+ *
+ * the compiled policy is built by a constructor before main() and freed by
+ * a destructor, so decoding needs no locking and leaves nothing behind.
+ * The fields are listed in the same order in the policy and in the enum
+ * used to index tb.
+ */
+
+#define BLOBMSG_CODEC_TYPE_STRING	const char *
+#define BLOBMSG_CODEC_TYPE_BOOL		bool
+#define BLOBMSG_CODEC_TYPE_INT8		uint8_t
+#define BLOBMSG_CODEC_TYPE_INT16	uint16_t
+#define BLOBMSG_CODEC_TYPE_INT32	uint32_t
+#define BLOBMSG_CODEC_TYPE_INT64	uint64_t
+#define BLOBMSG_CODEC_TYPE_TABLE	struct blob_attr *
+#define BLOBMSG_CODEC_TYPE_ARRAY	struct blob_attr *
+
+#define BLOBMSG_CODEC_GET_STRING(attr)	blobmsg_get_string(attr)
+#define BLOBMSG_CODEC_GET_BOOL(attr)	blobmsg_get_bool(attr)
+#define BLOBMSG_CODEC_GET_INT8(attr)	blobmsg_get_u8(attr)
+#define BLOBMSG_CODEC_GET_INT16(attr)	blobmsg_get_u16(attr)
+#define BLOBMSG_CODEC_GET_INT32(attr)	blobmsg_get_u32(attr)
+#define BLOBMSG_CODEC_GET_INT64(attr)	blobmsg_get_u64(attr)
+#define BLOBMSG_CODEC_GET_TABLE(attr)	(attr)
+#define BLOBMSG_CODEC_GET_ARRAY(attr)	(attr)
+
+#define BLOBMSG_CODEC_PUT_STRING(buf, name, val) \
+	(val ? blobmsg_add_string(buf, name, val) : -1)
+#define BLOBMSG_CODEC_PUT_BOOL(buf, name, val)	blobmsg_add_u8(buf, name, !!(val))
+#define BLOBMSG_CODEC_PUT_INT8(buf, name, val)	blobmsg_add_u8(buf, name, val)
+#define BLOBMSG_CODEC_PUT_INT16(buf, name, val)	blobmsg_add_u16(buf, name, val)
+#define BLOBMSG_CODEC_PUT_INT32(buf, name, val)	blobmsg_add_u32(buf, name, val)
+#define BLOBMSG_CODEC_PUT_INT64(buf, name, val)	blobmsg_add_u64(buf, name, val)
+#define BLOBMSG_CODEC_PUT_TABLE(buf, name, val) \
+	__blobmsg_codec_put_nested(buf, BLOBMSG_TYPE_TABLE, name, val)
+#define BLOBMSG_CODEC_PUT_ARRAY(buf, name, val) \
+	__blobmsg_codec_put_nested(buf, BLOBMSG_TYPE_ARRAY, name, val)
+
+#define BLOBMSG_CODEC_POLICY_TYPE(type) \
+	(BLOBMSG_CODEC_POLICY_TYPE_##type)
+#define BLOBMSG_CODEC_POLICY_TYPE_STRING	BLOBMSG_TYPE_STRING
+#define BLOBMSG_CODEC_POLICY_TYPE_BOOL		BLOBMSG_TYPE_BOOL
+#define BLOBMSG_CODEC_POLICY_TYPE_INT8		BLOBMSG_TYPE_INT8
+#define BLOBMSG_CODEC_POLICY_TYPE_INT16		BLOBMSG_TYPE_INT16
+#define BLOBMSG_CODEC_POLICY_TYPE_INT32		BLOBMSG_TYPE_INT32
+#define BLOBMSG_CODEC_POLICY_TYPE_INT64		BLOBMSG_TYPE_INT64
+#define BLOBMSG_CODEC_POLICY_TYPE_TABLE		BLOBMSG_TYPE_TABLE
+#define BLOBMSG_CODEC_POLICY_TYPE_ARRAY		BLOBMSG_TYPE_ARRAY
+
+static inline int
+__blobmsg_codec_put_nested(struct blob_buf *buf, int type, const char *name,
+			   struct blob_attr *val)
+{
+	if (!val)
+		return -1;
+
+	return blobmsg_add_field(buf, type, name, blobmsg_data(val),
+				 blobmsg_data_len(val));
+}
+
+#define __BLOBMSG_CODEC_MEMBER(_type, _name, _req) \
+	BLOBMSG_CODEC_TYPE_##_type _name; \
+	bool has_##_name;
+
+#define __BLOBMSG_CODEC_ENUM(_type, _name, _req) \
+	__BLOBMSG_CODEC_F_##_name,
+
+#define __BLOBMSG_CODEC_POLICY(_type, _name, _req) \
+	{ \
+		.name = #_name, \
+		.type = BLOBMSG_CODEC_POLICY_TYPE(_type), \
+	},
+
+#define __BLOBMSG_CODEC_DECODE(_type, _name, _req) \
+	if (tb[__BLOBMSG_CODEC_F_##_name]) { \
+		msg->_name = BLOBMSG_CODEC_GET_##_type(tb[__BLOBMSG_CODEC_F_##_name]); \
+		msg->has_##_name = true; \
+	} else if (_req) { \
+		return -1; \
+	}
+
+#define __BLOBMSG_CODEC_ENCODE(_type, _name, _req) \
+	if (msg->has_##_name && \
+	    BLOBMSG_CODEC_PUT_##_type(buf, #_name, msg->_name)) \
+		return -1;
+
+#define BLOBMSG_CODEC_DECLARE(prefix, FIELDS) \
+	struct prefix { \
+		FIELDS(__BLOBMSG_CODEC_MEMBER) \
+	}; \
+	int prefix##_decode(struct prefix *msg, struct blob_attr *attr); \
+	int prefix##_encode(struct blob_buf *buf, const struct prefix *msg);
+
+#define BLOBMSG_CODEC_DEFINE(prefix, FIELDS) \
+	static const struct blobmsg_policy prefix##_codec_policy[] = { \
+		FIELDS(__BLOBMSG_CODEC_POLICY) \
+	}; \
+	static struct blobmsg_policy_compiled *prefix##_codec_cp; \
+	\
+	static void __constructor prefix##_codec_init(void) \
+	{ \
+		prefix##_codec_cp = blobmsg_policy_compile(prefix##_codec_policy, \
+			ARRAY_SIZE(prefix##_codec_policy)); \
+	} \
+	\
+	static void __destructor prefix##_codec_free(void) \
+	{ \
+		blobmsg_policy_free(prefix##_codec_cp); \
+		prefix##_codec_cp = NULL; \
+	} \
+	\
+	int prefix##_decode(struct prefix *msg, struct blob_attr *attr) \
+	{ \
+		enum { FIELDS(__BLOBMSG_CODEC_ENUM) __BLOBMSG_CODEC_MAX }; \
+		struct blobmsg_policy_compiled *cp = prefix##_codec_cp; \
+		struct blob_attr *tb[__BLOBMSG_CODEC_MAX]; \
+		\
+		memset(msg, 0, sizeof(*msg)); \
+		if (!cp || !attr || blobmsg_type(attr) != BLOBMSG_TYPE_TABLE) \
+			return -1; \
+		\
+		if (blobmsg_parse_compiled(cp, tb, blobmsg_data(attr), \
+					   blobmsg_data_len(attr))) \
+			return -1; \
+		\
+		FIELDS(__BLOBMSG_CODEC_DECODE) \
+		return 0; \
+	} \
+	\
+	int prefix##_encode(struct blob_buf *buf, const struct prefix *msg) \
+	{ \
+		FIELDS(__BLOBMSG_CODEC_ENCODE) \
+		return 0; \
+	}
+
+#endif
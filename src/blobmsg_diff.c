@@ -0,0 +1,360 @@
+/*
+ * blobmsg_diff - structural diff and patch for blobmsg tables
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "blobmsg.h"
+
+enum {
+	DIFF_SET,
+	DIFF_DEL,
+	DIFF_MOD,
+	__DIFF_MAX
+};
+
+static const struct blobmsg_policy diff_policy[__DIFF_MAX] = {
+	[DIFF_SET] = { .name = "set", .type = BLOBMSG_TYPE_TABLE },
+	[DIFF_DEL] = { .name = "del", .type = BLOBMSG_TYPE_TABLE },
+	[DIFF_MOD] = { .name = "mod", .type = BLOBMSG_TYPE_TABLE },
+};
+
+/* smaller tables are searched linearly instead of building an index */
+#define DIFF_INDEX_MIN_LEN	256
+
+struct diff_list {
+	struct blob_attr *attr;
+	struct blobmsg_index idx;
+};
+
+/* rollback point for the open table of a blob_buf */
+struct diff_mark {
+	unsigned int len;
+	bool long_hdr;
+};
+
+static bool
+diff_is_table(struct blob_attr *attr)
+{
+	return attr && blobmsg_type(attr) == BLOBMSG_TYPE_TABLE;
+}
+
+static int
+diff_list_init(struct diff_list *l, struct blob_attr *attr)
+{
+	memset(l, 0, sizeof(*l));
+	l->attr = attr;
+	if (!attr)
+		return 0;
+
+	if (blobmsg_data_len(attr) >= DIFF_INDEX_MIN_LEN)
+		return blobmsg_index_init(&l->idx, attr, NULL);
+
+	return blobmsg_check_array(attr, BLOBMSG_TYPE_UNSPEC) < 0 ? -1 : 0;
+}
+
+static void
+diff_list_free(struct diff_list *l)
+{
+	blobmsg_index_free(&l->idx);
+}
+
+/* the first member with a given name is the one that counts */
+static struct blob_attr *
+diff_lookup(struct diff_list *l, const char *name)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	if (l->idx.attr)
+		return blobmsg_index_lookup(&l->idx, name);
+
+	blobmsg_for_each_attr(cur, l->attr, rem)
+		if (!strcmp(blobmsg_name(cur), name))
+			return cur;
+
+	return NULL;
+}
+
+static bool
+diff_is_first(struct diff_list *l, struct blob_attr *attr)
+{
+	return diff_lookup(l, blobmsg_name(attr)) == attr;
+}
+
+/* value compare, ignoring the name */
+static bool
+diff_value_equal(struct blob_attr *a, struct blob_attr *b)
+{
+	int len = blobmsg_data_len(a);
+
+	return blobmsg_type(a) == blobmsg_type(b) &&
+	       len == blobmsg_data_len(b) &&
+	       !memcmp(blobmsg_data(a), blobmsg_data(b), len);
+}
+
+static void *
+diff_open(struct blob_buf *out, void **cookie, int type)
+{
+	if (out && !*cookie)
+		*cookie = blobmsg_open_table(out, diff_policy[type].name);
+
+	return *cookie;
+}
+
+static void
+diff_mark(struct blob_buf *out, struct diff_mark *m)
+{
+	m->len = blob_raw_len(out->head);
+	m->long_hdr = blob_is_long(out->head);
+}
+
+/* drop everything added to the open table since diff_mark() */
+static void
+diff_rollback(struct blob_buf *out, struct diff_mark *m)
+{
+	struct blob_attr *head = out->head;
+
+	out->gen++;
+	if (blob_is_long(head) == m->long_hdr) {
+		blob_set_raw_len(head, m->len);
+		return;
+	}
+
+	/*
+	 * the table was moved to a long header meanwhile: what is kept fit the
+	 * short one, move it back. The parent only accounts for 4 bytes of
+	 * the header of its open child either way.
+	 */
+	memmove(head->data, head->data + sizeof(uint32_t), m->len - sizeof(*head));
+	head->id_len &= ~cpu_to_be32(BLOB_ATTR_LEN_MASK);
+	head->id_len |= cpu_to_be32(m->len);
+}
+
+/*
+ * adds the change set for one nested table below "mod", or nothing if the
+ * tables only differ in layout. with out == NULL only count the changes.
+ */
+static int diff_table(struct blob_attr *old, struct blob_attr *new, struct blob_buf *out);
+
+static int
+diff_mod(struct blob_attr *o, struct blob_attr *cur, struct blob_buf *out,
+	 void **mod)
+{
+	struct diff_mark outer, inner;
+	bool opened = false;
+	void *c;
+	int n;
+
+	if (!out)
+		return diff_table(o, cur, NULL);
+
+	diff_mark(out, &outer);
+	if (!*mod) {
+		if (!diff_open(out, mod, DIFF_MOD))
+			return -1;
+		opened = true;
+	}
+
+	diff_mark(out, &inner);
+	c = blobmsg_open_table(out, blobmsg_name(cur));
+	if (!c)
+		return -1;
+
+	n = diff_table(o, cur, out);
+	blobmsg_close_table(out, c);
+	if (n)
+		return n;
+
+	diff_rollback(out, &inner);
+	if (opened) {
+		blobmsg_close_table(out, *mod);
+		*mod = NULL;
+		diff_rollback(out, &outer);
+	}
+
+	return 0;
+}
+
+static int
+diff_table(struct blob_attr *old, struct blob_attr *new, struct blob_buf *out)
+{
+	struct diff_list old_l, new_l;
+	struct blob_attr *cur, *o;
+	void *cookie[__DIFF_MAX] = {};
+	int changes = 0, ret = 0;
+	int n, rem;
+
+	if (diff_list_init(&old_l, old))
+		return -1;
+
+	if (diff_list_init(&new_l, new)) {
+		diff_list_free(&old_l);
+		return -1;
+	}
+
+	/* added or replaced members */
+	blobmsg_for_each_attr(cur, new, rem) {
+		if (!diff_is_first(&new_l, cur))
+			continue;
+
+		o = diff_lookup(&old_l, blobmsg_name(cur));
+		if (o && diff_value_equal(o, cur))
+			continue;
+
+		if (o && diff_is_table(o) && diff_is_table(cur))
+			continue;
+
+		changes++;
+		if (diff_open(out, &cookie[DIFF_SET], DIFF_SET))
+			blobmsg_add_blob(out, cur);
+	}
+
+	if (cookie[DIFF_SET])
+		blobmsg_close_table(out, cookie[DIFF_SET]);
+
+	/* removed members */
+	blobmsg_for_each_attr(o, old, rem) {
+		if (!diff_is_first(&old_l, o) ||
+		    diff_lookup(&new_l, blobmsg_name(o)))
+			continue;
+
+		changes++;
+		if (diff_open(out, &cookie[DIFF_DEL], DIFF_DEL))
+			blobmsg_add_u8(out, blobmsg_name(o), 1);
+	}
+
+	if (cookie[DIFF_DEL])
+		blobmsg_close_table(out, cookie[DIFF_DEL]);
+
+	/* nested tables that changed, in a single pass */
+	blobmsg_for_each_attr(cur, new, rem) {
+		if (!diff_is_table(cur) || !diff_is_first(&new_l, cur))
+			continue;
+
+		o = diff_lookup(&old_l, blobmsg_name(cur));
+		if (!diff_is_table(o) || diff_value_equal(o, cur))
+			continue;
+
+		n = diff_mod(o, cur, out, &cookie[DIFF_MOD]);
+		if (n < 0) {
+			ret = -1;
+			break;
+		}
+
+		changes += n;
+	}
+
+	if (cookie[DIFF_MOD])
+		blobmsg_close_table(out, cookie[DIFF_MOD]);
+
+	diff_list_free(&old_l);
+	diff_list_free(&new_l);
+
+	return ret ? ret : changes;
+}
+
+int blobmsg_diff(struct blob_attr *old, struct blob_attr *new, struct blob_buf *out)
+{
+	if (!diff_is_table(old) || !diff_is_table(new))
+		return -1;
+
+	return diff_table(old, new, out);
+}
+
+static int
+patch_table(struct blob_attr *base, struct blob_attr *diff, struct blob_buf *out)
+{
+	struct diff_list base_l, l[__DIFF_MAX] = {};
+	struct blob_attr *tb[__DIFF_MAX], *cur, *val;
+	const char *name;
+	int i, rem, ret = -1;
+	void *c;
+
+	if (blobmsg_parse(diff_policy, __DIFF_MAX, tb, blobmsg_data(diff),
+			  blobmsg_data_len(diff)))
+		return -1;
+
+	/* a member that did not make it into tb has the wrong type */
+	blobmsg_for_each_attr(cur, diff, rem)
+		for (i = 0; i < __DIFF_MAX; i++)
+			if (!strcmp(blobmsg_name(cur), diff_policy[i].name) &&
+			    tb[i] != cur)
+				return -1;
+
+	if (diff_list_init(&base_l, base))
+		return -1;
+
+	for (i = 0; i < __DIFF_MAX; i++)
+		if (diff_list_init(&l[i], tb[i]))
+			goto out;
+
+	blobmsg_for_each_attr(cur, base, rem) {
+		name = blobmsg_name(cur);
+
+		if (diff_lookup(&l[DIFF_DEL], name))
+			continue;
+
+		if (!diff_is_first(&base_l, cur)) {
+			blobmsg_add_blob(out, cur);
+			continue;
+		}
+
+		val = diff_lookup(&l[DIFF_SET], name);
+		if (val) {
+			blobmsg_add_field(out, blobmsg_type(val), name,
+					  blobmsg_data(val), blobmsg_data_len(val));
+			continue;
+		}
+
+		val = diff_lookup(&l[DIFF_MOD], name);
+		if (val && diff_is_table(cur) && diff_is_table(val)) {
+			c = blobmsg_open_table(out, name);
+			if (!c)
+				goto out;
+
+			ret = patch_table(cur, val, out);
+			blobmsg_close_table(out, c);
+			if (ret)
+				goto out;
+
+			ret = -1;
+			continue;
+		}
+
+		blobmsg_add_blob(out, cur);
+	}
+
+	/* members that are new to base */
+	if (tb[DIFF_SET]) {
+		blobmsg_for_each_attr(val, tb[DIFF_SET], rem)
+			if (!diff_lookup(&base_l, blobmsg_name(val)))
+				blobmsg_add_blob(out, val);
+	}
+
+	ret = 0;
+
+out:
+	for (i = 0; i < __DIFF_MAX; i++)
+		diff_list_free(&l[i]);
+	diff_list_free(&base_l);
+	return ret;
+}
+
+int blobmsg_patch(struct blob_attr *base, struct blob_attr *diff, struct blob_buf *out)
+{
+	if (!diff_is_table(base) || !diff_is_table(diff))
+		return -1;
+
+	return patch_table(base, diff, out);
+}
@@ -13,9 +13,15 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#include <ctype.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "json.h"
+#include "printbuf.h"
+#include "ustream.h"
 #include "blobmsg.h"
 #include "blobmsg_json.h"
 
@@ -65,56 +71,469 @@ bool blobmsg_add_json_element(struct blob_buf *b, const char *name, struct json
 	return ret;
 }
 
-static bool __blobmsg_add_json(struct blob_buf *b, struct json *obj)
+/*
+ * direct JSON text to blobmsg conversion: attributes are written to the
+ * blob_buf while the text is scanned, no struct json tree is built.
+ * The type mapping is the same as in blobmsg_add_json_element().
+ */
+#define BLOBMSG_JSON_NAME_LEN	256
+
+struct blobmsg_json_parser {
+	struct blob_buf *b;
+	const char *pos;
+};
+
+static bool blobmsg_json_parse_value(struct blobmsg_json_parser *p, const char *name);
+
+static void blobmsg_json_skip(struct blobmsg_json_parser *p)
 {
-	bool ret = false;
+	while (isspace(*p->pos))
+		p->pos++;
+}
 
-	if (!obj)
+/* length of the escaped string, the unescaped version never gets longer */
+static int blobmsg_json_string_len(const char *str)
+{
+	const char *ptr = str + 1;
+
+	while (*ptr != '"' && *ptr) {
+		if (*ptr++ == '\\' && *ptr)
+			ptr++;
+	}
+
+	if (*ptr != '"')
+		return -1;
+
+	return ptr - str - 1;
+}
+
+static int blobmsg_json_hex4(const char *str, unsigned int *val)
+{
+	int i;
+
+	*val = 0;
+	for (i = 0; i < 4; i++) {
+		if (!isxdigit(str[i]))
+			return -1;
+
+		*val = (*val << 4) | (isdigit(str[i]) ? str[i] - '0' :
+				      (tolower(str[i]) - 'a' + 10));
+	}
+
+	return 0;
+}
+
+static const unsigned char blobmsg_json_first_byte[5] = {
+	0x00, 0x00, 0xC0, 0xE0, 0xF0
+};
+
+/*
+ * unescape the string at p->pos into out (NUL terminated) and move past
+ * the closing quote. Invalid \u sequences are dropped, like json_parse()
+ * does.
+ */
+static bool blobmsg_json_unescape(struct blobmsg_json_parser *p, char *out)
+{
+	const char *ptr = p->pos + 1;
+	unsigned int uc, uc2;
+	int len;
+
+	while (*ptr != '"') {
+		if (!*ptr)
+			return false;
+
+		if (*ptr != '\\') {
+			*out++ = *ptr++;
+			continue;
+		}
+
+		ptr++;
+		switch (*ptr) {
+		case 'b':
+			*out++ = '\b';
+			break;
+		case 'f':
+			*out++ = '\f';
+			break;
+		case 'n':
+			*out++ = '\n';
+			break;
+		case 'r':
+			*out++ = '\r';
+			break;
+		case 't':
+			*out++ = '\t';
+			break;
+		case 'u':
+			if (blobmsg_json_hex4(ptr + 1, &uc))
+				return false;
+			ptr += 4;
+
+			if ((uc >= 0xDC00 && uc <= 0xDFFF) || uc == 0)
+				break;
+
+			if (uc >= 0xD800 && uc <= 0xDBFF) {
+				if (ptr[1] != '\\' || ptr[2] != 'u')
+					break;
+				if (blobmsg_json_hex4(ptr + 3, &uc2))
+					return false;
+				ptr += 6;
+				if (uc2 < 0xDC00 || uc2 > 0xDFFF)
+					break;
+				uc = 0x10000 | ((uc & 0x3FF) << 10) | (uc2 & 0x3FF);
+			}
+
+			if (uc < 0x80)
+				len = 1;
+			else if (uc < 0x800)
+				len = 2;
+			else if (uc < 0x10000)
+				len = 3;
+			else
+				len = 4;
+
+			out += len;
+			switch (len) {
+			case 4:
+				*--out = (uc | 0x80) & 0xBF;
+				uc >>= 6;
+			case 3:
+				*--out = (uc | 0x80) & 0xBF;
+				uc >>= 6;
+			case 2:
+				*--out = (uc | 0x80) & 0xBF;
+				uc >>= 6;
+			case 1:
+				*--out = uc | blobmsg_json_first_byte[len];
+			}
+			out += len;
+			break;
+		case 0:
+			return false;
+		default:
+			*out++ = *ptr;
+			break;
+		}
+		ptr++;
+	}
+
+	*out = 0;
+	p->pos = ptr + 1;
+	return true;
+}
+
+static bool blobmsg_json_parse_string(struct blobmsg_json_parser *p, const char *name)
+{
+	int len = blobmsg_json_string_len(p->pos);
+	char *str;
+
+	if (len < 0)
+		return false;
+
+	str = blobmsg_alloc_string_buffer(p->b, name, len + 1);
+	if (!str || !blobmsg_json_unescape(p, str))
 		return false;
 
-	if (obj->type != json_type_object)
+	blobmsg_add_string_buffer(p->b);
+	return true;
+}
+
+/* same rounding as parse_number() in json.c */
+static bool blobmsg_json_parse_number(struct blobmsg_json_parser *p, const char *name)
+{
+	const char *num = p->pos;
+	uint64_t n64 = 0;
+	int64_t val;
+	double n = 0, sign = 1;
+	int scale = 0, subscale = 0, signsubscale = 1;
+	bool real = false;
+
+	if (*num == '-') {
+		sign = -1;
+		num++;
+	}
+	if (*num == '0')
+		num++;
+	while (*num >= '0' && *num <= '9') {
+		n = (n * 10.0) + (*num - '0');
+		n64 = (n64 * 10) + (*num - '0');
+		num++;
+	}
+	if (*num == '.' && num[1] >= '0' && num[1] <= '9') {
+		real = true;
+		num++;
+		do {
+			n = (n * 10.0) + (*num - '0');
+			scale--;
+			num++;
+		} while (*num >= '0' && *num <= '9');
+	}
+	if (*num == 'e' || *num == 'E') {
+		real = true;
+		num++;
+		if (*num == '+')
+			num++;
+		else if (*num == '-') {
+			signsubscale = -1;
+			num++;
+		}
+		while (*num >= '0' && *num <= '9') {
+			subscale = (subscale * 10) + (*num - '0');
+			num++;
+		}
+	}
+
+	if (real)
+		val = (int64_t) (sign * n * pow(10.0, scale + subscale * signsubscale));
+	else
+		val = sign < 0 ? -(int64_t) n64 : (int64_t) n64;
+
+	p->pos = num;
+	return !blobmsg_add_u32(p->b, name, val);
+}
+
+/* add the members of the array or object at p->pos to the current container */
+static bool blobmsg_json_parse_members(struct blobmsg_json_parser *p, bool array)
+{
+	char buf[BLOBMSG_JSON_NAME_LEN], *key = NULL;
+	char end = array ? ']' : '}';
+	bool ret = false;
+	int len;
+
+	p->pos++;
+	blobmsg_json_skip(p);
+	if (*p->pos == end)
 		goto out;
 
-	ret = blobmsg_add_object(b, obj);
+	while (1) {
+		if (!array) {
+			if (*p->pos != '"')
+				return false;
+
+			len = blobmsg_json_string_len(p->pos);
+			if (len < 0)
+				return false;
+
+			if (len < sizeof(buf))
+				key = buf;
+			else if (!(key = malloc(len + 1)))
+				return false;
+
+			if (!blobmsg_json_unescape(p, key))
+				goto error;
+
+			blobmsg_json_skip(p);
+			if (*p->pos != ':')
+				goto error;
+			p->pos++;
+			blobmsg_json_skip(p);
+		}
+
+		if (!blobmsg_json_parse_value(p, key))
+			goto error;
+
+		if (key != buf)
+			free(key);
+		key = NULL;
+
+		blobmsg_json_skip(p);
+		if (*p->pos != ',')
+			break;
+
+		p->pos++;
+		blobmsg_json_skip(p);
+	}
+
+	if (*p->pos != end)
+		goto error;
 
 out:
-	json_object_put(obj);
+	p->pos++;
+	ret = true;
+error:
+	if (key != buf)
+		free(key);
 	return ret;
 }
 
+static bool blobmsg_json_parse_list(struct blobmsg_json_parser *p, const char *name,
+				    bool array)
+{
+	void *c;
+	bool ret;
+
+	c = blobmsg_open_nested(p->b, name, array);
+	if (!c)
+		return false;
+
+	ret = blobmsg_json_parse_members(p, array);
+	blob_nest_end(p->b, c);
+	return ret;
+}
+
+static bool blobmsg_json_parse_value(struct blobmsg_json_parser *p, const char *name)
+{
+	if (!strncmp(p->pos, "true", 4)) {
+		p->pos += 4;
+		return !blobmsg_add_u8(p->b, name, 1);
+	} else if (!strncmp(p->pos, "false", 5)) {
+		p->pos += 5;
+		return !blobmsg_add_u8(p->b, name, 0);
+	}
+
+	switch (*p->pos) {
+	case '"':
+		return blobmsg_json_parse_string(p, name);
+	case '-':
+	case '0' ... '9':
+		return blobmsg_json_parse_number(p, name);
+	case '[':
+		return blobmsg_json_parse_list(p, name, true);
+	case '{':
+		return blobmsg_json_parse_list(p, name, false);
+	}
+
+	/* null has no blobmsg representation */
+	return false;
+}
+
+/*
+ * the members of the top level object are added to b directly. On
+ * failure, b may contain the attributes converted up to the error.
+ */
+static bool __blobmsg_add_json(struct blob_buf *b, const char *str)
+{
+	struct blobmsg_json_parser p = {
+		.b = b,
+		.pos = str,
+	};
+
+	blobmsg_json_skip(&p);
+	if (*p.pos != '{')
+		return false;
+
+	return blobmsg_json_parse_members(&p, false);
+}
+
 bool blobmsg_add_json_from_file(struct blob_buf *b, const char *file)
 {
-	return __blobmsg_add_json(b, json_object_from_file(file));
+	struct printbuf *pb;
+	char buf[JSON_FILE_BUF_SIZE];
+	bool ret = false;
+	int fd, len;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	pb = printbuf_new();
+	if (!pb)
+		goto out;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+		printbuf_memappend(pb, buf, len);
+
+	if (!len && pb->bpos)
+		ret = __blobmsg_add_json(b, pb->buf);
+
+	printbuf_free(pb);
+out:
+	close(fd);
+	return ret;
 }
 
 bool blobmsg_add_json_from_string(struct blob_buf *b, const char *str)
 {
-	return __blobmsg_add_json(b, json_parse(str));
+	return __blobmsg_add_json(b, str);
 }
 
 
+/* staging buffer size when the output goes to a sink */
+#define BLOBMSG_JSON_SINK_BUF	4096
+
 struct strbuf {
 	int len;
 	int pos;
 	char *buf;
 
+	/* with a sink, buf is flushed to it whenever it fills up */
+	blobmsg_json_sink_t sink;
+	void *sink_priv;
+	int written;
+	bool error;
+
 	blobmsg_json_format_t custom_format;
 	void *priv;
 	bool indent;
 	int indent_level;
 };
 
-static bool blobmsg_puts(struct strbuf *s, const char *c, int len)
+static bool blobmsg_sink_write(struct strbuf *s, const char *c, int len)
 {
-	if (len <= 0)
-		return true;
+	int wr = s->sink(s->sink_priv, c, len);
+
+	if (wr > 0)
+		s->written += wr;
+	if (wr < len) {
+		/* makes every further blobmsg_puts() take the slow path */
+		s->error = true;
+		s->len = 0;
+	}
+
+	return !s->error;
+}
 
-	if (s->pos + len >= s->len) {
-		s->len += 16 + len;
-		s->buf = realloc(s->buf, s->len);
-		if (!s->buf)
+static bool blobmsg_flush(struct strbuf *s)
+{
+	int len = s->pos;
+
+	s->pos = 0;
+	return !len || blobmsg_sink_write(s, s->buf, len);
+}
+
+static bool __blobmsg_puts(struct strbuf *s, const char *c, int len)
+{
+	char *buf;
+	int new_len;
+
+	if (s->error)
+		return false;
+
+	if (s->sink) {
+		if (!blobmsg_flush(s))
 			return false;
+
+		/* does not fit the staging buffer, pass it through */
+		if (len >= s->len)
+			return blobmsg_sink_write(s, c, len);
+	} else {
+		new_len = s->len * 2;
+		while (s->pos + len >= new_len)
+			new_len *= 2;
+
+		buf = realloc(s->buf, new_len);
+		if (!buf) {
+			s->error = true;
+			s->len = 0;
+			return false;
+		}
+		s->buf = buf;
+		s->len = new_len;
 	}
+
+	memcpy(s->buf + s->pos, c, len);
+	s->pos += len;
+	return true;
+}
+
+static inline bool blobmsg_puts(struct strbuf *s, const char *c, int len)
+{
+	if (len <= 0)
+		return true;
+
+	if (s->pos + len >= s->len)
+		return __blobmsg_puts(s, c, len);
+
 	memcpy(s->buf + s->pos, c, len);
 	s->pos += len;
 	return true;
@@ -142,15 +561,22 @@ static void add_separator(struct strbuf *s)
 
 static void blobmsg_format_string(struct strbuf *s, const char *str)
 {
-	const unsigned char *p, *last, *end;
+	const char *p, *end;
 	char buf[8] = "\\u00";
+	size_t n;
 
-	end = (unsigned char *) str + strlen(str);
+	end = str + strlen(str);
 	blobmsg_puts(s, "\"", 1);
-	for (p = (unsigned char *) str, last = p; *p; p++) {
+	for (p = str; ; p++) {
 		char escape = '\0';
 		int len;
 
+		n = json_escape_span(p, end - p, 1);
+		blobmsg_puts(s, p, n);
+		p += n;
+		if (p == end)
+			break;
+
 		switch(*p) {
 		case '\b':
 			escape = 'b';
@@ -170,19 +596,11 @@ static void blobmsg_format_string(struct strbuf *s, const char *str)
 			escape = *p;
 			break;
 		default:
-			if (*p < ' ')
-				escape = 'u';
+			escape = 'u';
 			break;
 		}
 
-		if (!escape)
-			continue;
-
-		if (p > last)
-			blobmsg_puts(s, (char *) last, p - last);
-		last = p + 1;
 		buf[1] = escape;
-
 		if (escape == 'u') {
 			sprintf(buf + 4, "%02x", (unsigned char) *p);
 			len = 6;
@@ -191,8 +609,6 @@ static void blobmsg_format_string(struct strbuf *s, const char *str)
 		}
 		blobmsg_puts(s, buf, len);
 	}
-
-	blobmsg_puts(s, (char *) last, end - last);
 	blobmsg_puts(s, "\"", 1);
 }
 
@@ -277,38 +693,91 @@ static void blobmsg_format_json_list(struct strbuf *s, struct blob_attr *attr, i
 	blobmsg_puts(s, (array ? "]" : "}"), 1);
 }
 
-char *blobmsg_format_json_with_cb(struct blob_attr *attr, bool list, blobmsg_json_format_t cb, void *priv, int indent)
+static void blobmsg_format_json_init(struct strbuf *s, blobmsg_json_format_t cb,
+				     void *priv, int indent)
 {
-	struct strbuf s;
-	bool array;
-
-	s.len = blob_len(attr);
-	s.buf = malloc(s.len);
-	s.pos = 0;
-	s.custom_format = cb;
-	s.priv = priv;
-	s.indent = false;
+	memset(s, 0, sizeof(*s));
+	s->custom_format = cb;
+	s->priv = priv;
 
 	if (indent >= 0) {
-		s.indent = true;
-		s.indent_level = indent;
+		s->indent = true;
+		s->indent_level = indent;
 	}
+}
+
+static void blobmsg_format_json_attr(struct strbuf *s, struct blob_attr *attr, bool list)
+{
+	bool array;
 
 	array = blob_is_extended(attr) &&
 		blobmsg_type(attr) == BLOBMSG_TYPE_ARRAY;
 
 	if (list)
-		blobmsg_format_json_list(&s, blobmsg_data(attr), blobmsg_data_len(attr), array);
+		blobmsg_format_json_list(s, blobmsg_data(attr), blobmsg_data_len(attr), array);
 	else
-		blobmsg_format_element(&s, attr, false, false);
+		blobmsg_format_element(s, attr, false, false);
+}
 
-	if (!s.len) {
+char *blobmsg_format_json_with_cb(struct blob_attr *attr, bool list, blobmsg_json_format_t cb, void *priv, int indent)
+{
+	struct strbuf s;
+	char *buf;
+
+	blobmsg_format_json_init(&s, cb, priv, indent);
+
+	/* the JSON text is usually a bit larger than the blob */
+	s.len = 64;
+	while (s.len < blob_len(attr) + blob_len(attr) / 2)
+		s.len *= 2;
+
+	s.buf = malloc(s.len);
+	if (!s.buf)
+		return NULL;
+
+	blobmsg_format_json_attr(&s, attr, list);
+	if (s.error || (!s.pos && !blob_len(attr))) {
 		free(s.buf);
 		return NULL;
 	}
 
-	s.buf = realloc(s.buf, s.pos + 1);
-	s.buf[s.pos] = 0;
+	/* give back what the doubling over-allocated */
+	buf = realloc(s.buf, s.pos + 1);
+	if (buf)
+		s.buf = buf;
 
+	s.buf[s.pos] = 0;
 	return s.buf;
 }
+
+int blobmsg_format_json_sink(struct blob_attr *attr, bool list,
+			     blobmsg_json_format_t cb, void *priv, int indent,
+			     blobmsg_json_sink_t sink, void *sink_priv)
+{
+	char buf[BLOBMSG_JSON_SINK_BUF];
+	struct strbuf s;
+
+	blobmsg_format_json_init(&s, cb, priv, indent);
+	s.buf = buf;
+	s.len = sizeof(buf);
+	s.sink = sink;
+	s.sink_priv = sink_priv;
+
+	blobmsg_format_json_attr(&s, attr, list);
+	if (!s.error)
+		blobmsg_flush(&s);
+
+	return s.error ? -1 : s.written;
+}
+
+static int blobmsg_ustream_sink(void *priv, const char *data, int len)
+{
+	return ustream_write(priv, data, len, false);
+}
+
+int blobmsg_format_json_ustream(struct ustream *us, struct blob_attr *attr,
+				bool list, int indent)
+{
+	return blobmsg_format_json_sink(attr, list, NULL, NULL, indent,
+					blobmsg_ustream_sink, us);
+}
@@ -17,6 +17,7 @@
 #define __BLOBMSG_JSON_H__
 
 struct json_object;
+struct ustream;
 
 #include <stdbool.h>
 #include "libubox/blobmsg.h"
@@ -32,6 +33,28 @@ char *blobmsg_format_json_with_cb(struct blob_attr *attr, bool list,
 				  blobmsg_json_format_t cb, void *priv,
 				  int indent);
 
+/*
+ * blobmsg_json_sink_t: output callback for blobmsg_format_json_sink()
+ * returns the number of bytes accepted, formatting stops early when
+ * fewer than len bytes were taken.
+ */
+typedef int (*blobmsg_json_sink_t)(void *priv, const char *data, int len);
+
+/*
+ * blobmsg_format_json_sink: format attr without building the string
+ *
+ * The text is handed to the sink in pieces of up to a few KB, so large
+ * messages never have to be held in memory as a whole. Returns the number
+ * of bytes written, or -1 if the sink gave up.
+ */
+int blobmsg_format_json_sink(struct blob_attr *attr, bool list,
+			     blobmsg_json_format_t cb, void *priv, int indent,
+			     blobmsg_json_sink_t sink, void *sink_priv);
+
+/* blobmsg_format_json_sink() into the write buffer of a ustream */
+int blobmsg_format_json_ustream(struct ustream *us, struct blob_attr *attr,
+				bool list, int indent);
+
 static inline char *blobmsg_format_json(struct blob_attr *attr, bool list)
 {
 	return blobmsg_format_json_with_cb(attr, list, NULL, NULL, -1);
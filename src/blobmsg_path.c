@@ -0,0 +1,451 @@
+/*
+ * blobmsg_path - path queries over blobmsg trees
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+
+#include "blobmsg_path.h"
+
+enum path_step_type {
+	PATH_NAME,
+	PATH_ANY,
+	PATH_INDEX,
+	PATH_FILTER,
+};
+
+enum path_op {
+	PATH_OP_EQ,
+	PATH_OP_NE,
+	PATH_OP_LT,
+	PATH_OP_LE,
+	PATH_OP_GT,
+	PATH_OP_GE,
+};
+
+struct path_step {
+	enum path_step_type type;
+	enum path_op op;
+	const char *name;
+	unsigned int namelen;
+	int index;
+
+	/* filter value */
+	const char *str;
+	int64_t num;
+};
+
+struct blobmsg_path {
+	int n_steps;
+	struct path_step steps[];
+};
+
+struct path_match {
+	struct blob_attr **res;
+	int max;
+	int count;
+};
+
+static const char *
+path_parse_string(const char *s, char **out)
+{
+	char *dest = *out;
+
+	/* s points behind the opening quote */
+	while (*s && *s != '"') {
+		if (*s == '\\' && s[1])
+			s++;
+		*dest++ = *s++;
+	}
+
+	if (*s != '"')
+		return NULL;
+
+	*dest++ = 0;
+	*out = dest;
+	return s + 1;
+}
+
+static const char *
+path_parse_filter(struct path_step *step, const char *s, char **strbuf)
+{
+	static const struct {
+		const char *str;
+		enum path_op op;
+	} ops[] = {
+		{ "==", PATH_OP_EQ }, { "!=", PATH_OP_NE },
+		{ "<=", PATH_OP_LE }, { ">=", PATH_OP_GE },
+		{ "<", PATH_OP_LT }, { ">", PATH_OP_GT },
+		{ "=", PATH_OP_EQ },
+	};
+	const char *start = s;
+	char *end;
+	int i;
+
+	while (*s && !strchr("=!<>]", *s))
+		s++;
+
+	while (s > start && isspace(s[-1]))
+		s--;
+
+	if (s == start)
+		return NULL;
+
+	step->type = PATH_FILTER;
+	step->name = start;
+	step->namelen = s - start;
+
+	while (isspace(*s))
+		s++;
+
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		if (!strncmp(s, ops[i].str, strlen(ops[i].str)))
+			break;
+	}
+	if (i == ARRAY_SIZE(ops))
+		return NULL;
+
+	step->op = ops[i].op;
+	s += strlen(ops[i].str);
+	while (isspace(*s))
+		s++;
+
+	if (*s == '"') {
+		step->str = *strbuf;
+		s = path_parse_string(s + 1, strbuf);
+		if (!s)
+			return NULL;
+	} else if (!strncmp(s, "true", 4)) {
+		step->num = 1;
+		s += 4;
+	} else if (!strncmp(s, "false", 5)) {
+		step->num = 0;
+		s += 5;
+	} else {
+		step->num = strtoll(s, &end, 0);
+		if (end == s)
+			return NULL;
+		s = end;
+	}
+
+	while (isspace(*s))
+		s++;
+
+	return s;
+}
+
+static const char *
+path_parse_bracket(struct path_step *step, const char *s, char **strbuf)
+{
+	char *end;
+	long val;
+
+	while (isspace(*s))
+		s++;
+
+	if (*s == '*') {
+		step->type = PATH_ANY;
+		s++;
+	} else if (*s == '"') {
+		step->type = PATH_NAME;
+		step->name = *strbuf;
+		s = path_parse_string(s + 1, strbuf);
+		if (!s)
+			return NULL;
+		step->namelen = strlen(step->name);
+	} else if (isdigit(*s)) {
+		val = strtol(s, &end, 10);
+		if (val > INT_MAX)
+			return NULL;
+		step->type = PATH_INDEX;
+		step->index = val;
+		s = end;
+	} else {
+		s = path_parse_filter(step, s, strbuf);
+		if (!s)
+			return NULL;
+	}
+
+	while (isspace(*s))
+		s++;
+
+	if (*s != ']')
+		return NULL;
+
+	return s + 1;
+}
+
+struct blobmsg_path *
+blobmsg_path_compile(const char *path)
+{
+	struct blobmsg_path *p;
+	struct path_step *step;
+	const char *s;
+	char *strbuf, *str;
+	int n_steps = 1;
+	size_t len = strlen(path);
+
+	for (s = path; *s; s++)
+		if (*s == '.' || *s == '[')
+			n_steps++;
+
+	/* steps first, the path copy and unescaped strings behind them */
+	p = calloc(1, sizeof(*p) + n_steps * sizeof(*step) + 2 * (len + 1));
+	if (!p)
+		return NULL;
+
+	str = (char *) &p->steps[n_steps];
+	strcpy(str, path);
+	strbuf = str + len + 1;
+
+	s = str;
+	while (*s) {
+		step = &p->steps[p->n_steps];
+
+		if (*s == '[') {
+			s = path_parse_bracket(step, s + 1, &strbuf);
+			if (!s)
+				goto error;
+		} else {
+			if (*s == '.' && s > str)
+				s++;
+
+			step->name = s;
+			while (*s && *s != '.' && *s != '[')
+				s++;
+
+			step->namelen = s - step->name;
+			if (!step->namelen)
+				goto error;
+
+			if (step->namelen == 1 && *step->name == '*')
+				step->type = PATH_ANY;
+			else
+				step->type = PATH_NAME;
+		}
+
+		p->n_steps++;
+		if (*s && *s != '.' && *s != '[')
+			goto error;
+	}
+
+	return p;
+
+error:
+	free(p);
+	return NULL;
+}
+
+void blobmsg_path_free(struct blobmsg_path *p)
+{
+	free(p);
+}
+
+static bool
+path_is_container(struct blob_attr *attr)
+{
+	int type = blobmsg_type(attr);
+
+	return type == BLOBMSG_TYPE_TABLE || type == BLOBMSG_TYPE_ARRAY;
+}
+
+static bool
+path_name_match(struct blob_attr *attr, const char *name, unsigned int namelen)
+{
+	struct blobmsg_hdr *hdr = blob_data(attr);
+
+	if (!blob_is_extended(attr) ||
+	    blob_len(attr) < sizeof(struct blobmsg_hdr) + namelen)
+		return false;
+
+	return be16_to_cpu(hdr->namelen) == namelen &&
+	       !memcmp(hdr->name, name, namelen);
+}
+
+static struct blob_attr *
+path_find(struct blob_attr *attr, const char *name, unsigned int namelen)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	if (blobmsg_type(attr) != BLOBMSG_TYPE_TABLE)
+		return NULL;
+
+	blobmsg_for_each_attr(cur, attr, rem)
+		if (path_name_match(cur, name, namelen))
+			return cur;
+
+	return NULL;
+}
+
+static bool
+path_get_num(struct blob_attr *attr, int64_t *val)
+{
+	if (!blobmsg_check_attr(attr, false))
+		return false;
+
+	switch (blobmsg_type(attr)) {
+	case BLOBMSG_TYPE_INT8:
+		*val = (int8_t) blobmsg_get_u8(attr);
+		break;
+	case BLOBMSG_TYPE_INT16:
+		*val = (int16_t) blobmsg_get_u16(attr);
+		break;
+	case BLOBMSG_TYPE_INT32:
+		*val = (int32_t) blobmsg_get_u32(attr);
+		break;
+	case BLOBMSG_TYPE_INT64:
+		*val = (int64_t) blobmsg_get_u64(attr);
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+path_filter(const struct path_step *step, struct blob_attr *attr)
+{
+	struct blob_attr *val;
+	int64_t num;
+	int cmp;
+
+	val = path_find(attr, step->name, step->namelen);
+	if (!val)
+		return false;
+
+	if (step->str) {
+		if (blobmsg_type(val) != BLOBMSG_TYPE_STRING ||
+		    !blobmsg_check_attr(val, false))
+			return false;
+		cmp = strcmp(blobmsg_get_string(val), step->str);
+	} else {
+		if (!path_get_num(val, &num))
+			return false;
+		cmp = (num > step->num) - (num < step->num);
+	}
+
+	switch (step->op) {
+	case PATH_OP_EQ:
+		return cmp == 0;
+	case PATH_OP_NE:
+		return cmp != 0;
+	case PATH_OP_LT:
+		return cmp < 0;
+	case PATH_OP_LE:
+		return cmp <= 0;
+	case PATH_OP_GT:
+		return cmp > 0;
+	case PATH_OP_GE:
+		return cmp >= 0;
+	}
+
+	return false;
+}
+
+static int
+path_eval(const struct path_step *step, const struct path_step *end,
+	  struct blob_attr *attr, blobmsg_path_cb cb, void *priv)
+{
+	struct blob_attr *cur;
+	int rem, n, ret;
+
+	if (step == end)
+		return cb(attr, priv);
+
+	if (!path_is_container(attr))
+		return 0;
+
+	switch (step->type) {
+	case PATH_NAME:
+		cur = path_find(attr, step->name, step->namelen);
+		if (!cur)
+			return 0;
+		return path_eval(step + 1, end, cur, cb, priv);
+	case PATH_INDEX:
+		n = step->index;
+		blobmsg_for_each_attr(cur, attr, rem)
+			if (!n--)
+				return path_eval(step + 1, end, cur, cb, priv);
+		return 0;
+	case PATH_ANY:
+	case PATH_FILTER:
+		blobmsg_for_each_attr(cur, attr, rem) {
+			if (step->type == PATH_FILTER &&
+			    (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE ||
+			     !path_filter(step, cur)))
+				continue;
+
+			ret = path_eval(step + 1, end, cur, cb, priv);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	return 0;
+}
+
+int blobmsg_path_eval(const struct blobmsg_path *p, struct blob_attr *attr,
+		      blobmsg_path_cb cb, void *priv)
+{
+	if (!attr)
+		return 0;
+
+	return path_eval(p->steps, p->steps + p->n_steps, attr, cb, priv);
+}
+
+static int
+path_match_cb(struct blob_attr *attr, void *priv)
+{
+	struct path_match *m = priv;
+
+	if (m->count < m->max)
+		m->res[m->count] = attr;
+	m->count++;
+
+	return 0;
+}
+
+int blobmsg_path_match(const struct blobmsg_path *p, struct blob_attr *attr,
+		       struct blob_attr **res, int max)
+{
+	struct path_match m = {
+		.res = res,
+		.max = max,
+	};
+
+	blobmsg_path_eval(p, attr, path_match_cb, &m);
+	return m.count;
+}
+
+static int
+path_first_cb(struct blob_attr *attr, void *priv)
+{
+	struct blob_attr **res = priv;
+
+	*res = attr;
+	return 1;
+}
+
+struct blob_attr *blobmsg_path_first(const struct blobmsg_path *p,
+				     struct blob_attr *attr)
+{
+	struct blob_attr *res = NULL;
+
+	blobmsg_path_eval(p, attr, path_first_cb, &res);
+	return res;
+}
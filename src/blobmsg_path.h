@@ -0,0 +1,58 @@
+/*
+ * blobmsg_path - path queries over blobmsg trees
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef __BLOBMSG_PATH_H__
+#define __BLOBMSG_PATH_H__
+
+#include "libubox/blobmsg.h"
+
+/*
+ * path syntax, evaluated left to right starting at the given attribute:
+ *
+ *   name         member of a table (the first one if names repeat)
+ *   ["name"]     same, for names containing '.' or '['
+ *   *  or  [*]   every element of an array or table
+ *   [n]          n-th element of an array or table
+ *   [key OP v]   every element that is a table whose member key compares
+ *                to v; OP is one of == != < <= > >=, v is an integer,
+ *                true/false or a "quoted string"
+ *
+ * steps are separated by '.', e.g. "interfaces[up==true].stats.rx_bytes"
+ */
+struct blobmsg_path;
+
+typedef int (*blobmsg_path_cb)(struct blob_attr *attr, void *priv);
+
+struct blobmsg_path *blobmsg_path_compile(const char *path);
+void blobmsg_path_free(struct blobmsg_path *p);
+
+/*
+ * blobmsg_path_eval: call cb for every attribute matching the path
+ *
+ * matches are reported in message order. A non-zero return value from cb
+ * stops the evaluation and is passed on to the caller.
+ */
+int blobmsg_path_eval(const struct blobmsg_path *p, struct blob_attr *attr,
+		      blobmsg_path_cb cb, void *priv);
+
+/* store up to max matches in res and return the total number of matches */
+int blobmsg_path_match(const struct blobmsg_path *p, struct blob_attr *attr,
+		       struct blob_attr **res, int max);
+
+/* return the first match or NULL */
+struct blob_attr *blobmsg_path_first(const struct blobmsg_path *p,
+				     struct blob_attr *attr);
+
+#endif
@@ -405,6 +405,63 @@ int va_format(u8 *str, size_t size, const char *fmt, va_list *va)
 	return s - str;
 }
 
+int va_format_sink(format_sink_t *sink, void *priv, const char *fmt,
+		   va_list *va)
+{
+	u8 scratch[FORMAT_BUFF_MAX_SIZE];
+	const u8 *f, *g, *data;
+	u8 *s;
+	int n = 0, len, wr;
+
+	f = g = (const u8 *) fmt;
+
+	while (1) {
+		if (*f && *f != '%') {
+			f++;
+			continue;
+		}
+
+		/* flush pending literal text straight from the format string */
+		if (f > g) {
+			len = f - g;
+			wr = sink(priv, g, len);
+			if (wr > 0)
+				n += wr;
+			if (wr < len)
+				break;
+		}
+
+		if (!*f)
+			break;
+
+		if (f[1] == 's') {
+			/* plain %s needs no justification, pass it through */
+			data = va_arg(*va, u8 *);
+			if (!data)
+				data = (const u8 *) "(nil)";
+			len = strlen((const char *) data);
+			f += 2;
+		} else {
+			s = scratch;
+			f = do_percent(&s, scratch + sizeof(scratch), f, va);
+			data = scratch;
+			len = s - scratch;
+		}
+		g = f;
+
+		if (!len)
+			continue;
+
+		wr = sink(priv, data, len);
+		if (wr > 0)
+			n += wr;
+		if (wr < len)
+			break;
+	}
+
+	return n;
+}
+
 int format(u8 *str, size_t size, const char *fmt, ...)
 {
 	int n;
@@ -109,6 +109,22 @@ typedef u8 *(format_function_t) (u8 *s, va_list *args);
 int va_format(u8 *str, size_t size, const char *format, va_list *args);
 int format(u8 *str, size_t size, const char *format, ...);
 
+/*
+ * format_sink_t: output callback for va_format_sink()
+ * returns the number of bytes accepted, formatting stops early when
+ * fewer than len bytes were taken.
+ */
+typedef int (format_sink_t) (void *priv, const u8 *data, size_t len);
+
+/*
+ * va_format_sink: run the format engine without a destination buffer.
+ * literal text and plain %s arguments are handed to the sink in place,
+ * every other conversion is rendered into a FORMAT_BUFF_MAX_SIZE stack
+ * scratch area first. returns the number of bytes accepted by the sink.
+ */
+int va_format_sink(format_sink_t *sink, void *priv, const char *format,
+		   va_list *args);
+
 #include <stdio.h>
 
 size_t va_fformat(FILE *f, char *fmt, va_list *va);
@@ -19,8 +19,10 @@
 #include <errno.h>
 #include <ctype.h>
 #include "json.h"
+#include "blob.h"
 #include "ulog.h"
 #include "printbuf.h"
+#include "ustream.h"
 
 static int sscanf_is_broken = 0;
 static int sscanf_is_broken_testdone = 0;
@@ -75,7 +77,30 @@ static struct json *json_new_item(void)
 	return node;
 }
 
-/* Delete a struct json structure. */
+/* Parser allocations, from the arena if there is one. */
+static void *json_parse_alloc(struct blob_arena *arena, size_t size)
+{
+	if (arena)
+		return blob_arena_alloc(arena, size);
+	return json_malloc(size);
+}
+
+static struct json *json_parse_new_item(struct blob_arena *arena)
+{
+	struct json *node;
+
+	if (!arena)
+		return json_new_item();
+
+	node = (struct json *) blob_arena_alloc(arena, sizeof(struct json));
+	if (node) {
+		memset(node, 0, sizeof(*node));
+		node->flags = JSON_F_ARENA;
+	}
+	return node;
+}
+
+/* Delete a struct json structure. Arena parts are left to blob_arena_free(). */
 void json_delete(struct json *c)
 {
 	struct json *next;
@@ -83,13 +108,17 @@ void json_delete(struct json *c)
 		next = c->next;
 		if (!(c->type & JSON_T_IS_REFERENCE) && c->child)
 			json_delete(c->child);
-		if (!(c->type & JSON_T_IS_REFERENCE) && c->valuestring)
+		if (!(c->type & JSON_T_IS_REFERENCE) && c->valuestring &&
+		    !(c->flags & JSON_F_ARENA_VALUE))
 			json_free(c->valuestring);
-		if (c->string)
+		if (c->string && !(c->flags & JSON_F_ARENA_NAME))
 			json_free(c->string);
 		if (c->print_out)
 			json_free(c->print_out);
-		json_free(c);
+		if (c->index)
+			json_free(c->index);
+		if (!(c->flags & JSON_F_ARENA_NODE))
+			json_free(c);
 		c = next;
 	}
 }
@@ -163,34 +192,11 @@ int json_type_is_double(struct json *item)
 	return 1;
 }
 
-/* Render the number nicely from the given item into a string. */
-static char *print_number(struct json *item)
-{
-	char *str;
-	double d = item->valuedouble;
-	if (fabs(((double)item->valueint) - d) <= DBL_EPSILON && d <= LLONG_MAX
-	    && d >= LLONG_MIN) {
-		str = (char *)json_malloc(21);	/* 2^64+1 can be represented in 21 chars. */
-		if (str)
-			sprintf(str, "%"PRId64, item->valueint);
-	} else {
-		str = (char *)json_malloc(64);	/* This is a nice tradeoff. */
-		if (str) {
-			if (fabs(floor(d) - d) <= DBL_EPSILON)
-				sprintf(str, "%.0f", d);
-			else if (fabs(d) < 1.0e-6 || fabs(d) > 1.0e9)
-				sprintf(str, "%e", d);
-			else
-				sprintf(str, "%f", d);
-		}
-	}
-	return str;
-}
-
 /* Parse the input text into an unescaped cstring, and populate item. */
 static const unsigned char firstByteMark[7] =
     { 0x00, 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
-static char **parse_string(struct json *item, char **str)
+static char **parse_string(struct json *item, char **str,
+			   struct blob_arena *arena)
 {
 	char *ptr = *str + 1;
 	char *ptr2;
@@ -204,7 +210,7 @@ static char **parse_string(struct json *item, char **str)
 		if (*ptr++ == '\\')
 			ptr++;	/* Skip escaped quotes. */
 
-	out = (char *)json_malloc(len + 1);	/* This is how long we need for the string, roughly. */
+	out = (char *)json_parse_alloc(arena, len + 1);	/* This is how long we need for the string, roughly. */
 	if (!out)
 		return 0;
 
@@ -290,84 +296,13 @@ static char **parse_string(struct json *item, char **str)
 	return str;
 }
 
-/* Render the cstring provided to an escaped version that can be printed. */
-static char *print_string_ptr(const char *str)
-{
-	const char *ptr;
-	char *ptr2, *out;
-	int len = 0;
-	unsigned char token;
-
-	if (!str)
-		return json_strdup("");
-	ptr = str;
-	while ((token = *ptr) && ++len) {
-		if (strchr("\"\\\b\f\n\r\t", token))
-			len++;
-		else if (token < 32)
-			len += 5;
-		ptr++;
-	}
-
-	out = (char *)json_malloc(len + 3);
-	if (!out)
-		return 0;
-
-	ptr2 = out;
-	ptr = str;
-	*ptr2++ = '\"';
-	while (*ptr) {
-		if ((unsigned char)*ptr > 31 && *ptr != '\"' && *ptr != '\\')
-			*ptr2++ = *ptr++;
-		else {
-			*ptr2++ = '\\';
-			switch (token = *ptr++) {
-			case '\\':
-				*ptr2++ = '\\';
-				break;
-			case '\"':
-				*ptr2++ = '\"';
-				break;
-			case '\b':
-				*ptr2++ = 'b';
-				break;
-			case '\f':
-				*ptr2++ = 'f';
-				break;
-			case '\n':
-				*ptr2++ = 'n';
-				break;
-			case '\r':
-				*ptr2++ = 'r';
-				break;
-			case '\t':
-				*ptr2++ = 't';
-				break;
-			default:
-				sprintf(ptr2, "u%04x", token);
-				ptr2 += 5;
-				break;	/* escape and print */
-			}
-		}
-	}
-	*ptr2++ = '\"';
-	*ptr2++ = 0;
-	return out;
-}
-
-/* Invote print_string_ptr (which is useful) on an item. */
-static char *print_string(struct json *item)
-{
-	return print_string_ptr(item->valuestring);
-}
-
 /* Predeclare these prototypes. */
-static char **parse_value(struct json *item, char **value);
-static char *print_value(struct json *item, int depth, int fmt);
-static char **parse_array(struct json *item, char **value);
-static char *print_array(struct json *item, int depth, int fmt);
-static char **parse_object(struct json *item, char **value);
-static char *print_object(struct json *item, int depth, int fmt);
+static char **parse_value(struct json *item, char **value,
+			  struct blob_arena *arena);
+static char **parse_array(struct json *item, char **value,
+			  struct blob_arena *arena);
+static char **parse_object(struct json *item, char **value,
+			   struct blob_arena *arena);
 
 /* Utility to jump whitespace and cr/lf */
 static inline char **skip(char **in)
@@ -378,55 +313,51 @@ static inline char **skip(char **in)
 	return in;
 }
 
-/* Parse an object - create a new root, and populate. */
-struct json *json_parse(const char *value)
+static struct json *json_parse_root(const char *value, char **end_ptr,
+				    struct blob_arena *arena)
 {
-	struct json *c = json_new_item();
+	struct json *c = json_parse_new_item(arena);
 	if (!c)
 		return 0;	/* memory fail */
 
-	char **end_ptr = (char **)&value;
+	*end_ptr = (char *)value;
 
-	if (!parse_value(c, skip(end_ptr))) {
+	if (!parse_value(c, skip(end_ptr), arena)) {
 		json_delete(c);
 		return 0;
 	}
 	return c;
 }
 
-/* Parse an object - create a new root, and populate
- *  Also indicates where in the stream the Object ends. */
-struct json *json_parse_stream(const char *value, char **end_ptr)
+/* Parse an object - create a new root, and populate. */
+struct json *json_parse(const char *value)
 {
-	if (!end_ptr)
-		return NULL;
-	struct json *c = json_new_item();
-	if (!c)
-		return 0;	/* memory fail */
-
-	*end_ptr = (char *)value;
+	char *end;
 
-	if (!parse_value(c, skip(end_ptr))) {
-		json_delete(c);
-		return 0;
-	}
-	return c;
+	return json_parse_root(value, &end, NULL);
 }
 
-/* Render a struct json item/entity/structure to text. */
-char *json_to_string(struct json *item)
+struct json *json_parse_arena(const char *value, struct blob_arena *arena)
 {
-	return print_value(item, 0, 1);
+	char *end;
+
+	return json_parse_root(value, &end, arena);
 }
 
-char *json_to_string_unformatted(struct json *item)
+/* Parse an object - create a new root, and populate
+ *  Also indicates where in the stream the Object ends. */
+struct json *json_parse_stream(const char *value, char **end_ptr)
 {
-	return print_value(item, 0, 0);
+	if (!end_ptr)
+		return NULL;
+
+	return json_parse_root(value, end_ptr, NULL);
 }
 
 static int stream_cmp(char **stream, const char *str)
 {
-	while (**stream == *str) {
+	/* stop at the end of str, a literal can end the input */
+	while (*str && **stream == *str) {
 		(*stream)++;
 		str++;
 	}
@@ -436,7 +367,8 @@ static int stream_cmp(char **stream, const char *str)
 }
 
 /* Parser core - when encountering text, process appropriately. */
-static char **parse_value(struct json *item, char **value)
+static char **parse_value(struct json *item, char **value,
+			  struct blob_arena *arena)
 {
 	if (!stream_cmp(value, "null")) {
 		item->type = JSON_T_NULL;
@@ -452,320 +384,995 @@ static char **parse_value(struct json *item, char **value)
 
 	switch (**value) {
 	case '"':
-		return parse_string(item, value);
+		return parse_string(item, value, arena);
 	case '-':
 	case '0' ... '9':
 		return parse_number(item, value);
 	case '[':
-		return parse_array(item, value);
+		return parse_array(item, value, arena);
 	case '{':
-		return parse_object(item, value);
+		return parse_object(item, value, arena);
 	}
 
 	return NULL;		/* failure */
 }
 
-/* Render a value to text. */
-static char *print_value(struct json *item, int depth, int fmt)
+/* Build an array from input text. */
+static char **parse_array(struct json *item, char **value,
+			  struct blob_arena *arena)
+{
+	struct json *child;
+	if (**value != '[')	/* not an array! */
+		return NULL;
+
+	item->type = JSON_T_ARRAY;
+	(*value)++;
+	skip(value);
+	if (**value == ']') {
+		(*value)++;
+		return value;	/* empty array. */
+	}
+
+	item->child = child = json_parse_new_item(arena);
+	if (!item->child)
+		return 0;	/* memory fail */
+	if (!skip(parse_value(child, value, arena)))	/* skip any spacing, get the value. */
+		return NULL;
+
+	while (**value == ',') {
+		(*value)++;
+		skip(value);
+		if (**value == ']') {
+			(*value)++;
+			break;
+		}
+
+		struct json *new_item;
+		if (!(new_item = json_parse_new_item(arena)))
+			return 0;	/* memory fail */
+		child->next = new_item;
+		new_item->prev = child;
+		child = new_item;
+		if (!skip(parse_value(child, value, arena)))
+			return 0;	/* memory fail */
+	}
+
+	if (**value != ']')
+		return NULL;
+	(*value)++;
+
+	return value;
+}
+
+/* Build an object from the text. */
+static char **parse_object(struct json *item, char **value,
+			   struct blob_arena *arena)
+{
+	struct json *child;
+	if (**value != '{')
+		return NULL;	/* not an object! */
+
+	item->type = JSON_T_OBJECT;
+	(*value)++;
+	skip(value);
+	if (**value == '}') {
+		(*value)++;
+		return value;	/* empty object. */
+	}
+
+	item->child = child = json_parse_new_item(arena);
+	if (!item->child)
+		return 0;
+	if (!skip(parse_string(child, value, arena)))
+		return 0;
+	child->string = child->valuestring;
+	child->valuestring = 0;
+	if (**value != ':')
+		return NULL;	/* fail! */
+	(*value)++;
+	if (!skip(parse_value(child, skip(value), arena)))	/* skip any spacing, get the value. */
+		return 0;
+
+	while (**value == ',') {
+		(*value)++;
+		skip(value);
+
+		if (**value == '}') {
+			(*value)++;
+			break;
+		}
+
+		struct json *new_item;
+		if (!(new_item = json_parse_new_item(arena)))
+			return 0;	/* memory fail */
+		child->next = new_item;
+		new_item->prev = child;
+		child = new_item;
+		if (!skip(parse_string(child, value, arena)))
+			return 0;
+		child->string = child->valuestring;
+		child->valuestring = 0;
+		if (**value != ':')
+			return NULL;	/* fail! */
+		(*value)++;
+		if (!skip(parse_value(child, skip(value), arena)))	/* skip any spacing, get the value. */
+			return 0;
+	}
+
+	if (**value != '}')
+		return NULL;
+	(*value)++;
+
+	return value;
+}
+
+/*
+ * Incremental parser: a state machine over the input bytes with an explicit
+ * stack of open containers, so that a document arriving in pieces is
+ * scanned once. Strings and numbers are collected in tok and then handed to
+ * parse_string() and parse_number(), which keeps the results identical to
+ * json_parse().
+ */
+enum {
+	JSON_P_VALUE,
+	JSON_P_VALUE_OR_CLOSE,	/* right after '[' */
+	JSON_P_KEY,
+	JSON_P_KEY_OR_CLOSE,	/* right after '{' */
+	JSON_P_COLON,
+	JSON_P_AFTER,		/* after a container member */
+	JSON_P_STRING,
+	JSON_P_KEY_STRING,
+	JSON_P_NUMBER,
+	JSON_P_LITERAL,
+};
+
+struct json_parser_frame {
+	struct json *item;
+	struct json *last;
+};
+
+void json_parser_init(struct json_parser *p, struct blob_arena *arena)
+{
+	memset(p, 0, sizeof(*p));
+	p->arena = arena;
+	p->max_depth = JSON_PARSER_MAX_DEPTH;
+}
+
+static int json_parser_fail(struct json_parser *p)
+{
+	p->status = JSON_PARSE_ERROR;
+	return 0;
+}
+
+static int json_parser_append(struct json_parser *p, const char *data, int len)
+{
+	char *tok;
+	int size;
+
+	if (p->tok_len + len >= p->tok_size) {
+		size = p->tok_size ? p->tok_size * 2 : 64;
+		while (p->tok_len + len >= size)
+			size *= 2;
+
+		/* there is no realloc hook */
+		tok = (char *)json_malloc(size);
+		if (!tok)
+			return json_parser_fail(p);
+		if (p->tok) {
+			memcpy(tok, p->tok, p->tok_len);
+			json_free(p->tok);
+		}
+		p->tok = tok;
+		p->tok_size = size;
+	}
+
+	memcpy(p->tok + p->tok_len, data, len);
+	p->tok_len += len;
+	p->tok[p->tok_len] = 0;
+	return 1;
+}
+
+static int json_parser_push(struct json_parser *p, struct json *item)
+{
+	struct json_parser_frame *stack;
+	int size;
+
+	/* json_delete() recurses, keep untrusted input from going deep */
+	if (p->depth >= p->max_depth)
+		return json_parser_fail(p);
+
+	if (p->depth == p->stack_size) {
+		size = p->stack_size ? p->stack_size * 2 : 16;
+		stack = (struct json_parser_frame *)
+			json_malloc(size * sizeof(*stack));
+		if (!stack)
+			return json_parser_fail(p);
+		if (p->stack) {
+			memcpy(stack, p->stack, p->depth * sizeof(*stack));
+			json_free(p->stack);
+		}
+		p->stack = stack;
+		p->stack_size = size;
+	}
+
+	p->stack[p->depth].item = item;
+	p->stack[p->depth].last = 0;
+	p->depth++;
+	return 1;
+}
+
+/* Create a member of the innermost container, in member order. */
+static struct json *json_parser_add(struct json_parser *p)
+{
+	struct json_parser_frame *top = &p->stack[p->depth - 1];
+	struct json *item = json_parse_new_item(p->arena);
+
+	if (!item) {
+		json_parser_fail(p);
+		return 0;
+	}
+
+	if (top->last) {
+		top->last->next = item;
+		item->prev = top->last;
+	} else {
+		top->item->child = item;
+	}
+	top->last = item;
+	return item;
+}
+
+/* A value is complete: the document is done, or its container goes on. */
+static void json_parser_value_end(struct json_parser *p)
+{
+	if (!p->depth)
+		p->status = JSON_PARSE_DONE;
+	else
+		p->state = JSON_P_AFTER;
+}
+
+static int json_parser_close(struct json_parser *p, char c)
+{
+	int type = p->stack[p->depth - 1].item->type;
+
+	if (c != (type == JSON_T_ARRAY ? ']' : '}'))
+		return json_parser_fail(p);
+
+	p->depth--;
+	json_parser_value_end(p);
+	return 1;
+}
+
+static int json_parser_value(struct json_parser *p, char c)
 {
-	char *out = NULL;
+	struct json *item;
+
+	switch (c) {
+	case '{':
+	case '[':
+	case '"':
+	case '-':
+	case '0' ... '9':
+	case 't':
+	case 'f':
+	case 'n':
+		break;
+	default:
+		return json_parser_fail(p);
+	}
+
+	if (!p->depth)
+		item = p->root = json_parse_new_item(p->arena);
+	else if (p->stack[p->depth - 1].item->type == JSON_T_ARRAY)
+		item = json_parser_add(p);
+	else
+		item = p->cur;	/* created with its name */
 	if (!item)
+		return json_parser_fail(p);
+
+	p->cur = item;
+	p->tok_len = 0;
+	switch (c) {
+	case '{':
+		item->type = JSON_T_OBJECT;
+		p->state = JSON_P_KEY_OR_CLOSE;
+		return json_parser_push(p, item);
+	case '[':
+		item->type = JSON_T_ARRAY;
+		p->state = JSON_P_VALUE_OR_CLOSE;
+		return json_parser_push(p, item);
+	case '"':
+		p->state = JSON_P_STRING;
+		p->esc = 0;
+		break;
+	case 't':
+		p->literal = "true";
+		p->state = JSON_P_LITERAL;
+		break;
+	case 'f':
+		p->literal = "false";
+		p->state = JSON_P_LITERAL;
+		break;
+	case 'n':
+		p->literal = "null";
+		p->state = JSON_P_LITERAL;
+		break;
+	default:
+		p->state = JSON_P_NUMBER;
+		break;
+	}
+
+	return json_parser_append(p, &c, 1);
+}
+
+static int json_parser_key(struct json_parser *p)
+{
+	p->cur = json_parser_add(p);
+	if (!p->cur)
 		return 0;
 
-	if (fmt == item->print_fmt && item->print_out)
-		return item->print_out;
+	p->tok_len = 0;
+	p->esc = 0;
+	p->state = JSON_P_KEY_STRING;
+	return json_parser_append(p, "\"", 1);
+}
+
+static int json_parser_string_end(struct json_parser *p)
+{
+	struct json *item = p->cur;
+	char *ptr = p->tok;
+
+	if (!json_parser_append(p, "\"", 1) ||
+	    !parse_string(item, &ptr, p->arena))
+		return json_parser_fail(p);
+
+	if (p->state == JSON_P_KEY_STRING) {
+		item->string = item->valuestring;
+		item->valuestring = 0;
+		item->type = 0;
+		p->state = JSON_P_COLON;
+	} else {
+		json_parser_value_end(p);
+	}
+	return 1;
+}
+
+static const char *json_parser_string(struct json_parser *p, const char *s,
+				      const char *end)
+{
+	size_t n;
+
+	while (s < end) {
+		if (p->esc) {
+			p->esc = 0;
+			if (!*s)
+				break;
+		} else {
+			/* copy the runs without quotes and escapes in one go */
+			n = json_escape_span(s, end - s, 0);
+			if (!json_parser_append(p, s, n))
+				return s;
+			s += n;
+			if (s == end)
+				break;
+
+			if (*s == '"') {
+				json_parser_string_end(p);
+				return s + 1;
+			}
+			if (*s == '\\')
+				p->esc = 1;
+			else if (!*s)
+				break;
+		}
+
+		if (!json_parser_append(p, s, 1))
+			return s;
+		s++;
+	}
+
+	if (s < end)
+		json_parser_fail(p);
+	return s;
+}
+
+static const char *json_parser_number(struct json_parser *p, const char *s,
+				      const char *end)
+{
+	const char *start = s;
+	char *ptr;
+
+	while (s < end && ((*s >= '0' && *s <= '9') || *s == '.' ||
+			   *s == 'e' || *s == 'E' || *s == '+' || *s == '-'))
+		s++;
+
+	if (!json_parser_append(p, start, s - start) || s == end)
+		return s;
+
+	/* only complete once the byte after it has arrived */
+	ptr = p->tok;
+	parse_number(p->cur, &ptr);
+	if (*ptr)
+		json_parser_fail(p);
+	else
+		json_parser_value_end(p);
+	return s;
+}
+
+static int json_parser_literal(struct json_parser *p, char c)
+{
+	if (c != p->literal[p->tok_len++])
+		return json_parser_fail(p);
+
+	if (p->literal[p->tok_len])
+		return 1;
+
+	switch (p->literal[0]) {
+	case 't':
+		p->cur->type = JSON_T_TRUE;
+		p->cur->valueint = 1;
+		break;
+	case 'f':
+		p->cur->type = JSON_T_FALSE;
+		break;
+	default:
+		p->cur->type = JSON_T_NULL;
+		break;
+	}
+
+	json_parser_value_end(p);
+	return 1;
+}
+
+enum json_parse_status json_parser_feed(struct json_parser *p,
+					const char *data, size_t len,
+					size_t *used)
+{
+	const char *s = data, *end = data + len;
+	char c;
+
+	while (s < end && p->status == JSON_PARSE_MORE) {
+		switch (p->state) {
+		case JSON_P_STRING:
+		case JSON_P_KEY_STRING:
+			s = json_parser_string(p, s, end);
+			continue;
+		case JSON_P_NUMBER:
+			s = json_parser_number(p, s, end);
+			continue;
+		case JSON_P_LITERAL:
+			if (json_parser_literal(p, *s))
+				s++;
+			continue;
+		}
+
+		c = *s;
+		if (isspace((unsigned char)c)) {
+			s++;
+			continue;
+		}
+
+		switch (p->state) {
+		case JSON_P_VALUE:
+			json_parser_value(p, c);
+			break;
+		case JSON_P_VALUE_OR_CLOSE:
+			if (c == ']')
+				json_parser_close(p, c);
+			else
+				json_parser_value(p, c);
+			break;
+		case JSON_P_KEY_OR_CLOSE:
+			if (c == '}') {
+				json_parser_close(p, c);
+				break;
+			}
+			/* fall through */
+		case JSON_P_KEY:
+			if (c == '"')
+				json_parser_key(p);
+			else
+				json_parser_fail(p);
+			break;
+		case JSON_P_COLON:
+			if (c == ':')
+				p->state = JSON_P_VALUE;
+			else
+				json_parser_fail(p);
+			break;
+		case JSON_P_AFTER:
+			if (c != ',')
+				json_parser_close(p, c);
+			else if (p->stack[p->depth - 1].item->type == JSON_T_ARRAY)
+				p->state = JSON_P_VALUE;
+			else
+				p->state = JSON_P_KEY;
+			break;
+		}
+
+		if (p->status != JSON_PARSE_ERROR)
+			s++;
+	}
+
+	if (used)
+		*used = s - data;
+	return p->status;
+}
+
+struct json *json_parser_result(struct json_parser *p)
+{
+	struct json *root = p->root;
+
+	if (p->status != JSON_PARSE_DONE)
+		return 0;
+
+	p->root = 0;
+	json_parser_reset(p);
+	return root;
+}
+
+void json_parser_reset(struct json_parser *p)
+{
+	json_delete(p->root);
+	p->root = p->cur = 0;
+	p->status = JSON_PARSE_MORE;
+	p->state = JSON_P_VALUE;
+	p->depth = 0;
+	p->tok_len = 0;
+}
+
+void json_parser_free(struct json_parser *p)
+{
+	int max_depth = p->max_depth;
+
+	json_parser_reset(p);
+	if (p->stack)
+		json_free(p->stack);
+	if (p->tok)
+		json_free(p->tok);
+	json_parser_init(p, p->arena);
+	p->max_depth = max_depth;
+}
+
+/*
+ * Printer output: text is written once, front to back, into buf. Without a
+ * sink buf grows as needed (json_malloc, or the caller's printbuf pb), with
+ * a sink it is a staging buffer that is flushed whenever it fills up.
+ */
+#define JSON_PRINT_BUF_INIT	256
+#define JSON_PRINT_SINK_BUF	4096
+
+typedef int (*json_sink_t)(void *priv, const char *data, int len);
+
+struct json_out {
+	char *buf;
+	int pos;
+	int len;
+
+	struct printbuf *pb;
+	json_sink_t sink;
+	void *sink_priv;
+	int written;
+	int error;
+};
+
+static int json_out_init(struct json_out *o, int len)
+{
+	memset(o, 0, sizeof(*o));
+	o->buf = (char *)json_malloc(len);
+	if (!o->buf)
+		return 0;
+	o->len = len;
+	return 1;
+}
+
+static int json_out_fail(struct json_out *o)
+{
+	/* makes every further json_out_put() take the slow path */
+	o->error = 1;
+	o->len = 0;
+	return 0;
+}
+
+static int json_sink_write(struct json_out *o, const char *data, int len)
+{
+	int wr = o->sink(o->sink_priv, data, len);
+
+	if (wr > 0)
+		o->written += wr;
+	if (wr < len)
+		return json_out_fail(o);
+
+	return 1;
+}
+
+static int json_out_flush(struct json_out *o)
+{
+	int len = o->pos;
+
+	o->pos = 0;
+	return !len || json_sink_write(o, o->buf, len);
+}
+
+static int __json_out_put(struct json_out *o, const char *data, int len)
+{
+	char *buf;
+	int new_len;
+
+	if (o->error)
+		return 0;
+
+	if (o->sink) {
+		if (!json_out_flush(o))
+			return 0;
+
+		/* does not fit the staging buffer, pass it through */
+		if (len >= o->len)
+			return json_sink_write(o, data, len);
+	} else if (o->pb) {
+		o->pb->bpos = o->pos;
+		if (printbuf_memappend(o->pb, data, len) < 0)
+			return json_out_fail(o);
+
+		o->buf = o->pb->buf;
+		o->pos = o->pb->bpos;
+		o->len = o->pb->size;
+		return 1;
+	} else {
+		new_len = o->len * 2;
+		while (o->pos + len >= new_len)
+			new_len *= 2;
+
+		/* there is no realloc hook */
+		buf = (char *)json_malloc(new_len);
+		if (!buf)
+			return json_out_fail(o);
+		memcpy(buf, o->buf, o->pos);
+		json_free(o->buf);
+		o->buf = buf;
+		o->len = new_len;
+	}
+
+	memcpy(o->buf + o->pos, data, len);
+	o->pos += len;
+	return 1;
+}
+
+static inline int json_out_put(struct json_out *o, const char *data, int len)
+{
+	/* always leaves room for the terminating 0 */
+	if (o->pos + len >= o->len)
+		return __json_out_put(o, data, len);
+
+	memcpy(o->buf + o->pos, data, len);
+	o->pos += len;
+	return 1;
+}
+
+static void print_indent(struct json_out *o, int depth)
+{
+	static const char tabs[16] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+	int n;
+
+	for (; depth > 0; depth -= n) {
+		n = depth < sizeof(tabs) ? depth : sizeof(tabs);
+		json_out_put(o, tabs, n);
+	}
+}
+
+/* Render the number nicely from the given item. */
+static int print_number(struct json *item, struct json_out *o)
+{
+	char str[512];		/* %.0f of DBL_MAX is 309 digits */
+	double d = item->valuedouble;
+	int len;
+
+	if (fabs(((double)item->valueint) - d) <= DBL_EPSILON && d <= LLONG_MAX
+	    && d >= LLONG_MIN)
+		len = snprintf(str, sizeof(str), "%"PRId64, item->valueint);
+	else if (fabs(floor(d) - d) <= DBL_EPSILON)
+		len = snprintf(str, sizeof(str), "%.0f", d);
+	else if (fabs(d) < 1.0e-6 || fabs(d) > 1.0e9)
+		len = snprintf(str, sizeof(str), "%e", d);
+	else
+		len = snprintf(str, sizeof(str), "%f", d);
+
+	if (len >= sizeof(str))
+		len = sizeof(str) - 1;
+	return json_out_put(o, str, len);
+}
+
+/* Render the cstring provided as an escaped string literal. */
+static int print_string_ptr(const char *str, struct json_out *o)
+{
+	const char *end, *esc;
+	char buf[8];
+	size_t n;
+	int len;
+
+	if (!str)
+		str = "";
+
+	end = str + strlen(str);
+	json_out_put(o, "\"", 1);
+	while (1) {
+		/* copy the runs that need no escaping in one go */
+		n = json_escape_span(str, end - str, 0);
+		json_out_put(o, str, n);
+		str += n;
+		if (str == end)
+			break;
+
+		len = 2;
+		switch (*str) {
+		case '\\':
+			esc = "\\\\";
+			break;
+		case '\"':
+			esc = "\\\"";
+			break;
+		case '\b':
+			esc = "\\b";
+			break;
+		case '\f':
+			esc = "\\f";
+			break;
+		case '\n':
+			esc = "\\n";
+			break;
+		case '\r':
+			esc = "\\r";
+			break;
+		case '\t':
+			esc = "\\t";
+			break;
+		default:
+			len = snprintf(buf, sizeof(buf), "\\u%04x",
+				       (unsigned char)*str);
+			esc = buf;
+			break;
+		}
+		json_out_put(o, esc, len);
+		str++;
+	}
 
+	return json_out_put(o, "\"", 1);
+}
+
+/* Predeclare these prototypes. */
+static int print_value(struct json *item, int depth, int fmt,
+		       struct json_out *o);
+static int print_array(struct json *item, int depth, int fmt,
+		       struct json_out *o);
+static int print_object(struct json *item, int depth, int fmt,
+			struct json_out *o);
+
+/* Render an item, ignoring its print cache. */
+static int print_item(struct json *item, int depth, int fmt,
+		      struct json_out *o)
+{
 	switch ((item->type) & 255) {
 	case JSON_T_NULL:
-		out = json_strdup("null");
-		break;
+		return json_out_put(o, "null", 4);
 	case JSON_T_FALSE:
-		out = json_strdup("false");
-		break;
+		return json_out_put(o, "false", 5);
 	case JSON_T_TRUE:
-		out = json_strdup("true");
-		break;
+		return json_out_put(o, "true", 4);
 	case JSON_T_NUMBER:
-		out = print_number(item);
-		break;
+		return print_number(item, o);
 	case JSON_T_STRING:
-		out = print_string(item);
-		break;
+		return print_string_ptr(item->valuestring, o);
 	case JSON_T_ARRAY:
-		out = print_array(item, depth, fmt);
-		break;
+		return print_array(item, depth, fmt, o);
 	case JSON_T_OBJECT:
-		out = print_object(item, depth, fmt);
-		break;
+		return print_object(item, depth, fmt, o);
 	}
 
-	if (item->print_out)
-		json_free(item->print_out);
+	return json_out_fail(o);
+}
+
+/* Render an item into a new json_malloc string. */
+static char *print_string_alloc(struct json *item, int depth, int fmt)
+{
+	struct json_out o;
+
+	if (!json_out_init(&o, JSON_PRINT_BUF_INIT))
+		return 0;
+
+	if (!print_item(item, depth, fmt, &o) || o.error) {
+		json_free(o.buf);
+		return 0;
+	}
+
+	o.buf[o.pos] = 0;
+	return o.buf;
+}
+
+/* Keep out in item->print_out, it depends on the format and, when
+ * formatted, on the indentation depth. */
+static char *print_store(struct json *item, int depth, int fmt, char *out)
+{
+	if (!out)
+		return 0;
+
+	if (item->print_out)
+		json_free(item->print_out);
+
+	item->print_out = out;
+	item->print_fmt = fmt ? depth + 1 : 0;
+	return out;
+}
+
+static char *print_cached(struct json *item, int depth, int fmt)
+{
+	if (item->print_out && item->print_fmt == (fmt ? depth + 1 : 0))
+		return item->print_out;
+
+	return print_store(item, depth, fmt,
+			   print_string_alloc(item, depth, fmt));
+}
+
+/* Render a value to text. */
+static int print_value(struct json *item, int depth, int fmt,
+		       struct json_out *o)
+{
+	char *out;
+
+	if (!(item->flags & JSON_F_PRINT_CACHE))
+		return print_item(item, depth, fmt, o);
 
-	item->print_out = out;
-	item->print_fmt = fmt;
-	return out;
+	out = print_cached(item, depth, fmt);
+	if (!out)
+		return json_out_fail(o);
+
+	return json_out_put(o, out, strlen(out));
 }
 
-/* Build an array from input text. */
-static char **parse_array(struct json *item, char **value)
+/* Render an array to text */
+static int print_array(struct json *item, int depth, int fmt,
+		       struct json_out *o)
 {
 	struct json *child;
-	if (**value != '[')	/* not an array! */
-		return NULL;
 
-	item->type = JSON_T_ARRAY;
-	(*value)++;
-	skip(value);
-	if (**value == ']') {
-		(*value)++;
-		return value;	/* empty array. */
+	json_out_put(o, "[", 1);
+	for (child = item->child; child; child = child->next) {
+		if (child != item->child)
+			json_out_put(o, ", ", fmt ? 2 : 1);
+		if (!print_value(child, depth + 1, fmt, o))
+			return 0;
 	}
 
-	item->child = child = json_new_item();
-	if (!item->child)
-		return 0;	/* memory fail */
-	if (!skip(parse_value(child, value)))	/* skip any spacing, get the value. */
-		return NULL;
+	return json_out_put(o, "]", 1);
+}
 
-	while (**value == ',') {
-		(*value)++;
-		skip(value);
-		if (**value == ']') {
-			(*value)++;
-			break;
-		}
+/* Render an object to text. */
+static int print_object(struct json *item, int depth, int fmt,
+			struct json_out *o)
+{
+	struct json *child;
 
-		struct json *new_item;
-		if (!(new_item = json_new_item()))
-			return 0;	/* memory fail */
-		child->next = new_item;
-		new_item->prev = child;
-		child = new_item;
-		if (!skip(parse_value(child, value)))
-			return 0;	/* memory fail */
+	depth++;
+	json_out_put(o, "{\n", fmt ? 2 : 1);
+	for (child = item->child; child; child = child->next) {
+		if (fmt)
+			print_indent(o, depth);
+		print_string_ptr(child->string, o);
+		json_out_put(o, ":\t", fmt ? 2 : 1);
+		if (!print_value(child, depth, fmt, o))
+			return 0;
+		if (child->next)
+			json_out_put(o, ",", 1);
+		if (fmt)
+			json_out_put(o, "\n", 1);
 	}
 
-	if (**value != ']')
-		return NULL;
-	(*value)++;
-
-	return value;
+	if (fmt)
+		print_indent(o, depth - 1);
+	return json_out_put(o, "}", 1);
 }
 
-/* Render an array to text */
-static char *print_array(struct json *item, int depth, int fmt)
-{
-	char **entries;
-	char *out = 0, *ptr, *ret;
-	int len = 5;
-	struct json *child = item->child;
-	int numentries = 0, i = 0, fail = 0;
-
-	/* How many entries in the array? */
-	while (child)
-		numentries++, child = child->next;
-	/* Allocate an array to hold the values for each */
-	entries = (char **)json_malloc(numentries * sizeof(char *));
-	if (!entries)
-		return 0;
-	memset(entries, 0, numentries * sizeof(char *));
-	/* Retrieve all the results: */
-	child = item->child;
-	while (child && !fail) {
-		ret = print_value(child, depth + 1, fmt);
-		entries[i++] = ret;
-		if (ret)
-			len += strlen(ret) + 2 + (fmt ? 1 : 0);
-		else
-			fail = 1;
-		child = child->next;
-	}
+static int json_print_sink(struct json *item, int fmt, json_sink_t sink,
+			   void *sink_priv)
+{
+	char buf[JSON_PRINT_SINK_BUF];
+	struct json_out o = {
+		.buf = buf,
+		.len = sizeof(buf),
+		.sink = sink,
+		.sink_priv = sink_priv,
+	};
 
-	/* If we didn't fail, try to malloc the output string */
-	if (!fail)
-		out = (char *)json_malloc(len);
-	/* If that fails, we fail. */
-	if (!out)
-		fail = 1;
+	if (!item)
+		return -1;
 
-	/* Handle failure. */
-	if (fail) {
-		json_free(entries);
-		return 0;
-	}
+	if (print_value(item, 0, fmt, &o))
+		json_out_flush(&o);
 
-	/* Compose the output array. */
-	*out = '[';
-	ptr = out + 1;
-	*ptr = 0;
-	for (i = 0; i < numentries; i++) {
-		strcpy(ptr, entries[i]);
-		ptr += strlen(entries[i]);
-		if (i != numentries - 1) {
-			*ptr++ = ',';
-			if (fmt)
-				*ptr++ = ' ';
-			*ptr = 0;
-		}
-	}
-	json_free(entries);
-	*ptr++ = ']';
-	*ptr++ = 0;
-	return out;
+	return o.error ? -1 : o.written;
 }
 
-/* Build an object from the text. */
-static char **parse_object(struct json *item, char **value)
+/* Render a struct json item/entity/structure to text. */
+static char *json_print_root(struct json *item, int fmt)
 {
-	struct json *child;
-	if (**value != '{')
-		return NULL;	/* not an object! */
-
-	item->type = JSON_T_OBJECT;
-	(*value)++;
-	skip(value);
-	if (**value == '}') {
-		(*value)++;
-		return value;	/* empty object. */
-	}
+	char *out;
 
-	item->child = child = json_new_item();
-	if (!item->child)
-		return 0;
-	if (!skip(parse_string(child, value)))
-		return 0;
-	child->string = child->valuestring;
-	child->valuestring = 0;
-	if (**value != ':')
-		return NULL;	/* fail! */
-	(*value)++;
-	if (!skip(parse_value(child, skip(value))))	/* skip any spacing, get the value. */
+	if (!item)
 		return 0;
 
-	while (**value == ',') {
-		(*value)++;
-		skip(value);
+	if (item->flags & JSON_F_PRINT_CACHE)
+		return print_cached(item, 0, fmt);
 
-		if (**value == '}') {
-			(*value)++;
-			break;
-		}
+	out = print_string_alloc(item, 0, fmt);
+	if (!out)
+		return 0;
 
-		struct json *new_item;
-		if (!(new_item = json_new_item()))
-			return 0;	/* memory fail */
-		child->next = new_item;
-		new_item->prev = child;
-		child = new_item;
-		if (!skip(parse_string(child, value)))
-			return 0;
-		child->string = child->valuestring;
-		child->valuestring = 0;
-		if (**value != ':')
-			return NULL;	/* fail! */
-		(*value)++;
-		if (!skip(parse_value(child, skip(value))))	/* skip any spacing, get the value. */
-			return 0;
+	/*
+	 * keep handing out the same text while the tree does not change. The
+	 * tree is rendered anyway: changes to it are not tracked, fields are
+	 * set directly and a child cannot reach the root to invalidate it.
+	 */
+	if (item->print_out && item->print_fmt == (fmt ? 1 : 0) &&
+	    !strcmp(item->print_out, out)) {
+		json_free(out);
+		return item->print_out;
 	}
 
-	if (**value != '}')
-		return NULL;
-	(*value)++;
+	return print_store(item, 0, fmt, out);
+}
 
-	return value;
+char *json_to_string(struct json *item)
+{
+	return json_print_root(item, 1);
 }
 
-/* Render an object to text. */
-static char *print_object(struct json *item, int depth, int fmt)
-{
-	char **entries = 0, **names = 0;
-	char *out = 0, *ptr, *ret, *str;
-	int len = 7, i = 0, j;
-	struct json *child = item->child;
-	int numentries = 0, fail = 0;
-	/* Count the number of entries. */
-	while (child)
-		numentries++, child = child->next;
-	/* Allocate space for the names and the objects */
-	entries = (char **)json_malloc(numentries * sizeof(char *));
-	if (!entries)
-		return 0;
-	names = (char **)json_malloc(numentries * sizeof(char *));
-	if (!names) {
-		json_free(entries);
-		return 0;
-	}
-	memset(entries, 0, sizeof(char *) * numentries);
-	memset(names, 0, sizeof(char *) * numentries);
+char *json_to_string_unformatted(struct json *item)
+{
+	return json_print_root(item, 0);
+}
 
-	/* Collect all the results into our arrays: */
-	child = item->child;
-	depth++;
-	if (fmt)
-		len += depth;
-	while (child) {
-		names[i] = str = print_string_ptr(child->string);
-		entries[i++] = ret = print_value(child, depth, fmt);
-		if (str && ret)
-			len +=
-			    strlen(ret) + strlen(str) + 2 + (fmt ? 2 +
-							     depth : 0);
-		else
-			fail = 1;
-		child = child->next;
-	}
+int json_print_buf(struct printbuf *pb, struct json *item, int fmt)
+{
+	struct json_out o = {
+		.buf = pb->buf,
+		.pos = pb->bpos,
+		.len = pb->size,
+		.pb = pb,
+	};
 
-	/* Try to allocate the output string */
-	if (!fail)
-		out = (char *)json_malloc(len);
-	if (!out)
-		fail = 1;
+	if (!item)
+		return -1;
 
-	/* Handle failure */
-	if (fail) {
-		for (i = 0; i < numentries; i++) {
-			if (names[i])
-				json_free(names[i]);
-		}
-		json_free(names);
-		json_free(entries);
-		return 0;
-	}
+	print_value(item, 0, fmt, &o);
+	if (o.error)
+		return -1;
 
-	/* Compose the output: */
-	*out = '{';
-	ptr = out + 1;
-	if (fmt)
-		*ptr++ = '\n';
-	*ptr = 0;
-	for (i = 0; i < numentries; i++) {
-		if (fmt)
-			for (j = 0; j < depth; j++)
-				*ptr++ = '\t';
-		strcpy(ptr, names[i]);
-		ptr += strlen(names[i]);
-		*ptr++ = ':';
-		if (fmt)
-			*ptr++ = '\t';
-		strcpy(ptr, entries[i]);
-		ptr += strlen(entries[i]);
-		if (i != numentries - 1)
-			*ptr++ = ',';
-		if (fmt)
-			*ptr++ = '\n';
-		*ptr = 0;
-		json_free(names[i]);
+	pb->buf = o.buf;
+	pb->buf[o.pos] = 0;
+	pb->bpos = o.pos;
+	return 0;
+}
+
+static int json_ustream_sink(void *priv, const char *data, int len)
+{
+	return ustream_write(priv, data, len, false);
+}
+
+int json_print_ustream(struct ustream *s, struct json *item, int fmt)
+{
+	return json_print_sink(item, fmt, json_ustream_sink, s);
+}
+
+void json_set_print_cache(struct json *item, int enable)
+{
+	if (item->print_out) {
+		json_free(item->print_out);
+		item->print_out = 0;
 	}
 
-	json_free(names);
-	json_free(entries);
-	if (fmt)
-		for (i = 0; i < depth - 1; i++)
-			*ptr++ = '\t';
-	*ptr++ = '}';
-	*ptr++ = 0;
-	return out;
+	if (enable)
+		item->flags |= JSON_F_PRINT_CACHE;
+	else
+		item->flags &= ~JSON_F_PRINT_CACHE;
 }
 
 /* Get Array size/item / object item. */
@@ -790,12 +1397,195 @@ struct json *json_get_array_item(struct json *array, int item)
 
 
 
+/*
+ * Object member index: an open addressing table of the named members,
+ * hashed on the ASCII case folded name so that exact and case insensitive
+ * matches share a probe sequence. It is built once a lookup had to walk
+ * JSON_INDEX_MIN members, and kept up to date by the add, detach and
+ * replace functions.
+ */
+#define JSON_INDEX_MIN	8
+
+struct json_index_entry {
+	uint32_t hash;
+	struct json *item;
+};
+
+struct json_index {
+	unsigned int size;	/* power of two */
+	unsigned int count;
+	struct json_index_entry e[];
+};
+
+static uint32_t json_index_hash(const char *str)
+{
+	uint32_t h = 2166136261u;
+	unsigned char c;
+
+	while ((c = *str++)) {
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h = (h ^ c) * 16777619u;
+	}
+
+	return h;
+}
+
+static void json_index_insert(struct json_index *idx, struct json *item)
+{
+	uint32_t hash = json_index_hash(item->string);
+	unsigned int mask = idx->size - 1, i;
+
+	/* after any equal names, lookups keep returning the first one */
+	for (i = hash & mask; idx->e[i].item; i = (i + 1) & mask)
+		;
+
+	idx->e[i].hash = hash;
+	idx->e[i].item = item;
+	idx->count++;
+}
+
+static void json_index_drop(struct json *object)
+{
+	json_free(object->index);
+	object->index = 0;
+}
+
+static int json_index_build(struct json *object)
+{
+	struct json_index *idx;
+	struct json *c;
+	unsigned int size = 16, count = 0;
+
+	for (c = object->child; c; c = c->next)
+		count++;
+	while (size < count * 2)
+		size *= 2;
+
+	idx = (struct json_index *) json_malloc(sizeof(*idx) +
+						size * sizeof(idx->e[0]));
+	if (!idx)
+		return 0;
+
+	memset(idx, 0, sizeof(*idx) + size * sizeof(idx->e[0]));
+	idx->size = size;
+	for (c = object->child; c; c = c->next)
+		if (c->string)
+			json_index_insert(idx, c);
+
+	if (object->index)
+		json_free(object->index);
+	object->index = idx;
+	return 1;
+}
+
+static void json_index_add(struct json *object, struct json *item)
+{
+	struct json_index *idx = object->index;
+
+	if (!item->string)
+		return;
+
+	if ((idx->count + 1) * 2 <= idx->size)
+		json_index_insert(idx, item);
+	else if (!json_index_build(object))
+		json_index_drop(object);	/* rebuilt by a later lookup */
+}
+
+static void json_index_del(struct json *object, struct json *item)
+{
+	struct json_index *idx = object->index;
+	unsigned int mask = idx->size - 1, i, j, k;
+
+	if (!item->string)
+		return;
+
+	for (i = json_index_hash(item->string) & mask; idx->e[i].item != item;
+	     i = (i + 1) & mask)
+		if (!idx->e[i].item)
+			return;
+
+	/* shift the rest of the cluster back, no tombstones */
+	for (j = i; ; ) {
+		j = (j + 1) & mask;
+		if (!idx->e[j].item)
+			break;
+
+		k = idx->e[j].hash & mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		idx->e[i] = idx->e[j];
+		i = j;
+	}
+
+	idx->e[i].item = 0;
+	idx->count--;
+}
+
+static void json_index_replace(struct json *object, struct json *c,
+			       struct json *newitem)
+{
+	struct json_index *idx = object->index;
+	unsigned int mask = idx->size - 1, i;
+	uint32_t hash;
+
+	/* the same name in any case keeps the slot, and the member order */
+	if (c->string && newitem->string &&
+	    (hash = json_index_hash(c->string)) == json_index_hash(newitem->string)) {
+		for (i = hash & mask; idx->e[i].item; i = (i + 1) & mask) {
+			if (idx->e[i].item == c) {
+				idx->e[i].item = newitem;
+				return;
+			}
+		}
+	}
+
+	json_index_drop(object);
+}
+
+static struct json *json_index_lookup(struct json_index *idx, const char *string)
+{
+	uint32_t hash = json_index_hash(string);
+	unsigned int mask = idx->size - 1, i;
+	struct json *c, *match = 0;
+
+	for (i = hash & mask; (c = idx->e[i].item); i = (i + 1) & mask) {
+		if (idx->e[i].hash != hash)
+			continue;
+		if (!strcmp(c->string, string))
+			return c;
+		if (!match && !json_strcasecmp(c->string, string))
+			match = c;
+	}
+
+	return match;
+}
+
+/* Get item "string" from object, an exact match wins over a different case. */
 struct json *json_get_object_item(struct json *object, const char *string)
 {
-	struct json *c = object->child;
-	while (c && json_strcasecmp(c->string, string))
-		c = c->next;
-	return c;
+	struct json *c, *match = 0;
+	unsigned int n = 0;
+
+	if (object->index)
+		return json_index_lookup(object->index, string);
+
+	for (c = object->child; c; c = c->next, n++) {
+		if (!c->string)
+			continue;
+		if (!strcmp(c->string, string))
+			break;
+		if (!match && !json_strcasecmp(c->string, string))
+			match = c;
+	}
+
+	/* members shared with a reference can change behind the index's back */
+	if (n >= JSON_INDEX_MIN && !(object->type & JSON_T_IS_REFERENCE) &&
+	    !(object->flags & JSON_F_REFERENCED))
+		json_index_build(object);
+
+	return c ? c : match;
 }
 
 /* Utility for array list handling. */
@@ -811,9 +1601,18 @@ static struct json *create_reference(struct json *item)
 	struct json *ref = json_new_item();
 	if (!ref)
 		return 0;
+
+	/* changes through ref would not update the index of item */
+	if (item->index)
+		json_index_drop(item);
+	item->flags |= JSON_F_REFERENCED;
+
 	memcpy(ref, item, sizeof(*ref));
 	ref->string = 0;
+	ref->print_out = 0;
+	ref->index = 0;
 	ref->type |= JSON_T_IS_REFERENCE;
+	ref->flags = 0;
 	ref->next = ref->prev = 0;
 	return ref;
 }
@@ -831,6 +1630,8 @@ void json_add_item_to_array(struct json *array, struct json *item)
 			c = c->next;
 		suffix_object(c, item);
 	}
+	if (array->index)
+		json_index_add(array, item);
 }
 
 void json_add_item_to_object(struct json *object, const char *string,
@@ -838,9 +1639,10 @@ void json_add_item_to_object(struct json *object, const char *string,
 {
 	if (!item)
 		return;
-	if (item->string)
+	if (item->string && !(item->flags & JSON_F_ARENA_NAME))
 		json_free(item->string);
 	item->string = json_strdup(string);
+	item->flags &= ~JSON_F_ARENA_NAME;
 	json_add_item_to_array(object, item);
 }
 
@@ -855,13 +1657,12 @@ void json_add_item_reference_to_object(struct json *object, const char *string,
 	json_add_item_to_object(object, string, create_reference(item));
 }
 
-struct json *json_detach_item_from_array(struct json *array, int which)
+static struct json *json_detach_item(struct json *array, struct json *c)
 {
-	struct json *c = array->child;
-	while (c && which > 0)
-		c = c->next, which--;
 	if (!c)
 		return 0;
+	if (array->index)
+		json_index_del(array, c);
 	if (c->prev)
 		c->prev->next = c->next;
 	if (c->next)
@@ -872,6 +1673,11 @@ struct json *json_detach_item_from_array(struct json *array, int which)
 	return c;
 }
 
+struct json *json_detach_item_from_array(struct json *array, int which)
+{
+	return json_detach_item(array, json_get_array_item(array, which));
+}
+
 void json_delete_item_from_array(struct json *array, int which)
 {
 	json_delete(json_detach_item_from_array(array, which));
@@ -880,13 +1686,7 @@ void json_delete_item_from_array(struct json *array, int which)
 struct json *json_detach_item_from_object(struct json *object,
 					 const char *string)
 {
-	int i = 0;
-	struct json *c = object->child;
-	while (c && json_strcasecmp(c->string, string))
-		i++, c = c->next;
-	if (c)
-		return json_detach_item_from_array(object, i);
-	return 0;
+	return json_detach_item(object, json_get_object_item(object, string));
 }
 
 void json_delete_item_from_object(struct json *object, const char *string)
@@ -895,14 +1695,9 @@ void json_delete_item_from_object(struct json *object, const char *string)
 }
 
 /* Replace array/object items with new ones. */
-void json_replace_item_in_array(struct json *array, int which,
+static void json_replace_item(struct json *array, struct json *c,
 			      struct json *newitem)
 {
-	struct json *c = array->child;
-	while (c && which > 0)
-		c = c->next, which--;
-	if (!c)
-		return;
 	newitem->next = c->next;
 	newitem->prev = c->prev;
 	if (newitem->next)
@@ -912,19 +1707,29 @@ void json_replace_item_in_array(struct json *array, int which,
 	else
 		newitem->prev->next = newitem;
 	c->next = c->prev = 0;
+	if (array->index)
+		json_index_replace(array, c, newitem);
 	json_delete(c);
 }
 
+void json_replace_item_in_array(struct json *array, int which,
+			      struct json *newitem)
+{
+	struct json *c = json_get_array_item(array, which);
+
+	if (c)
+		json_replace_item(array, c, newitem);
+}
+
 void json_replace_item_in_object(struct json *object, const char *string,
 			       struct json *newitem)
 {
-	int i = 0;
-	struct json *c = object->child;
-	while (c && json_strcasecmp(c->string, string))
-		i++, c = c->next;
+	struct json *c = json_get_object_item(object, string);
+
 	if (c) {
 		newitem->string = json_strdup(string);
-		json_replace_item_in_array(object, i, newitem);
+		newitem->flags &= ~JSON_F_ARENA_NAME;
+		json_replace_item(object, c, newitem);
 	}
 }
 
@@ -1136,12 +1941,27 @@ struct json *json_object_from_file(const char *filename)
 
 /* extended "format and write to file" function */
 
+static int json_fd_sink(void *priv, const char *data, int len)
+{
+	int fd = *(int *)priv;
+	int wpos = 0, ret;
+
+	while (wpos < len) {
+		if ((ret = write(fd, data + wpos, len - wpos)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		wpos += ret;
+	}
+
+	return wpos;
+}
+
 int json_object_to_file_ext(const char *filename, struct json *obj,
 			    int flags)
 {
-	char *json_str;
-	int fd, ret;
-	unsigned int wpos, wsize;
+	int fd;
 
 	if (!obj) {
 		elog("json_object_to_file: object is null\n");
@@ -1154,25 +1974,14 @@ int json_object_to_file_ext(const char *filename, struct json *obj,
 		return -1;
 	}
 
-	if (!(json_str = print_value(obj, 0, flags))) {
+	/* written as it is rendered, no copy of the whole text */
+	if (json_print_sink(obj, flags, json_fd_sink, &fd) < 0) {
+		elog("json_object_to_file: error writing file %s: %s\n",
+		     filename, strerror(errno));
 		close(fd);
 		return -1;
 	}
 
-	wsize = (unsigned int)(strlen(json_str) & UINT_MAX);	/* CAW: probably unnecessary, but the most 64bit safe */
-	wpos = 0;
-	while (wpos < wsize) {
-		if ((ret = write(fd, json_str + wpos, wsize - wpos)) < 0) {
-			close(fd);
-			elog("json_object_to_file: error writing file %s: %s\n",
-			     filename, strerror(errno));
-			return -1;
-		}
-
-		/* because of the above check for ret < 0, we can safely cast and add */
-		wpos += (unsigned int)ret;
-	}
-
 	close(fd);
 	return 0;
 }
@@ -18,6 +18,18 @@
 
 #define JSON_T_IS_REFERENCE 256
 
+/* json flags: parts of an item that live in a json_parse_arena() arena */
+#define JSON_F_ARENA_NODE	1	/* the struct json itself */
+#define JSON_F_ARENA_NAME	2	/* string */
+#define JSON_F_ARENA_VALUE	4	/* valuestring */
+#define JSON_F_ARENA		(JSON_F_ARENA_NODE | JSON_F_ARENA_NAME | JSON_F_ARENA_VALUE)
+#define JSON_F_PRINT_CACHE	8	/* keep the rendered text in print_out */
+#define JSON_F_REFERENCED	16	/* members shared with a reference, never indexed */
+
+struct blob_arena;
+struct json_index;
+struct printbuf;
+struct ustream;
 
 /* The json structure: */
 struct json {
@@ -33,6 +45,8 @@ struct json {
 	char *string;		/* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
 	char *print_out;
 	int print_fmt;
+	int flags;		/* JSON_F_* */
+	struct json_index *index;	/* member hash of a large object, see json_get_object_item() */
 };
 
 struct json_hooks {
@@ -52,13 +66,97 @@ extern struct json *json_parse(const char *value);
  * end_ptr will point to 1 past the end of the JSON object */
 extern struct json *json_parse_stream(const char *value, char **end_ptr);
 
-/* Render a json entity to text for transfer/storage. will Free the char* when delete(item). */
+/* Like json_parse(), but nodes and strings are bump allocated from arena
+ * (see blob_arena_init()) instead of one json_malloc per node and string.
+ * The rest of the API works on the result as usual; json_delete() only
+ * releases what was added or printed later, the parsed document itself
+ * goes away with blob_arena_free(). Lookups in large objects allocate a
+ * member index as well, so call json_delete() on the document before
+ * blob_arena_free() once json_get_object_item() may have been used. */
+extern struct json *json_parse_arena(const char *value, struct blob_arena *arena);
+
+/*
+ * json_parser: incremental parsing of a document that arrives in pieces,
+ * e.g. one read() at a time. Every byte is looked at once; the state between
+ * json_parser_feed() calls is kept here. Nodes come from arena if it is set,
+ * as with json_parse_arena(). Documents nested deeper than max_depth
+ * arrays and objects are an error, set it after json_parser_init() to
+ * change the default.
+ */
+#define JSON_PARSER_MAX_DEPTH	512
+
+enum json_parse_status {
+	JSON_PARSE_MORE,	/* all input used, the document is not complete */
+	JSON_PARSE_DONE,	/* see json_parser_result() */
+	JSON_PARSE_ERROR,	/* until json_parser_reset() */
+};
+
+struct json_parser_frame;
+
+struct json_parser {
+	struct blob_arena *arena;
+	enum json_parse_status status;
+	int state;
+
+	struct json *root;
+	struct json *cur;	/* item that receives the current value */
+	struct json_parser_frame *stack;	/* open arrays and objects */
+	int depth;
+	int stack_size;
+	int max_depth;
+
+	char *tok;		/* string or number in progress */
+	int tok_len;
+	int tok_size;
+	const char *literal;
+	int esc;
+};
+
+extern void json_parser_init(struct json_parser *p, struct blob_arena *arena);
+
+/* Parse up to len bytes of data. *used is set to the number of bytes that
+ * belong to the document, the rest is the start of the next one. A number
+ * at the top level is only complete once the byte after it has been fed. */
+extern enum json_parse_status json_parser_feed(struct json_parser *p,
+					       const char *data, size_t len,
+					       size_t *used);
+
+/* Take the completed document, the parser moves on to the next one. */
+extern struct json *json_parser_result(struct json_parser *p);
+
+/* Drop a partial document (or an error) and start over. */
+extern void json_parser_reset(struct json_parser *p);
+extern void json_parser_free(struct json_parser *p);
+
+/* Render a json entity to text for transfer/storage. will Free the char* when delete(item).
+ * Calling it again returns the same pointer as long as the text is the
+ * same; once item or its subtree changed, or after
+ * json_to_string_unformatted(), the new text replaces (and frees) the old
+ * one. Copy the text to keep it across such calls.
+ * This only keeps the pointer valid, it saves no work: every call renders
+ * the whole tree and compares it with the old text, since items can be
+ * changed in place and do not know their parents. Use
+ * json_set_print_cache() to skip rendering a subtree. */
 extern char *json_to_string(struct json *item);
 
 /* Render a json entity to text for transfer/storage without any formatting.
- * will Free the char* when delete(item). */
+ * will Free the char* when delete(item). Same lifetime as json_to_string(). */
 extern char *json_to_string_unformatted(struct json *item);
 
+/* Append the text of item to pb, which can be reused for many documents.
+ * Returns 0, or -1 if out of memory. */
+extern int json_print_buf(struct printbuf *pb, struct json *item, int fmt);
+
+/* Write the text of item into the write buffer of a ustream, a few KB at
+ * a time. Returns the number of bytes written, or -1 on error. */
+extern int json_print_ustream(struct ustream *s, struct json *item, int fmt);
+
+/* Keep the rendered text of item (and its subtree) in item->print_out and
+ * reuse it whenever item is printed again, e.g. for a large constant part
+ * of a reply. Only the text of the last format and depth is kept, and it
+ * is not updated when the subtree changes; set it again to drop it. */
+extern void json_set_print_cache(struct json *item, int enable);
+
 /* Delete a json entity and all subentities. */
 extern void json_delete(struct json *c);
 
@@ -68,7 +166,11 @@ extern int json_get_array_size(struct json *array);
 /* Retrieve item number "item" from array "array". Returns NULL if unsuccessful. */
 extern struct json *json_get_array_item(struct json *array, int item);
 
-/* Get item "string" from object. Case insensitive. */
+/* Get item "string" from object. Case insensitive, but an exact match is
+ * preferred. Objects with many members get a hash index on first use,
+ * unless a reference to them was created (see json_add_item_reference_*),
+ * which could change the members without updating the index. The index is
+ * freed by json_delete(), also for json_parse_arena() documents. */
 extern struct json *json_get_object_item(struct json *object, const char *string);
 
 /* These calls create a json item of the appropriate type. */
@@ -118,8 +220,8 @@ extern void json_replace_item_in_object(struct json *object,
 					const char *string,
 					struct json *newitem);
 
-void *(*json_malloc) (size_t sz);
-void (*json_free) (void *ptr);
+extern void *(*json_malloc) (size_t sz);
+extern void (*json_free) (void *ptr);
 
 #define json_add_null_to_object(object,name)     json_add_item_to_object(object, name, json_create_null())
 #define json_add_true_to_object(object,name)     json_add_item_to_object(object, name, json_create_true())
@@ -173,4 +275,13 @@ extern const char *json_type_to_name(int type);
 
 extern int json_type_is_double(struct json *item);
 
+/*
+ * json_escape_span: returns the length of the leading run of str that can
+ * go into a JSON string literal as is, i.e. the offset of the first
+ * control character, '"' or '\\' (or '/' if slash is set), or len.
+ * Uses SSE2/AVX2 where available, json_escape_span_scalar() otherwise.
+ */
+extern size_t json_escape_span(const char *str, size_t len, int slash);
+extern size_t json_escape_span_scalar(const char *str, size_t len, int slash);
+
 #endif
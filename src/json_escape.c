@@ -0,0 +1,154 @@
+/*
+ * Copyright 2016 yubo. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * json_escape_span() - find the next byte that needs escaping in a JSON
+ * string literal. Clean runs are scanned 32 (AVX2) or 16 (SSE2) bytes at
+ * a time on x86, 8 bytes at a time with plain word arithmetic elsewhere.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "json.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define JSON_ESCAPE_X86
+#include <immintrin.h>
+#endif
+
+static inline int json_escape_byte(unsigned char c, int slash)
+{
+	return c < 0x20 || c == '"' || c == '\\' || (slash && c == '/');
+}
+
+static size_t json_escape_tail(const char *str, size_t i, size_t len, int slash)
+{
+	while (i < len && !json_escape_byte(str[i], slash))
+		i++;
+
+	return i;
+}
+
+#define ONES	0x0101010101010101ULL
+#define HIGHS	0x8080808080808080ULL
+
+/* high bit set in every byte of x that is zero */
+static inline uint64_t json_escape_zero(uint64_t x)
+{
+	return (x - ONES) & ~x & HIGHS;
+}
+
+static size_t json_escape_span_word(const char *str, size_t len, int slash)
+{
+	uint64_t x, hit;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&x, str + i, 8);
+
+		/* bytes below 0x20, ignoring the ones with the high bit set */
+		hit = (x - ONES * 0x20) & ~x & HIGHS;
+		hit |= json_escape_zero(x ^ (ONES * '"'));
+		hit |= json_escape_zero(x ^ (ONES * '\\'));
+		if (slash)
+			hit |= json_escape_zero(x ^ (ONES * '/'));
+
+		if (hit)
+			break;
+	}
+
+	return json_escape_tail(str, i, len, slash);
+}
+
+#ifdef JSON_ESCAPE_X86
+static size_t json_escape_span_sse2(const char *str, size_t len, int slash)
+{
+	const __m128i ctrl = _mm_set1_epi8(0x1f);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i sl = _mm_set1_epi8(slash ? '/' : '"');
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (str + i));
+		__m128i hit;
+		int mask;
+
+		/* v <= 0x1f as unsigned */
+		hit = _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v);
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, quote));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, bslash));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, sl));
+
+		mask = _mm_movemask_epi8(hit);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return json_escape_tail(str, i, len, slash);
+}
+
+__attribute__((target("avx2")))
+static size_t json_escape_span_avx2(const char *str, size_t len, int slash)
+{
+	const __m256i ctrl = _mm256_set1_epi8(0x1f);
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i bslash = _mm256_set1_epi8('\\');
+	const __m256i sl = _mm256_set1_epi8(slash ? '/' : '"');
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (str + i));
+		__m256i hit;
+		unsigned int mask;
+
+		hit = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl), v);
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, quote));
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, bslash));
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, sl));
+
+		mask = _mm256_movemask_epi8(hit);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + json_escape_span_sse2(str + i, len - i, slash);
+}
+
+static size_t json_escape_span_init(const char *str, size_t len, int slash);
+
+static size_t (*json_escape_span_fn)(const char *str, size_t len, int slash) =
+	json_escape_span_init;
+
+static size_t json_escape_span_init(const char *str, size_t len, int slash)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		json_escape_span_fn = json_escape_span_avx2;
+	else
+		json_escape_span_fn = json_escape_span_sse2;
+
+	return json_escape_span_fn(str, len, slash);
+}
+#endif
+
+size_t json_escape_span(const char *str, size_t len, int slash)
+{
+	/* not worth setting up the vector registers */
+	if (len < 16)
+		return json_escape_tail(str, 0, len, slash);
+
+#ifdef JSON_ESCAPE_X86
+	return json_escape_span_fn(str, len, slash);
+#else
+	return json_escape_span_word(str, len, slash);
+#endif
+}
+
+size_t json_escape_span_scalar(const char *str, size_t len, int slash)
+{
+	return json_escape_span_word(str, len, slash);
+}
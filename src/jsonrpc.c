@@ -161,6 +161,7 @@ static void close_connection(struct jrpc_connection *conn)
 	close(conn->sock.fd);
 	free(conn->r.data);
 	free(conn->w.data);
+	json_parser_free(&conn->parser);
 	free(conn);
 }
 
@@ -189,8 +190,9 @@ static void connection_cb(struct uloop_fd *sock, unsigned int events)
 	struct buffer_t *buf;
 	int n, offset, size, fd;
 	struct json *root;
-	char *new_buffer, *end_ptr = NULL;
+	char *new_buffer;
 	struct jrpc_server *server;
+	size_t used;
 	
 	
 	conn = container_of(sock, struct jrpc_connection, sock);
@@ -263,7 +265,10 @@ retry:
 	//string must be NULL terminated
 	buf->data[buf->pos] = 0;
 
-	if ((root = json_parse_stream(buf->data, &end_ptr)) != NULL) {
+	/* a partial request stays in conn->parser, every byte is parsed once */
+	switch (json_parser_feed(&conn->parser, buf->data, buf->pos, &used)) {
+	case JSON_PARSE_DONE:
+		root = json_parser_result(&conn->parser);
 		if (server->debug_level > 1) {
 			dlog("Valid JSON Received:\n%s\n",
 			     json_to_string(root));
@@ -273,26 +278,27 @@ retry:
 			eval_request(server, conn, root);
 		}
 		//shift processed request, discarding it
-		buf->pos -= end_ptr - buf->data;
-		memmove(buf->data, end_ptr, buf->pos);
+		buf->pos -= used;
+		memmove(buf->data, buf->data + used, buf->pos);
 		buf->data[buf->pos] = 0;
 
 		json_delete(root);
 		return;
-	} else {
-		// did we parse the all buffer? If so, just wait for more.
-		// else there was an error before the buffer's end
-		if (end_ptr != (buf->data + buf->pos)) {
-			if (server->debug_level) {
-				dlog("INVALID JSON Received:\n---\n%s\n---\n",
-				     buf->data);
-			}
-			send_error(conn, JRPC_PARSE_ERROR,
-				   strdup("Parse error. Invalid JSON"
-					  " was received by the server."),
-				   NULL);
-			goto disconnect;
+	case JSON_PARSE_MORE:
+		// all of it went into the parser, just wait for more
+		buf->pos = 0;
+		buf->data[0] = 0;
+		break;
+	case JSON_PARSE_ERROR:
+		if (server->debug_level) {
+			dlog("INVALID JSON Received:\n---\n%s\n---\n",
+			     buf->data);
 		}
+		send_error(conn, JRPC_PARSE_ERROR,
+			   strdup("Parse error. Invalid JSON"
+				  " was received by the server."),
+			   NULL);
+		goto disconnect;
 	}
 
 out:
@@ -314,6 +320,7 @@ static struct jrpc_connection *new_connection(int fd, uloop_fd_handler cb)
 	conn->sock.fd = fd;
 	conn->sock.cb = cb;
 	conn->sock.eof = false;
+	json_parser_init(&conn->parser, NULL);
 
 	conn->r.size = 1500;
 	conn->r.data = calloc(1, 1500);
@@ -521,7 +528,7 @@ int jrpc_client_init(struct jrpc_client *client, char *host, char *port)
 	}
 
 	strncpy(client->host, host, sizeof(client->host) - 1);
-	strncpy(client->port, port, sizeof(client->host) - 1);
+	strncpy(client->port, port, sizeof(client->port) - 1);
 	client->conn.r.size = 1500;
 	client->conn.r.data = calloc(1, 1500);
 	client->conn.r.pos = 0;
@@ -66,6 +66,7 @@ struct jrpc_connection {
 	struct sockaddr_in addr;
 	struct buffer_t r;
 	struct buffer_t w;
+	struct json_parser parser;	/* request being received */
 	/*
 	int pos;
 	char *buffer;
@@ -16,11 +16,23 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
 #include "ustream.h"
 
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define USE_ZEROCOPY
+#endif
+
 static void ustream_fd_set_uloop(struct ustream *s, bool write)
 {
 	struct ustream_fd *sf = container_of(s, struct ustream_fd, stream);
@@ -33,6 +45,8 @@ static void ustream_fd_set_uloop(struct ustream *s, bool write)
 	buf = s->w.head;
 	if (write || (buf && s->w.data_bytes && !s->write_error))
 		flags |= ULOOP_WRITE;
+	else if (!list_empty(&sf->zc.pending) && !s->write_error)
+		flags |= ULOOP_WRITE;
 
 	uloop_fd_add(&sf->fd, flags);
 }
@@ -58,12 +72,15 @@ static void ustream_fd_read_pending(struct ustream_fd *sf, bool *more)
 			break;
 
 		len = read(sf->fd.fd, buf, buflen);
+		ustream_stat_add(s, read_calls, 1);
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
 
-			if (errno == EAGAIN)
+			if (errno == EAGAIN) {
+				ustream_stat_add(s, eagain, 1);
 				return;
+			}
 
 			len = 0;
 		}
@@ -89,15 +106,31 @@ static int ustream_fd_write(struct ustream *s, const char *buf, int buflen, bool
 	if (!buflen)
 		return 0;
 
+	/* copied data must not overtake a queued zero-copy region */
+	if (!list_empty(&sf->zc.pending)) {
+		struct ustream_zc_buf *zb;
+		int64_t limit;
+
+		zb = list_first_entry(&sf->zc.pending, struct ustream_zc_buf, list);
+		limit = zb->offset - sf->zc.written;
+		if (limit <= 0)
+			return 0;
+		if (buflen > limit)
+			buflen = limit;
+	}
+
 	while (buflen) {
 		len = write(sf->fd.fd, buf, buflen);
+		ustream_stat_add(s, write_calls, 1);
 
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
 
-			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ustream_stat_add(s, eagain, 1);
 				break;
+			}
 
 			return -1;
 		}
@@ -107,12 +140,344 @@ static int ustream_fd_write(struct ustream *s, const char *buf, int buflen, bool
 		buflen -= len;
 	}
 
+	sf->zc.written += ret;
 	if (buflen)
 		ustream_fd_set_uloop(s, true);
 
 	return ret;
 }
 
+static void ustream_fd_zc_release(struct list_head *list)
+{
+	struct ustream_zc_buf *zb, *tmp;
+
+	list_for_each_entry_safe(zb, tmp, list, list) {
+		list_del(&zb->list);
+		if (zb->release)
+			zb->release(zb);
+	}
+}
+
+#ifdef USE_ZEROCOPY
+
+/* returns true if the head of the zero-copy queue has been fully sent */
+static bool ustream_fd_zc_send(struct ustream_fd *sf, int *written)
+{
+	struct ustream *s = &sf->stream;
+	struct ustream_zc_buf *zb;
+	ssize_t len;
+	int wr = 0;
+
+	if (list_empty(&sf->zc.pending))
+		return false;
+
+	zb = list_first_entry(&sf->zc.pending, struct ustream_zc_buf, list);
+	if (sf->zc.written != zb->offset + zb->sent)
+		return false;
+
+	while (zb->sent < zb->len) {
+		len = send(sf->fd.fd, zb->data + zb->sent, zb->len - zb->sent,
+			   MSG_ZEROCOPY);
+		ustream_stat_add(s, write_calls, 1);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* ENOBUFS: out of notification space, wait for completions */
+			if (errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == ENOBUFS) {
+				ustream_stat_add(s, eagain, 1);
+				break;
+			}
+
+			if (!s->write_error)
+				ustream_state_change(s);
+			s->write_error = true;
+			break;
+		}
+
+		/* every send() takes one completion id */
+		if (!zb->ids)
+			zb->id = sf->zc.next_id;
+		sf->zc.next_id++;
+		zb->ids++;
+		zb->sent += len;
+		wr += len;
+	}
+
+	sf->zc.written += wr;
+	s->w.data_bytes -= wr;
+	ustream_stat_add(s, tx_bytes, wr);
+	if (written)
+		*written += wr;
+
+	if (zb->sent < zb->len)
+		return false;
+
+	list_move_tail(&zb->list, &sf->zc.inflight);
+	return true;
+}
+
+/* count the ids first..last of a completion against a region, wrap safe */
+static void ustream_fd_zc_account(struct ustream_zc_buf *zb, uint32_t first,
+				  uint32_t last)
+{
+	int32_t start = first - zb->id;
+	int32_t end = last - zb->id;
+
+	if (start < 0)
+		start = 0;
+	if (end >= (int32_t) zb->ids)
+		end = zb->ids - 1;
+	if (end >= start)
+		zb->done += end - start + 1;
+}
+
+/*
+ * reads the completions off the error queue of fd and releases the regions
+ * on inflight that are complete. partial is a region that has only been
+ * sent in part so far. Returns the number of completions read, or -1 if
+ * the queue held a real error.
+ */
+static int ustream_fd_zc_reap(int fd, struct list_head *inflight,
+			      struct ustream_zc_buf *partial)
+{
+	struct ustream_zc_buf *zb, *tmp;
+	struct sock_extended_err *serr;
+	struct cmsghdr *cmsg;
+	char control[128];
+	struct msghdr msg;
+	bool error = false;
+	int n = 0;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				if (serr->ee_errno)
+					error = true;
+				continue;
+			}
+
+			/* the range ee_info..ee_data can cover several regions */
+			list_for_each_entry(zb, inflight, list)
+				ustream_fd_zc_account(zb, serr->ee_info, serr->ee_data);
+			if (partial)
+				ustream_fd_zc_account(partial, serr->ee_info, serr->ee_data);
+			n++;
+		}
+	}
+
+	list_for_each_entry_safe(zb, tmp, inflight, list) {
+		if (zb->done < zb->ids)
+			continue;
+
+		list_del(&zb->list);
+		if (zb->release)
+			zb->release(zb);
+	}
+
+	return error ? -1 : n;
+}
+
+static struct ustream_zc_buf *ustream_fd_zc_partial(struct ustream_fd *sf)
+{
+	struct ustream_zc_buf *zb;
+
+	if (list_empty(&sf->zc.pending))
+		return NULL;
+
+	zb = list_first_entry(&sf->zc.pending, struct ustream_zc_buf, list);
+	return zb->ids ? zb : NULL;
+}
+
+static bool ustream_fd_zc_error(struct ustream_fd *sf)
+{
+	struct pollfd pfd = { .fd = sf->fd.fd };
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (!sf->zc.threshold ||
+	    ustream_fd_zc_reap(sf->fd.fd, &sf->zc.inflight, ustream_fd_zc_partial(sf)) <= 0)
+		return true;
+
+	/* completions raise POLLERR as well, only keep real socket errors */
+	if (getsockopt(sf->fd.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+		return true;
+
+	/* the same event may have carried a hangup */
+	return poll(&pfd, 1, 0) != 0 && (pfd.revents & (POLLHUP | POLLNVAL));
+}
+
+/* keeps a freed stream's socket open for the regions still in flight */
+struct ustream_fd_zc_orphan {
+	struct uloop_fd fd;
+	struct list_head inflight;
+};
+
+static void ustream_fd_zc_orphan_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct ustream_fd_zc_orphan *o = container_of(fd, struct ustream_fd_zc_orphan, fd);
+
+	ustream_fd_zc_reap(fd->fd, &o->inflight, NULL);
+	if (!list_empty(&o->inflight))
+		return;
+
+	uloop_fd_delete(fd);
+	close(fd->fd);
+	free(o);
+}
+
+static void ustream_fd_zc_free(struct ustream_fd *sf)
+{
+	struct ustream_zc_buf *partial = ustream_fd_zc_partial(sf);
+	struct ustream_fd_zc_orphan *o;
+
+	/* the kernel may still read what was sent of a partial region */
+	if (partial)
+		list_move_tail(&partial->list, &sf->zc.inflight);
+	ustream_fd_zc_release(&sf->zc.pending);
+
+	if (list_empty(&sf->zc.inflight))
+		return;
+
+	ustream_fd_zc_reap(sf->fd.fd, &sf->zc.inflight, NULL);
+	if (list_empty(&sf->zc.inflight))
+		return;
+
+	/*
+	 * the rest may only be released once its completion arrives, which
+	 * needs the socket. Without memory for that, it is never released.
+	 */
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		goto out;
+
+	o->fd.fd = dup(sf->fd.fd);
+	if (o->fd.fd < 0) {
+		free(o);
+		goto out;
+	}
+
+	INIT_LIST_HEAD(&o->inflight);
+	list_splice_init(&sf->zc.inflight, &o->inflight);
+	o->fd.cb = ustream_fd_zc_orphan_cb;
+
+	/* completions raise POLLERR, which needs some event registered */
+	if (!uloop_fd_add(&o->fd, ULOOP_READ | ULOOP_EDGE_TRIGGER | ULOOP_ERROR_CB))
+		return;
+
+	close(o->fd.fd);
+	free(o);
+	return;
+
+out:
+	INIT_LIST_HEAD(&sf->zc.inflight);
+}
+
+int ustream_fd_set_zerocopy(struct ustream_fd *sf, int threshold)
+{
+	int val = 1;
+
+	if (setsockopt(sf->fd.fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)) < 0)
+		return -1;
+
+	sf->zc.threshold = threshold > 0 ? threshold : USTREAM_ZC_THRESHOLD;
+	return 0;
+}
+
+#else
+
+static bool ustream_fd_zc_send(struct ustream_fd *sf, int *written)
+{
+	return false;
+}
+
+static bool ustream_fd_zc_error(struct ustream_fd *sf)
+{
+	return true;
+}
+
+static void ustream_fd_zc_free(struct ustream_fd *sf)
+{
+	ustream_fd_zc_release(&sf->zc.pending);
+}
+
+int ustream_fd_set_zerocopy(struct ustream_fd *sf, int threshold)
+{
+	return -1;
+}
+
+#endif
+
+int ustream_fd_write_zerocopy(struct ustream_fd *sf, struct ustream_zc_buf *zb)
+{
+	struct ustream *s = &sf->stream;
+	int ret;
+
+	if (s->write_error)
+		return -1;
+
+	if (!sf->zc.threshold || zb->len < sf->zc.threshold) {
+		ret = ustream_write(s, zb->data, zb->len, false);
+		if (ret < 0)
+			return ret;
+
+		if (zb->release)
+			zb->release(zb);
+		return ret;
+	}
+
+	zb->sent = 0;
+	zb->ids = 0;
+	zb->done = 0;
+	zb->offset = sf->zc.written + s->w.data_bytes;
+	list_add_tail(&zb->list, &sf->zc.pending);
+
+	/* pending zero-copy data is accounted as buffered write data */
+	s->w.data_bytes += zb->len;
+
+	ustream_fd_zc_send(sf, NULL);
+	ustream_fd_set_uloop(s, false);
+
+	return zb->len;
+}
+
+static bool ustream_fd_write_pending(struct ustream_fd *sf)
+{
+	struct ustream *s = &sf->stream;
+	bool done, sent = false;
+	int wr, zc_wr = 0;
+
+	do {
+		done = ustream_write_pending(s);
+		if (list_empty(&sf->zc.pending))
+			break;
+
+		wr = 0;
+		sent = ustream_fd_zc_send(sf, &wr);
+		if (wr && s->notify_write)
+			s->notify_write(s, wr);
+		zc_wr += wr;
+	} while (sent);
+
+	if (s->eof && zc_wr && !s->w.data_bytes)
+		ustream_state_change(s);
+
+	return done;
+}
+
 static bool __ustream_fd_poll(struct ustream_fd *sf, unsigned int events)
 {
 	struct ustream *s = &sf->stream;
@@ -121,8 +486,14 @@ static bool __ustream_fd_poll(struct ustream_fd *sf, unsigned int events)
 	if (events & ULOOP_READ)
 		ustream_fd_read_pending(sf, &more);
 
+	if (sf->fd.error && !ustream_fd_zc_error(sf)) {
+		sf->fd.error = false;
+		if (!list_empty(&sf->zc.pending))
+			events |= ULOOP_WRITE;
+	}
+
 	if (events & ULOOP_WRITE) {
-		bool no_more = ustream_write_pending(s);
+		bool no_more = ustream_fd_write_pending(sf);
 		if (no_more)
 			ustream_fd_set_uloop(s, false);
 	}
@@ -155,6 +526,7 @@ static void ustream_fd_free(struct ustream *s)
 	struct ustream_fd *sf = container_of(s, struct ustream_fd, stream);
 
 	uloop_fd_delete(&sf->fd);
+	ustream_fd_zc_free(sf);
 }
 
 void ustream_fd_init(struct ustream_fd *sf, int fd)
@@ -165,6 +537,11 @@ void ustream_fd_init(struct ustream_fd *sf, int fd)
 
 	sf->fd.fd = fd;
 	sf->fd.cb = ustream_uloop_cb;
+	INIT_LIST_HEAD(&sf->zc.pending);
+	INIT_LIST_HEAD(&sf->zc.inflight);
+	sf->zc.written = 0;
+	sf->zc.next_id = 0;
+	sf->zc.threshold = 0;
 	s->set_read_blocked = ustream_fd_set_read_blocked;
 	s->write = ustream_fd_write;
 	s->free = ustream_fd_free;
@@ -0,0 +1,210 @@
+/*
+ * ustream - library for stream buffer management
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ustream.h"
+
+/*
+ * The read buffer list holds at most one ustream_buf, whose data points
+ * straight into the current mapping. Up to a window of data starting at the
+ * first unconsumed byte is exposed to the consumer. The mapping covers two
+ * windows, so partial consumes only extend the exposed range, and it is
+ * moved forward (keeping the remainder contiguous with the following bytes)
+ * once the consumed offset leaves the first window.
+ */
+
+static int ustream_mmap_alloc(struct ustream *s, struct ustream_buf_list *l)
+{
+	struct ustream_buf *buf;
+
+	if (l != &s->r)
+		return -1;
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return -1;
+
+	l->head = l->tail = buf;
+	l->buffers++;
+
+	return 0;
+}
+
+static bool ustream_mmap_map(struct ustream_mmap *sm, off_t start, off_t end)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	off_t offset = start & ~((off_t) pagesize - 1);
+	off_t map_end;
+	void *map;
+
+	if (sm->map && start >= sm->map_offset &&
+	    end <= sm->map_offset + (off_t) sm->map_len)
+		return true;
+
+	map_end = offset + 2 * (off_t) sm->window;
+	if (map_end > sm->size)
+		map_end = sm->size;
+
+	map = mmap(NULL, map_end - offset, PROT_READ, MAP_SHARED, sm->fd, offset);
+	if (map == MAP_FAILED)
+		return false;
+
+	madvise(map, map_end - offset, MADV_SEQUENTIAL);
+
+	if (sm->map)
+		munmap(sm->map, sm->map_len);
+
+	sm->map = map;
+	sm->map_len = map_end - offset;
+	sm->map_offset = offset;
+
+	return true;
+}
+
+static bool ustream_mmap_fetch(struct ustream_mmap *sm)
+{
+	struct ustream *s = &sm->stream;
+	struct ustream_buf *buf = s->r.head;
+	off_t start, end;
+	int maxlen;
+
+	if (s->read_blocked || s->eof)
+		return false;
+
+	if (sm->pos >= sm->size) {
+		s->eof = true;
+		ustream_state_change(s);
+		return false;
+	}
+
+	start = sm->pos;
+	if (buf)
+		start -= buf->tail - buf->data;
+
+	end = start + sm->window;
+	if (end > sm->size)
+		end = sm->size;
+
+	/* the whole window is still unconsumed, wait for the consumer */
+	if (end == sm->pos) {
+		__ustream_set_read_blocked(s, s->read_blocked | READ_BLOCKED_FULL);
+		return false;
+	}
+
+	if (!ustream_mmap_map(sm, start, end)) {
+		s->eof = true;
+		ustream_state_change(s);
+		return false;
+	}
+
+	if (!buf) {
+		ustream_reserve(s, 1, &maxlen);
+		buf = s->r.head;
+		if (!buf)
+			return false;
+	}
+
+	buf->data = sm->map + (start - sm->map_offset);
+	buf->tail = sm->map + (sm->pos - sm->map_offset);
+	buf->end = sm->map + (end - sm->map_offset);
+
+	maxlen = end - sm->pos;
+	sm->pos = end;
+	ustream_fill_read(s, maxlen);
+
+	return true;
+}
+
+static void ustream_mmap_timer_cb(struct uloop_timeout *t)
+{
+	struct ustream_mmap *sm = container_of(t, struct ustream_mmap, timer);
+
+	if (ustream_mmap_fetch(sm))
+		uloop_timeout_set(&sm->timer, 0);
+}
+
+static void ustream_mmap_set_read_blocked(struct ustream *s)
+{
+	struct ustream_mmap *sm = container_of(s, struct ustream_mmap, stream);
+
+	if (!s->read_blocked)
+		uloop_timeout_set(&sm->timer, 0);
+}
+
+static bool ustream_mmap_poll(struct ustream *s)
+{
+	struct ustream_mmap *sm = container_of(s, struct ustream_mmap, stream);
+
+	return ustream_mmap_fetch(sm);
+}
+
+static int ustream_mmap_write(struct ustream *s, const char *buf, int len, bool more)
+{
+	return -1;
+}
+
+static void ustream_mmap_free(struct ustream *s)
+{
+	struct ustream_mmap *sm = container_of(s, struct ustream_mmap, stream);
+
+	uloop_timeout_cancel(&sm->timer);
+	if (sm->map)
+		munmap(sm->map, sm->map_len);
+	sm->map = NULL;
+}
+
+int ustream_mmap_init(struct ustream_mmap *sm, int fd, size_t window)
+{
+	struct ustream *s = &sm->stream;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+
+	if (!window)
+		window = USTREAM_MMAP_WINDOW;
+	window = (window + pagesize - 1) & ~((size_t) pagesize - 1);
+
+	s->r.alloc = ustream_mmap_alloc;
+	ustream_init_defaults(s);
+
+	/* buffers point into the mapping, never keep or recycle them */
+	s->r.min_buffers = 0;
+	s->r.max_buffers = 1;
+	s->string_data = false;
+
+	s->set_read_blocked = ustream_mmap_set_read_blocked;
+	s->write = ustream_mmap_write;
+	s->free = ustream_mmap_free;
+	s->poll = ustream_mmap_poll;
+
+	sm->fd = fd;
+	sm->map = NULL;
+	sm->map_len = 0;
+	sm->map_offset = 0;
+	sm->pos = 0;
+	sm->size = st.st_size;
+	sm->window = window;
+	sm->timer.cb = ustream_mmap_timer_cb;
+	uloop_timeout_set(&sm->timer, 0);
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * ustream - library for stream buffer management
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "ustream.h"
+
+static void ustream_pipe_deliver(struct ustream_pipe *sp)
+{
+	struct ustream *s = &sp->stream;
+	int wr;
+
+	if (!sp->peer)
+		return;
+
+	wr = ustream_transfer(s, &sp->peer->stream);
+	if (!wr)
+		return;
+
+	if (s->notify_write)
+		s->notify_write(s, wr);
+
+	if (s->eof && !s->w.data_bytes)
+		ustream_state_change(s);
+}
+
+static void ustream_pipe_timer_cb(struct uloop_timeout *t)
+{
+	struct ustream_pipe *sp = container_of(t, struct ustream_pipe, timer);
+
+	ustream_pipe_deliver(sp);
+}
+
+static void ustream_pipe_schedule(struct ustream_pipe *sp)
+{
+	if (!sp->timer.pending)
+		uloop_timeout_set(&sp->timer, sp->latency);
+}
+
+static int ustream_pipe_write(struct ustream *s, const char *buf, int len, bool more)
+{
+	struct ustream_pipe *sp = container_of(s, struct ustream_pipe, stream);
+
+	if (!sp->peer)
+		return -1;
+
+	/* never accept data directly, it is handed over from the write buffers */
+	ustream_pipe_schedule(sp);
+	return 0;
+}
+
+static void ustream_pipe_set_read_blocked(struct ustream *s)
+{
+	struct ustream_pipe *sp = container_of(s, struct ustream_pipe, stream);
+
+	if (!s->read_blocked && sp->peer && sp->peer->stream.w.data_bytes)
+		ustream_pipe_schedule(sp->peer);
+}
+
+static bool ustream_pipe_poll(struct ustream *s)
+{
+	struct ustream_pipe *sp = container_of(s, struct ustream_pipe, stream);
+	int len = s->r.data_bytes;
+
+	if (sp->peer)
+		ustream_pipe_deliver(sp->peer);
+
+	return s->r.data_bytes != len;
+}
+
+static void ustream_pipe_free(struct ustream *s)
+{
+	struct ustream_pipe *sp = container_of(s, struct ustream_pipe, stream);
+	struct ustream_pipe *peer = sp->peer;
+
+	uloop_timeout_cancel(&sp->timer);
+	if (!peer)
+		return;
+
+	ustream_pipe_deliver(sp);
+	sp->peer = NULL;
+	peer->peer = NULL;
+
+	peer->stream.eof = true;
+	ustream_state_change(&peer->stream);
+}
+
+static void ustream_pipe_init(struct ustream_pipe *sp, struct ustream_pipe *peer)
+{
+	struct ustream *s = &sp->stream;
+
+	if (!s->w.buffer_len)
+		s->w.buffer_len = 4096;
+
+	ustream_init_defaults(s);
+
+	/* read buffers are the peer's write buffers, don't recycle them */
+	s->r.min_buffers = 0;
+	s->r.max_buffers = -1;
+
+	s->set_read_blocked = ustream_pipe_set_read_blocked;
+	s->write = ustream_pipe_write;
+	s->free = ustream_pipe_free;
+	s->poll = ustream_pipe_poll;
+
+	sp->peer = peer;
+	sp->timer.cb = ustream_pipe_timer_cb;
+}
+
+void ustream_pipe_pair(struct ustream_pipe *a, struct ustream_pipe *b)
+{
+	/* handed over buffers need room for the terminator on either side */
+	if (a->stream.string_data || b->stream.string_data)
+		a->stream.string_data = b->stream.string_data = true;
+
+	ustream_pipe_init(a, b);
+	ustream_pipe_init(b, a);
+}
@@ -0,0 +1,298 @@
+/*
+ * ustream - library for stream buffer management
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "ustream.h"
+
+#ifdef __linux__
+
+#define USTREAM_SPLICE_FLAGS	(SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+
+/* detach the buffers of l and append them to *tail, returns the new tail */
+static struct ustream_buf **ustream_splice_take(struct ustream_buf_list *l,
+					       struct ustream_buf **tail)
+{
+	*tail = l->head;
+	while (*tail)
+		tail = &(*tail)->next;
+
+	l->head = l->tail = l->data_tail = NULL;
+	l->data_bytes = 0;
+	l->buffers = 0;
+
+	return tail;
+}
+
+static void ustream_splice_free_backlog(struct ustream_splice_side *side)
+{
+	struct ustream_buf *buf;
+
+	while ((buf = side->backlog) != NULL) {
+		side->backlog = buf->next;
+		free(buf);
+	}
+}
+
+/* queue data that has been buffered by the ustreams into the pipe */
+static bool ustream_splice_queue(struct ustream_splice_side *side)
+{
+	struct ustream_buf *buf;
+	bool progress = false;
+	ssize_t len;
+
+	while ((buf = side->backlog) != NULL) {
+		len = buf->tail - buf->data;
+		if (len) {
+			len = write(side->pipe[1], buf->data, len);
+			if (len <= 0)
+				break;
+
+			buf->data += len;
+			side->pending += len;
+			progress = true;
+			if (buf->data != buf->tail)
+				break;
+		}
+
+		side->backlog = buf->next;
+		free(buf);
+	}
+
+	return progress;
+}
+
+/* the destination of side i failed, read and drop whatever still comes in */
+static bool ustream_splice_discard(struct ustream_splice_side *src)
+{
+	bool progress = false;
+	char buf[4096];
+	ssize_t len;
+
+	ustream_splice_free_backlog(src);
+	while (src->pending && read(src->pipe[0], buf, sizeof(buf)) > 0)
+		;
+	src->pending = 0;
+
+	if (src->eof)
+		return false;
+
+	len = read(src->fd.fd, buf, sizeof(buf));
+	if (len > 0) {
+		progress = true;
+	} else if (!len || (errno != EAGAIN && errno != EINTR)) {
+		src->eof = true;
+		progress = true;
+	}
+
+	return progress;
+}
+
+static void ustream_splice_set_uloop(struct ustream_splice *sp, int i)
+{
+	struct ustream_splice_side *side = &sp->side[i];
+	unsigned int flags = ULOOP_EDGE_TRIGGER | ULOOP_ERROR_CB;
+
+	if (!side->eof)
+		flags |= ULOOP_READ;
+
+	if (sp->side[!i].pending && !side->sf->stream.write_error)
+		flags |= ULOOP_WRITE;
+
+	if (flags != side->fd.flags || !side->fd.registered)
+		uloop_fd_add(&side->fd, flags);
+}
+
+/* move data read from side i towards the other side */
+static bool ustream_splice_move(struct ustream_splice *sp, int i)
+{
+	struct ustream_splice_side *src = &sp->side[i];
+	struct ustream_splice_side *dst = &sp->side[!i];
+	struct ustream *ds = &dst->sf->stream;
+	bool progress = false;
+	ssize_t len;
+
+	if (ds->write_error)
+		return ustream_splice_discard(src);
+
+	if (src->backlog) {
+		progress = ustream_splice_queue(src);
+	} else if (!src->eof && src->pending < src->pipe_size) {
+		len = splice(src->fd.fd, NULL, src->pipe[1], NULL,
+			     src->pipe_size - src->pending, USTREAM_SPLICE_FLAGS);
+		if (len > 0) {
+			src->pending += len;
+			progress = true;
+		} else if (!len || (errno != EAGAIN && errno != EINTR)) {
+			src->eof = true;
+			progress = true;
+		}
+	}
+
+	if (src->pending) {
+		len = splice(src->pipe[0], NULL, dst->fd.fd, NULL,
+			     src->pending, USTREAM_SPLICE_FLAGS);
+		if (len > 0) {
+			src->pending -= len;
+			progress = true;
+		} else if (len < 0 && errno != EAGAIN && errno != EINTR) {
+			ds->write_error = true;
+			ustream_state_change(ds);
+			progress = true;
+		}
+	}
+
+	return progress;
+}
+
+static void ustream_splice_pump(struct ustream_splice *sp)
+{
+	struct ustream_splice_side *side;
+	bool progress;
+	int i;
+
+	do {
+		progress = ustream_splice_move(sp, 0);
+		progress |= ustream_splice_move(sp, 1);
+	} while (progress);
+
+	for (i = 0; i < 2; i++) {
+		side = &sp->side[i];
+		if (!side->eof || side->pending || side->backlog ||
+		    side->sf->stream.eof)
+			continue;
+
+		/* everything has been relayed, pass the EOF on */
+		shutdown(sp->side[!i].fd.fd, SHUT_WR);
+		side->sf->stream.eof = true;
+		ustream_state_change(&side->sf->stream);
+	}
+
+	ustream_splice_set_uloop(sp, 0);
+	ustream_splice_set_uloop(sp, 1);
+}
+
+static void ustream_splice_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct ustream_splice_side *side = container_of(fd, struct ustream_splice_side, fd);
+
+	ustream_splice_pump(side->sp);
+}
+
+static int ustream_splice_side_init(struct ustream_splice *sp, int i)
+{
+	struct ustream_splice_side *side = &sp->side[i];
+
+	side->sp = sp;
+	side->pending = 0;
+	side->eof = false;
+	if (pipe2(side->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+		side->pipe[0] = side->pipe[1] = -1;
+		return -1;
+	}
+
+	side->pipe_size = fcntl(side->pipe[1], F_GETPIPE_SZ);
+	if (side->pipe_size <= 0)
+		return -1;
+
+	return 0;
+}
+
+static void ustream_splice_close(struct ustream_splice *sp)
+{
+	int i, j;
+
+	for (i = 0; i < 2; i++) {
+		uloop_fd_delete(&sp->side[i].fd);
+		for (j = 0; j < 2; j++) {
+			if (sp->side[i].pipe[j] >= 0)
+				close(sp->side[i].pipe[j]);
+			sp->side[i].pipe[j] = -1;
+		}
+		ustream_splice_free_backlog(&sp->side[i]);
+	}
+}
+
+int ustream_splice_pair(struct ustream_splice *sp, struct ustream_fd *a,
+			struct ustream_fd *b)
+{
+	struct ustream_fd *sf[2] = { a, b };
+	struct ustream_buf **tail;
+	struct ustream *s;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		sp->side[i].sf = sf[i];
+		sp->side[i].pipe[0] = sp->side[i].pipe[1] = -1;
+		sp->side[i].fd.fd = sf[i]->fd.fd;
+		sp->side[i].fd.cb = ustream_splice_cb;
+		sp->side[i].fd.registered = false;
+		sp->side[i].fd.flags = 0;
+		sp->side[i].backlog = NULL;
+
+		if (!list_empty(&sf[i]->zc.pending) ||
+		    !list_empty(&sf[i]->zc.inflight))
+			return -1;
+	}
+
+	for (i = 0; i < 2; i++)
+		if (ustream_splice_side_init(sp, i) < 0)
+			goto error;
+
+	/* pending output of the peer goes first, then what was read already */
+	for (i = 0; i < 2; i++) {
+		tail = ustream_splice_take(&sf[!i]->stream.w, &sp->side[i].backlog);
+		ustream_splice_take(&sf[i]->stream.r, tail);
+	}
+
+	/* the fds are driven by the relay from now on */
+	for (i = 0; i < 2; i++) {
+		s = &sf[i]->stream;
+		ustream_free(s);
+		ustream_init_defaults(s);
+	}
+
+	ustream_splice_pump(sp);
+	return 0;
+
+error:
+	ustream_splice_close(sp);
+	return -1;
+}
+
+void ustream_splice_free(struct ustream_splice *sp)
+{
+	ustream_splice_close(sp);
+}
+
+#else
+
+int ustream_splice_pair(struct ustream_splice *sp, struct ustream_fd *a,
+			struct ustream_fd *b)
+{
+	return -1;
+}
+
+void ustream_splice_free(struct ustream_splice *sp)
+{
+}
+
+#endif
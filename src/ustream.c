@@ -23,6 +23,57 @@
 #include <stdarg.h>
 
 #include "ustream.h"
+#include "libubox/format.h"
+
+#ifdef USTREAM_STATS
+struct ustream_stats ustream_global_stats;
+
+static uint64_t ustream_stat_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t ustream_global_buffered;
+
+/* track the buffered data of s and of all streams together */
+static void ustream_stat_buffered(struct ustream *s)
+{
+	uint64_t len = s->r.data_bytes + s->w.data_bytes;
+
+	ustream_global_buffered += len - s->stats_buffered;
+	s->stats_buffered = len;
+
+	if (len > s->stats.peak_buffered)
+		s->stats.peak_buffered = len;
+	if (ustream_global_buffered > ustream_global_stats.peak_buffered)
+		ustream_global_stats.peak_buffered = ustream_global_buffered;
+}
+
+static void ustream_stat_free(struct ustream *s)
+{
+	ustream_global_buffered -= s->stats_buffered;
+	s->stats_buffered = 0;
+}
+
+static void ustream_stat_blocked(struct ustream *s, bool blocked)
+{
+	uint64_t now = ustream_stat_time();
+
+	if (blocked) {
+		s->read_blocked_since = now;
+		return;
+	}
+
+	ustream_stat_add(s, read_blocked_us, now - s->read_blocked_since);
+}
+#else
+#define ustream_stat_buffered(s) do {} while (0)
+#define ustream_stat_free(s) do {} while (0)
+#define ustream_stat_blocked(s, blocked) do {} while (0)
+#endif
 
 static void ustream_init_buf(struct ustream_buf *buf, int len)
 {
@@ -67,11 +118,12 @@ static int ustream_alloc_default(struct ustream *s, struct ustream_buf_list *l)
 	buf = malloc(sizeof(*buf) + l->buffer_len + s->string_data);
 	ustream_init_buf(buf, l->buffer_len);
 	ustream_add_buf(l, buf);
+	ustream_stat_add(s, buf_alloc, 1);
 
 	return 0;
 }
 
-static void ustream_free_buffers(struct ustream_buf_list *l)
+static void ustream_free_buffers(struct ustream *s, struct ustream_buf_list *l)
 {
 	struct ustream_buf *buf = l->head;
 
@@ -79,6 +131,7 @@ static void ustream_free_buffers(struct ustream_buf_list *l)
 		struct ustream_buf *next = buf->next;
 
 		free(buf);
+		ustream_stat_add(s, buf_free, 1);
 		buf = next;
 	}
 	l->head = NULL;
@@ -92,8 +145,9 @@ void ustream_free(struct ustream *s)
 		s->free(s);
 
 	uloop_timeout_cancel(&s->state_change);
-	ustream_free_buffers(&s->r);
-	ustream_free_buffers(&s->w);
+	ustream_free_buffers(s, &s->r);
+	ustream_free_buffers(s, &s->w);
+	ustream_stat_free(s);
 }
 
 static void ustream_state_change_cb(struct uloop_timeout *t)
@@ -101,7 +155,7 @@ static void ustream_state_change_cb(struct uloop_timeout *t)
 	struct ustream *s = container_of(t, struct ustream, state_change);
 
 	if (s->write_error)
-		ustream_free_buffers(&s->w);
+		ustream_free_buffers(s, &s->w);
 	if (s->notify_state)
 		s->notify_state(s);
 }
@@ -138,6 +192,10 @@ void ustream_init_defaults(struct ustream *s)
 
 	s->w.buffers = 0;
 	s->w.data_bytes = 0;
+
+	memset(&s->stats, 0, sizeof(s->stats));
+	s->read_blocked_since = 0;
+	s->stats_buffered = 0;
 }
 
 static bool ustream_should_move(struct ustream_buf_list *l, struct ustream_buf *buf, int len)
@@ -168,7 +226,8 @@ static bool ustream_should_move(struct ustream_buf_list *l, struct ustream_buf *
 	return (buf->end - buf->tail < len);
 }
 
-static void ustream_free_buf(struct ustream_buf_list *l, struct ustream_buf *buf)
+static void ustream_free_buf(struct ustream *s, struct ustream_buf_list *l,
+			     struct ustream_buf *buf)
 {
 	if (buf == l->head)
 		l->head = buf->next;
@@ -181,6 +240,7 @@ static void ustream_free_buf(struct ustream_buf_list *l, struct ustream_buf *buf
 
 	if (--l->buffers >= l->min_buffers) {
 		free(buf);
+		ustream_stat_add(s, buf_free, 1);
 		return;
 	}
 
@@ -189,13 +249,15 @@ static void ustream_free_buf(struct ustream_buf_list *l, struct ustream_buf *buf
 	ustream_add_buf(l, buf);
 }
 
-static void __ustream_set_read_blocked(struct ustream *s, unsigned char val)
+void __ustream_set_read_blocked(struct ustream *s, unsigned char val)
 {
 	bool changed = !!s->read_blocked != !!val;
 
 	s->read_blocked = val;
-	if (changed)
+	if (changed) {
+		ustream_stat_blocked(s, !!val);
 		s->set_read_blocked(s);
+	}
 }
 
 void ustream_set_read_blocked(struct ustream *s, bool set)
@@ -229,10 +291,11 @@ void ustream_consume(struct ustream *s, int len)
 		}
 
 		len -= buf_len;
-		ustream_free_buf(&s->r, buf);
+		ustream_free_buf(s, &s->r, buf);
 		buf = next;
 	} while(len);
 
+	ustream_stat_buffered(s);
 	__ustream_set_read_blocked(s, s->read_blocked & ~READ_BLOCKED_FULL);
 }
 
@@ -254,6 +317,7 @@ static bool ustream_prepare_buf(struct ustream *s, struct ustream_buf_list *l, i
 			int len = buf->tail - buf->data;
 
 			memmove(buf->head, buf->data, len);
+			ustream_stat_add(s, memmove_bytes, len);
 			buf->data = buf->head;
 			buf->tail = buf->data + len;
 
@@ -302,6 +366,8 @@ void ustream_fill_read(struct ustream *s, int len)
 	int maxlen;
 
 	s->r.data_bytes += len;
+	ustream_stat_add(s, rx_bytes, len);
+	ustream_stat_buffered(s);
 	do {
 		if (!buf)
 			abort();
@@ -359,6 +425,16 @@ int ustream_read(struct ustream *s, char *buf, int buflen)
 	return len;
 }
 
+static int ustream_do_write(struct ustream *s, const char *buf, int len, bool more)
+{
+	int wr = s->write(s, buf, len, more);
+
+	if (wr > 0)
+		ustream_stat_add(s, tx_bytes, wr);
+
+	return wr;
+}
+
 static void ustream_write_error(struct ustream *s)
 {
 	if (!s->write_error)
@@ -366,19 +442,16 @@ static void ustream_write_error(struct ustream *s)
 	s->write_error = true;
 }
 
-bool ustream_write_pending(struct ustream *s)
+static int ustream_write_buffers(struct ustream *s)
 {
 	struct ustream_buf *buf = s->w.head;
 	int wr = 0, len;
 
-	if (s->write_error)
-		return false;
-
 	while (buf && s->w.data_bytes) {
 		struct ustream_buf *next = buf->next;
 		int maxlen = buf->tail - buf->data;
 
-		len = s->write(s, buf->data, maxlen, !!buf->next);
+		len = ustream_do_write(s, buf->data, maxlen, !!buf->next);
 		if (len < 0) {
 			ustream_write_error(s);
 			break;
@@ -394,10 +467,24 @@ bool ustream_write_pending(struct ustream *s)
 			break;
 		}
 
-		ustream_free_buf(&s->w, buf);
+		ustream_free_buf(s, &s->w, buf);
 		buf = next;
 	}
 
+	if (wr)
+		ustream_stat_buffered(s);
+
+	return wr;
+}
+
+bool ustream_write_pending(struct ustream *s)
+{
+	int wr;
+
+	if (s->write_error)
+		return false;
+
+	wr = ustream_write_buffers(s);
 	if (s->notify_write)
 		s->notify_write(s, wr);
 
@@ -407,6 +494,52 @@ bool ustream_write_pending(struct ustream *s)
 	return !s->w.data_bytes;
 }
 
+int ustream_transfer(struct ustream *s, struct ustream *dst)
+{
+	struct ustream_buf_list *w = &s->w, *r = &dst->r;
+	struct ustream_buf *buf;
+	int len, moved = 0;
+
+	while ((buf = w->head) && !(dst->read_blocked & READ_BLOCKED_USER)) {
+		len = buf->tail - buf->data;
+		if (!len)
+			break;
+
+		w->head = buf->next;
+		if (buf == w->data_tail)
+			w->data_tail = buf->next;
+		if (buf == w->tail)
+			w->tail = NULL;
+		w->buffers--;
+		w->data_bytes -= len;
+
+		buf->next = NULL;
+		if (r->tail)
+			r->tail->next = buf;
+		else
+			r->head = buf;
+		r->tail = r->data_tail = buf;
+		r->buffers++;
+		r->data_bytes += len;
+		ustream_fixup_string(dst, buf);
+
+		moved += len;
+	}
+
+	if (!moved)
+		return 0;
+
+	ustream_stat_add(s, tx_bytes, moved);
+	ustream_stat_add(dst, rx_bytes, moved);
+	ustream_stat_buffered(s);
+	ustream_stat_buffered(dst);
+
+	if (dst->notify_read)
+		dst->notify_read(dst, moved);
+
+	return moved;
+}
+
 static int ustream_write_buffered(struct ustream *s, const char *data, int len, int wr)
 {
 	struct ustream_buf_list *l = &s->w;
@@ -431,6 +564,7 @@ static int ustream_write_buffered(struct ustream *s, const char *data, int len,
 		l->data_bytes += maxlen;
 	}
 
+	ustream_stat_buffered(s);
 	return wr;
 }
 
@@ -443,7 +577,7 @@ int ustream_write(struct ustream *s, const char *data, int len, bool more)
 		return 0;
 
 	if (!l->data_bytes) {
-		wr = s->write(s, data, len, more);
+		wr = ustream_do_write(s, data, len, more);
 		if (wr == len)
 			return wr;
 
@@ -477,7 +611,7 @@ int ustream_vprintf(struct ustream *s, const char *format, va_list arg)
 		maxlen = vsnprintf(buf, MAX_STACK_BUFLEN, format, arg2);
 		va_end(arg2);
 		if (maxlen < MAX_STACK_BUFLEN) {
-			wr = s->write(s, buf, maxlen, false);
+			wr = ustream_do_write(s, buf, maxlen, false);
 			if (wr < 0) {
 				ustream_write_error(s);
 				return wr;
@@ -538,3 +672,59 @@ int ustream_printf(struct ustream *s, const char *format, ...)
 
 	return ret;
 }
+
+static int ustream_format_sink(void *priv, const u8 *data, size_t len)
+{
+	struct ustream *s = priv;
+
+	return ustream_write_buffered(s, (const char *) data, len, 0);
+}
+
+int ustream_vformat(struct ustream *s, const char *format, va_list *arg)
+{
+	bool idle;
+	int wr;
+
+	if (s->write_error)
+		return 0;
+
+	idle = !s->w.data_bytes;
+	wr = va_format_sink(ustream_format_sink, s, format, arg);
+
+	/* nothing was queued before, push out what we can right away */
+	if (idle && s->w.data_bytes)
+		ustream_write_buffers(s);
+
+	return wr;
+}
+
+int ustream_format(struct ustream *s, const char *format, ...)
+{
+	va_list arg;
+	int ret;
+
+	if (s->write_error)
+		return 0;
+
+	va_start(arg, format);
+	ret = ustream_vformat(s, format, &arg);
+	va_end(arg);
+
+	return ret;
+}
+
+void ustream_get_stats(struct ustream *s, struct ustream_stats *stats)
+{
+#ifdef USTREAM_STATS
+	if (!s) {
+		*stats = ustream_global_stats;
+		return;
+	}
+
+	*stats = s->stats;
+	if (s->read_blocked)
+		stats->read_blocked_us += ustream_stat_time() - s->read_blocked_since;
+#else
+	memset(stats, 0, sizeof(*stats));
+#endif
+}
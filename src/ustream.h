@@ -46,6 +46,26 @@ struct ustream_buf_list {
 	int buffers;
 };
 
+/*
+ * per-stream I/O counters, only maintained when built with USTREAM_STATS
+ * (cmake -DUSTREAM_STATS=ON). the layout of struct ustream does not depend
+ * on the setting.
+ * peak_buffered is the largest amount of read + write buffered data of a
+ * stream, or in the totals the largest sum over all streams at one time.
+ */
+struct ustream_stats {
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t read_calls;
+	uint64_t write_calls;
+	uint64_t eagain;
+	uint64_t buf_alloc;
+	uint64_t buf_free;
+	uint64_t memmove_bytes;
+	uint64_t peak_buffered;
+	uint64_t read_blocked_us;
+};
+
 struct ustream {
 	struct ustream_buf_list r, w;
 	struct uloop_timeout state_change;
@@ -117,11 +137,95 @@ struct ustream {
 	bool eof, eof_write_done;
 
 	enum read_blocked_reason read_blocked;
+
+	/* internal, see ustream_get_stats() */
+	struct ustream_stats stats;
+	uint64_t read_blocked_since;
+	uint64_t stats_buffered;
+};
+
+struct ustream_zc_buf {
+	struct list_head list;
+
+	/* caller owned memory, must stay untouched until release is called */
+	const char *data;
+	int len;
+
+	/*
+	 * release: (optional)
+	 * called once the kernel no longer references the data, or when the
+	 * stream is freed before the data could be sent. Data still in flight
+	 * when the stream is freed is released later from uloop, a duplicate
+	 * of the socket keeps it open until then.
+	 */
+	void (*release)(struct ustream_zc_buf *zb);
+
+	/* internal */
+	uint64_t offset;
+	int sent;
+
+	/* completion ids of the send() calls, and how many of them arrived */
+	uint32_t id;
+	uint32_t ids;
+	uint32_t done;
 };
 
 struct ustream_fd {
 	struct ustream stream;
 	struct uloop_fd fd;
+
+	/* MSG_ZEROCOPY state, see ustream_fd_set_zerocopy() */
+	struct {
+		struct list_head pending;
+		struct list_head inflight;
+		uint64_t written;
+		uint32_t next_id;
+		int threshold;
+	} zc;
+};
+
+struct ustream_mmap {
+	struct ustream stream;
+	struct uloop_timeout timer;
+	int fd;
+
+	char *map;
+	size_t map_len;
+	off_t map_offset;
+
+	off_t pos;
+	off_t size;
+	size_t window;
+};
+
+struct ustream_splice;
+
+struct ustream_splice_side {
+	struct ustream_splice *sp;
+	struct ustream_fd *sf;
+	struct uloop_fd fd;
+
+	/* buffered data from before the relay was set up, goes first */
+	struct ustream_buf *backlog;
+
+	/* pipe holding data read from this side */
+	int pipe[2];
+	int pipe_size;
+	int pending;
+	bool eof;
+};
+
+struct ustream_splice {
+	struct ustream_splice_side side[2];
+};
+
+struct ustream_pipe {
+	struct ustream stream;
+	struct ustream_pipe *peer;
+	struct uloop_timeout timer;
+
+	/* delay in ms before written data shows up on the peer */
+	int latency;
 };
 
 struct ustream_buf {
@@ -137,6 +241,72 @@ struct ustream_buf {
 /* ustream_fd_init: create a file descriptor ustream (uses uloop) */
 void ustream_fd_init(struct ustream_fd *s, int fd);
 
+/*
+ * ustream_fd_set_zerocopy: enable MSG_ZEROCOPY sends on a socket ustream
+ *
+ * threshold: minimum size for a zero-copy write, smaller writes are copied
+ * (0 selects USTREAM_ZC_THRESHOLD).
+ * returns -1 if the socket does not support zero-copy transmission.
+ */
+#define USTREAM_ZC_THRESHOLD	(16 * 1024)
+
+int ustream_fd_set_zerocopy(struct ustream_fd *s, int threshold);
+
+/*
+ * ustream_fd_write_zerocopy: queue caller owned memory for transmission
+ *
+ * the data is sent in stream order with MSG_ZEROCOPY and zb->release is
+ * called after the kernel has signalled completion on the error queue.
+ * below the threshold (or with zero-copy disabled) the data is copied into
+ * the write buffer and released right away.
+ * returns the number of bytes queued, or -1 on write error (in which case
+ * the caller keeps ownership and release is not called).
+ */
+int ustream_fd_write_zerocopy(struct ustream_fd *s, struct ustream_zc_buf *zb);
+
+/*
+ * ustream_mmap_init: create a read-only ustream on a regular file
+ *
+ * the file is exposed through ustream_get_read_buf() straight from a
+ * memory mapping of at most window bytes (0 selects USTREAM_MMAP_WINDOW),
+ * which is moved forward as data is consumed. string_data is not supported.
+ * the file size is sampled once: the file must not be truncated while the
+ * stream is in use, touching mapped pages past the new end raises SIGBUS.
+ * returns -1 if fd does not refer to a regular file.
+ */
+#define USTREAM_MMAP_WINDOW	(8 * 1024 * 1024)
+
+int ustream_mmap_init(struct ustream_mmap *s, int fd, size_t window);
+
+/*
+ * ustream_splice_pair: relay all data between two fd ustreams in the kernel
+ *
+ * takes over polling of both fds and moves data in both directions through
+ * pipes with splice(), so it never enters user space. data already sitting
+ * in the read or write buffers is relayed first. reading stops while a
+ * pipe is full, an EOF is passed on with shutdown() once the data before
+ * it has been relayed. once one side can no longer be written to, data
+ * from the other side is read and dropped until it hits EOF.
+ * the streams only report state afterwards: notify_state is called with
+ * eof set on the side that hit EOF, or write_error set on the side that
+ * could not be written to.
+ * returns -1 if the relay could not be set up (or splice is unsupported).
+ */
+int ustream_splice_pair(struct ustream_splice *sp, struct ustream_fd *a,
+			struct ustream_fd *b);
+
+/* ustream_splice_free: stop relaying and release the pipes */
+void ustream_splice_free(struct ustream_splice *sp);
+
+/*
+ * ustream_pipe_pair: connect two ustreams in memory (uses uloop)
+ *
+ * data written to one side is handed over to the read side of the other
+ * as whole buffers, after the configured latency. freeing one side flushes
+ * its pending output and signals EOF to the other.
+ */
+void ustream_pipe_pair(struct ustream_pipe *a, struct ustream_pipe *b);
+
 /* ustream_free: free all buffers and data associated with a ustream */
 void ustream_free(struct ustream *s);
 
@@ -153,6 +323,16 @@ int ustream_write(struct ustream *s, const char *buf, int len, bool more);
 int ustream_printf(struct ustream *s, const char *format, ...);
 int ustream_vprintf(struct ustream *s, const char *format, va_list arg);
 
+/*
+ * ustream_format: add va_format() style output to the write buffer
+ *
+ * the output is generated directly into the write buffers, spanning as
+ * many of them as needed, without temporary allocations or a second
+ * formatting pass. see format.h for the supported conversions.
+ */
+int ustream_format(struct ustream *s, const char *format, ...);
+int ustream_vformat(struct ustream *s, const char *format, va_list *arg);
+
 /* ustream_get_read_buf: get a pointer to the next read buffer data */
 char *ustream_get_read_buf(struct ustream *s, int *buflen);
 
@@ -181,8 +361,26 @@ static inline bool ustream_read_buf_full(struct ustream *s)
 	       s->r.buffers == s->r.max_buffers;
 }
 
+/*
+ * ustream_get_stats: fetch the I/O counters of a stream, or the totals of
+ * all streams if s is NULL. all zero without USTREAM_STATS.
+ */
+void ustream_get_stats(struct ustream *s, struct ustream_stats *stats);
+
 /*** --- functions only used by ustream implementations --- ***/
 
+#ifdef USTREAM_STATS
+extern struct ustream_stats ustream_global_stats;
+
+#define ustream_stat_add(_s, _field, _val)			\
+	do {							\
+		(_s)->stats._field += (_val);			\
+		ustream_global_stats._field += (_val);		\
+	} while (0)
+#else
+#define ustream_stat_add(_s, _field, _val) do {} while (0)
+#endif
+
 /* ustream_init_defaults: fill default callbacks and options */
 void ustream_init_defaults(struct ustream *s);
 
@@ -197,6 +395,23 @@ char *ustream_reserve(struct ustream *s, int len, int *maxlen);
 /* ustream_fill_read: mark rx buffer space as filled */
 void ustream_fill_read(struct ustream *s, int len);
 
+/*
+ * __ustream_set_read_blocked: replace the read_blocked flags (for stream
+ * implementations), calls set_read_blocked if the stream got (un)blocked
+ */
+void __ustream_set_read_blocked(struct ustream *s, unsigned char val);
+
+/*
+ * ustream_transfer: move the buffered write data of s to the read side of dst
+ *
+ * whole buffers are relinked instead of copied, so the writer must
+ * allocate room for the string terminator if dst uses string_data, and dst
+ * must not keep spare read buffers (r.min_buffers = 0).
+ * stops when dst is read blocked by the user, returns the number of bytes
+ * moved.
+ */
+int ustream_transfer(struct ustream *s, struct ustream *dst);
+
 /*
  * ustream_write_pending: attempt to write more data from write buffers
  * returns true if all write buffers have been emptied.